@@ -2,9 +2,10 @@
 
 layout(location=0) out vec4 color;
 
-in vec2 fragTexCoord;
-uniform sampler2D areaLightTex;
+in vec3 fragTexCoord; // uv and layer in the light texture array
+uniform sampler2DArray areaLightTex;
 uniform int useTexture;
+const float AREA_LIGHT_BORDER = 0.125; // padding around the light in areaLightTex, see lightPrefilter.h
 
 void main() {
     // Sample the area light texture
@@ -12,6 +13,7 @@ void main() {
         color = vec4(0.8, 0.8, 0.8, 1);
     }
     else {
-        color = texture(areaLightTex, fragTexCoord);
+        vec2 uv = AREA_LIGHT_BORDER + (1.0 - 2.0 * AREA_LIGHT_BORDER) * fragTexCoord.xy;
+        color = texture(areaLightTex, vec3(uv, fragTexCoord.z));
     }
 }
\ No newline at end of file
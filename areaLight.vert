@@ -1,10 +1,10 @@
 #version 330 core
 
 layout(location=0) in vec3 pos; // vector position
-layout(location=1) in vec2 txc;
+layout(location=1) in vec3 txc; // uv and layer in the light texture array
 
 out vec3 fragPos;		// the position of current fragment
-out vec2 fragTexCoord;
+out vec3 fragTexCoord;
 
 uniform mat4 modelMat;
 uniform mat4 viewMat;
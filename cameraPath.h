@@ -0,0 +1,177 @@
+// --------------------------------------------------------------------------------
+// Camera paths for repeatable flythroughs.
+//
+// A path is a list of keyframes of the camera: the time in seconds, the
+// position and the theta and phi angles of main.cpp in degrees. Between the
+// keys the camera follows a cubic Hermite spline whose tangents are the finite
+// differences of the neighbouring keys, so it passes through every key and the
+// keys need not be evenly spaced. The angles are interpolated as they are,
+// theta is not wrapped, so a recorded turn past 360 degrees plays as it was.
+//
+// The file is text, one key per line after a "cameraPath 1" header:
+//     time x y z theta phi
+// Blank lines and lines starting with # are skipped.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cyVector.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// One keyframe of the camera.
+/// </summary>
+struct CameraKey {
+	float time;
+	cy::Vec3f position;
+	float theta;
+	float phi;
+};
+
+/// <summary>
+/// Keyframes of the camera, sorted by time.
+/// </summary>
+class CameraPath {
+public:
+	/// <summary>
+	/// Reads a path file, replacing the keys.
+	/// </summary>
+	/// <returns> false, with an error printed, if the file cannot be read or has no keys </returns>
+	bool Load(const char* filename) {
+		std::ifstream file(filename);
+		if (!file) {
+			std::cerr << "Error: Failed to open camera path: " << filename << std::endl;
+			return false;
+		}
+		keys.clear();
+		std::string line;
+		int lineNumber = 0;
+		bool header = false;
+		while (std::getline(file, line)) {
+			lineNumber++;
+			size_t first = line.find_first_not_of(" \t\r");
+			if (first == std::string::npos || line[first] == '#') {
+				continue;
+			}
+			std::istringstream fields(line);
+			if (!header) {
+				std::string magic;
+				int version = 0;
+				fields >> magic >> version;
+				if (magic != "cameraPath" || version != 1) {
+					std::cerr << "Error: " << filename << " is not a camera path file" << std::endl;
+					return false;
+				}
+				header = true;
+				continue;
+			}
+			CameraKey key;
+			if (!(fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.theta >> key.phi)) {
+				std::cerr << "Error: " << filename << ":" << lineNumber << ": expected time x y z theta phi" << std::endl;
+				return false;
+			}
+			keys.push_back(key);
+		}
+		if (keys.empty()) {
+			std::cerr << "Error: Camera path " << filename << " has no keys" << std::endl;
+			return false;
+		}
+		std::stable_sort(keys.begin(), keys.end(), [](const CameraKey& a, const CameraKey& b) { return a.time < b.time; });
+		return true;
+	}
+
+	/// <summary>
+	/// Writes the keys to a path file.
+	/// </summary>
+	/// <returns> false, with an error printed, if the file cannot be written </returns>
+	bool Save(const char* filename) const {
+		std::ofstream file(filename);
+		if (!file) {
+			std::cerr << "Error: Failed to create camera path: " << filename << std::endl;
+			return false;
+		}
+		file << "cameraPath 1" << std::endl;
+		file << "# time x y z theta phi" << std::endl;
+		file << std::fixed << std::setprecision(4);
+		for (const CameraKey& key : keys) {
+			file << key.time << " " << key.position.x << " " << key.position.y << " " << key.position.z << " "
+				<< key.theta << " " << key.phi << std::endl;
+		}
+		return bool(file);
+	}
+
+	/// <summary>
+	/// Appends a key, its time must not be before the last one.
+	/// </summary>
+	void Add(const CameraKey& key) { keys.push_back(key); }
+
+	void Clear() { keys.clear(); }
+	bool Empty() const { return keys.empty(); }
+	size_t Size() const { return keys.size(); }
+
+	/// <summary>
+	/// The time of the first and of the last key.
+	/// </summary>
+	float StartTime() const { return keys.empty() ? 0.0f : keys.front().time; }
+	float EndTime() const { return keys.empty() ? 0.0f : keys.back().time; }
+
+	/// <summary>
+	/// The camera at a time, held at the first and last key outside of the path.
+	/// Phi is kept within the +-89 degrees of the mouse.
+	/// </summary>
+	CameraKey Sample(float time) const {
+		if (keys.empty()) {
+			return CameraKey{ time, cy::Vec3f(0.0f, 0.0f, 0.0f), 0.0f, 0.0f };
+		}
+		if (time <= keys.front().time || keys.size() == 1) {
+			return Keyed(keys.front(), time);
+		}
+		if (time >= keys.back().time) {
+			return Keyed(keys.back(), time);
+		}
+		size_t i = std::upper_bound(keys.begin(), keys.end(), time, [](float t, const CameraKey& key) { return t < key.time; }) - keys.begin() - 1;
+		const CameraKey& a = keys[i];
+		const CameraKey& b = keys[i + 1];
+		const CameraKey& before = keys[i > 0 ? i - 1 : i];
+		const CameraKey& after = keys[i + 2 < keys.size() ? i + 2 : i + 1];
+		float span = b.time - a.time;
+		if (span <= 0.0f) {
+			return Keyed(b, time);
+		}
+		float u = (time - a.time) / span;
+		// the tangents are scaled from their own time spans to the span of the segment
+		float spanA = span / std::max(b.time - before.time, 1e-6f);
+		float spanB = span / std::max(after.time - a.time, 1e-6f);
+		CameraKey key;
+		key.time = time;
+		key.position = Hermite(a.position, b.position, (b.position - before.position) * spanA, (after.position - a.position) * spanB, u);
+		key.theta = Hermite(a.theta, b.theta, (b.theta - before.theta) * spanA, (after.theta - a.theta) * spanB, u);
+		key.phi = Hermite(a.phi, b.phi, (b.phi - before.phi) * spanA, (after.phi - a.phi) * spanB, u);
+		key.phi = std::min(std::max(key.phi, -89.0f), 89.0f);
+		return key;
+	}
+
+private:
+	static CameraKey Keyed(const CameraKey& key, float time) {
+		CameraKey sample = key;
+		sample.time = time;
+		sample.phi = std::min(std::max(sample.phi, -89.0f), 89.0f);
+		return sample;
+	}
+
+	template <typename T>
+	static T Hermite(const T& p0, const T& p1, const T& m0, const T& m1, float u) {
+		float u2 = u * u;
+		float u3 = u2 * u;
+		return p0 * (2.0f * u3 - 3.0f * u2 + 1.0f) + m0 * (u3 - 2.0f * u2 + u) + p1 * (-2.0f * u3 + 3.0f * u2) + m1 * (u3 - u2);
+	}
+
+	std::vector<CameraKey> keys;
+};
@@ -0,0 +1,7 @@
+#version 330 core
+
+// The depth pre-pass of the water: the tessellated waves only write depth, so
+// the shading pass that follows lights every visible pixel once.
+
+void main() {
+}
@@ -0,0 +1,38 @@
+// The directional light and the light of the sky, for the water (tessShader.frag).
+
+#include "gamma.glsl"
+
+// Directional light
+uniform vec3 lightDir;          // Light direction = w
+uniform vec3 lightColor;        // Light color
+uniform float constShininess;   // the shininess of the reflection = alpha
+uniform float constLightIntensity;
+uniform float constAmbientLight;
+uniform vec3 skySH[9];            // irradiance / pi of the skybox, spherical harmonics with the basis constants folded in
+
+// Diffuse light of the skybox for the unit normal n, from its 9 spherical
+// harmonics coefficients (shIrradiance.h).
+vec3 skyIrradiance(vec3 n) {
+    vec3 e = skySH[0]
+           + skySH[1] * n.y + skySH[2] * n.z + skySH[3] * n.x
+           + skySH[4] * (n.x * n.y) + skySH[5] * (n.y * n.z) + skySH[6] * (3.0 * n.z * n.z - 1.0)
+           + skySH[7] * (n.x * n.z) + skySH[8] * (n.x * n.x - n.y * n.y);
+    return max(e, vec3(0.0));
+}
+
+// Standard directional lighting (diffuse + Blinn-Phong specular).
+void directionalLight(vec3 N, vec3 V, vec3 baseColor, out vec3 diffuse, out vec3 specular) {
+    vec3 dirW = normalize(-lightDir);   // omega
+    float dirCosTheta = max(dot(N, dirW), 0.0);
+    diffuse = lightColor * dirCosTheta * baseColor;
+
+    vec3 h = normalize(dirW + V);       // half vector
+    float dirCosPhi = max(dot(N, h), 0.0);
+    vec3 dirSpecReflCol = vec3(0.8);    // K_s
+    specular = lightColor * dirSpecReflCol * pow(dirCosPhi, constShininess);
+}
+
+// Ambient light of the sky on a surface of the given color (K_a).
+vec3 skyAmbient(vec3 N, vec3 baseColor) {
+    return baseColor * toSRGB(skyIrradiance(N));
+}
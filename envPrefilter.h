@@ -0,0 +1,348 @@
+// --------------------------------------------------------------------------------
+// GGX prefiltering of the environment map for the split-sum approximation.
+//
+// Following "Real Shading in Unreal Engine 4" (Karis 2013), the specular image
+// based lighting is split in two factors. The prefiltered radiance is stored in
+// the mip levels of the cube map, level i holding the GGX lobe of perceptual
+// roughness i / (levels - 1) with N = V = R. The directional albedo of the BRDF
+// is a 2D table of a scale and a bias to F0, indexed by N.V and roughness.
+//
+// The convolution uses filtered importance sampling ("Real-time Shading with
+// Filtered Importance Sampling", Krivanek and Colbert 2008): each GGX sample
+// reads a box filtered mip of the source whose texel covers the solid angle
+// of the sample, so a few dozen samples per texel give a smooth result. The
+// levels are computed in linear color and the rows are split between threads.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <lightPrefilter.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// The 6 faces of one cube map level, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order.
+/// </summary>
+typedef std::array<FilteredLevel, 6> CubeLevel;
+
+const float ENV_PI = 3.14159265358979f;
+
+/// <summary>
+/// Returns the unnormalized direction through the point (u, v) in [0, 1] of a face,
+/// following the cube map face selection table of the OpenGL specification.
+/// </summary>
+inline void cubeDirection(int face, float u, float v, float* dir) {
+	float sc = 2.0f * u - 1.0f;
+	float tc = 2.0f * v - 1.0f;
+	switch (face) {
+	case 0: dir[0] = 1.0f; dir[1] = -tc; dir[2] = -sc; break;
+	case 1: dir[0] = -1.0f; dir[1] = -tc; dir[2] = sc; break;
+	case 2: dir[0] = sc; dir[1] = 1.0f; dir[2] = tc; break;
+	case 3: dir[0] = sc; dir[1] = -1.0f; dir[2] = -tc; break;
+	case 4: dir[0] = sc; dir[1] = -tc; dir[2] = 1.0f; break;
+	default: dir[0] = -sc; dir[1] = -tc; dir[2] = -1.0f; break;
+	}
+}
+
+/// <summary>
+/// Bilinear lookup of a cube map level in the direction dir (any length).
+/// The lookup clamps at the face edges instead of filtering across them.
+/// </summary>
+inline void sampleCube(const CubeLevel& level, const float* dir, float* out) {
+	float ax = std::fabs(dir[0]), ay = std::fabs(dir[1]), az = std::fabs(dir[2]);
+	int face;
+	float sc, tc, ma;
+	if (ax >= ay && ax >= az) {
+		face = dir[0] > 0.0f ? 0 : 1;
+		ma = ax;
+		sc = dir[0] > 0.0f ? -dir[2] : dir[2];
+		tc = -dir[1];
+	}
+	else if (ay >= az) {
+		face = dir[1] > 0.0f ? 2 : 3;
+		ma = ay;
+		sc = dir[0];
+		tc = dir[1] > 0.0f ? dir[2] : -dir[2];
+	}
+	else {
+		face = dir[2] > 0.0f ? 4 : 5;
+		ma = az;
+		sc = dir[2] > 0.0f ? dir[0] : -dir[0];
+		tc = -dir[1];
+	}
+	sampleBilinear(level[face], 0.5f * (sc / ma + 1.0f), 0.5f * (tc / ma + 1.0f), out);
+}
+
+/// <summary>
+/// Trilinear lookup in a box filtered chain of cube map levels.
+/// </summary>
+inline void sampleCubeLod(const std::vector<CubeLevel>& chain, const float* dir, float lod, float* out) {
+	lod = std::min(std::max(lod, 0.0f), float(chain.size() - 1));
+	int level0 = int(lod);
+	int level1 = std::min(level0 + 1, int(chain.size() - 1));
+	float t = lod - level0;
+	float a[4], b[4];
+	sampleCube(chain[level0], dir, a);
+	if (t <= 0.0f || level1 == level0) {
+		std::copy(a, a + 4, out);
+		return;
+	}
+	sampleCube(chain[level1], dir, b);
+	for (int i = 0; i < 4; i++) out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+/// <summary>
+/// The i-th point of a Hammersley set of n points in [0, 1)^2.
+/// </summary>
+inline void hammersley(unsigned i, unsigned n, float* xi) {
+	unsigned bits = i;
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	xi[0] = float(i) / float(n);
+	xi[1] = float(bits) * 2.3283064365386963e-10f;
+}
+
+/// <summary>
+/// Samples a GGX half vector around +Z. Returns cos(theta_h).
+/// </summary>
+inline float sampleGGX(const float* xi, float alpha, float* h) {
+	float phi = 2.0f * ENV_PI * xi[0];
+	float cosTheta = std::sqrt((1.0f - xi[1]) / (1.0f + (alpha * alpha - 1.0f) * xi[1]));
+	float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+	h[0] = sinTheta * std::cos(phi);
+	h[1] = sinTheta * std::sin(phi);
+	h[2] = cosTheta;
+	return cosTheta;
+}
+
+/// <summary>
+/// The GGX normal distribution.
+/// </summary>
+inline float ggxD(float cosThetaH, float alpha) {
+	float a2 = alpha * alpha;
+	float d = cosThetaH * cosThetaH * (a2 - 1.0f) + 1.0f;
+	return a2 / (ENV_PI * d * d);
+}
+
+/// <summary>
+/// Builds an orthonormal basis (t, b, n) around the unit vector n.
+/// </summary>
+inline void tangentFrame(const float* n, float* t, float* b) {
+	float up[3] = { 0.0f, 0.0f, 1.0f };
+	if (std::fabs(n[2]) > 0.999f) {
+		up[0] = 1.0f;
+		up[2] = 0.0f;
+	}
+	t[0] = up[1] * n[2] - up[2] * n[1];
+	t[1] = up[2] * n[0] - up[0] * n[2];
+	t[2] = up[0] * n[1] - up[1] * n[0];
+	float length = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+	for (int i = 0; i < 3; i++) t[i] /= length;
+	b[0] = n[1] * t[2] - n[2] * t[1];
+	b[1] = n[2] * t[0] - n[0] * t[2];
+	b[2] = n[0] * t[1] - n[1] * t[0];
+}
+
+/// <summary>
+/// The GGX prefiltered radiance in the direction R (unit length), estimated with
+/// filtered importance sampling from the box filtered chain of the source.
+/// </summary>
+/// <param name="source"> box filtered chain of the source, level 0 is the full resolution </param>
+/// <param name="R"> the reflected direction, also the normal and view direction </param>
+/// <param name="alpha"> GGX alpha, the square of the perceptual roughness </param>
+/// <param name="numSamples"> the number of GGX samples </param>
+/// <param name="out"> receives the RGBA radiance </param>
+inline void prefilteredRadiance(const std::vector<CubeLevel>& source, const float* R, float alpha, unsigned numSamples, float* out) {
+	float t[3], b[3];
+	tangentFrame(R, t, b);
+	float texelSolidAngle = 4.0f * ENV_PI / (6.0f * source[0][0].width * source[0][0].width);
+	float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	float weight = 0.0f;
+	for (unsigned i = 0; i < numSamples; i++) {
+		float xi[2], h[3];
+		hammersley(i, numSamples, xi);
+		float cosThetaH = sampleGGX(xi, alpha, h);
+		// with N = V = R, L = reflect(-V, H) and N.L = 2 (N.H)^2 - 1
+		float cosThetaL = 2.0f * cosThetaH * cosThetaH - 1.0f;
+		if (cosThetaL <= 0.0f) {
+			continue;
+		}
+		float H[3], L[3];
+		for (int k = 0; k < 3; k++) H[k] = h[0] * t[k] + h[1] * b[k] + h[2] * R[k];
+		for (int k = 0; k < 3; k++) L[k] = 2.0f * cosThetaH * H[k] - R[k];
+
+		// the pdf of L is D / 4 when N = V, pick the level whose texels cover the sample
+		float pdf = ggxD(cosThetaH, alpha) * 0.25f;
+		float sampleSolidAngle = 1.0f / (numSamples * pdf + 1e-6f);
+		float lod = 0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f;
+		float c[4];
+		sampleCubeLod(source, L, lod, c);
+		for (int k = 0; k < 4; k++) sum[k] += c[k] * cosThetaL;
+		weight += cosThetaL;
+	}
+	for (int k = 0; k < 4; k++) out[k] = weight > 0.0f ? sum[k] / weight : 0.0f;
+}
+
+/// <summary>
+/// Converts a level between display (gamma 2.2) and linear color, the alpha is kept.
+/// </summary>
+inline void convertGamma(FilteredLevel& level, float exponent) {
+	for (size_t i = 0; i < level.rgba.size(); i++) {
+		if (i % 4 != 3) {
+			level.rgba[i] = std::pow(std::max(level.rgba[i], 0.0f), exponent);
+		}
+	}
+}
+
+/// <summary>
+/// Builds the GGX prefiltered chain of a cube map.
+/// </summary>
+/// <param name="faces"> the faces of the source in display color, square and of the same size </param>
+/// <param name="numLevels"> the number of roughness levels, level i has the perceptual roughness i / (numLevels - 1) </param>
+/// <param name="numSamples"> GGX samples per texel </param>
+/// <param name="numThreads"> worker threads, 0 for one per hardware thread </param>
+/// <returns> the levels in display color, halving in size like a mip chain </returns>
+inline std::vector<CubeLevel> prefilterEnvironment(const CubeLevel& faces, int numLevels, unsigned numSamples, unsigned numThreads = 0) {
+	// box filtered chain of the source in linear color
+	std::vector<CubeLevel> source(1, faces);
+	for (FilteredLevel& face : source[0]) {
+		convertGamma(face, 2.2f);
+	}
+	while (source.back()[0].width > 1) {
+		CubeLevel next;
+		for (int f = 0; f < 6; f++) {
+			next[f] = decimate(source.back()[f]);
+		}
+		source.push_back(std::move(next));
+	}
+	numLevels = std::max(1, std::min(numLevels, int(source.size())));
+
+	// the rows of all the faces of all the levels, handed out to the threads one by one
+	std::vector<CubeLevel> chain(numLevels);
+	chain[0] = faces;
+	struct Row { int level, face, y; };
+	std::vector<Row> rows;
+	for (int level = 1; level < numLevels; level++) {
+		for (int f = 0; f < 6; f++) {
+			FilteredLevel& face = chain[level][f];
+			face.width = source[level][f].width;
+			face.height = source[level][f].height;
+			face.rgba.resize(size_t(face.width) * face.height * 4);
+			for (int y = 0; y < face.height; y++) {
+				rows.push_back({ level, f, y });
+			}
+		}
+	}
+
+	std::atomic<size_t> nextRow(0);
+	auto work = [&] {
+		for (size_t r = nextRow++; r < rows.size(); r = nextRow++) {
+			const Row& row = rows[r];
+			FilteredLevel& face = chain[row.level][row.face];
+			float roughness = float(row.level) / float(numLevels - 1);
+			for (int x = 0; x < face.width; x++) {
+				float R[3];
+				cubeDirection(row.face, (x + 0.5f) / face.width, (row.y + 0.5f) / face.height, R);
+				float length = std::sqrt(R[0] * R[0] + R[1] * R[1] + R[2] * R[2]);
+				for (int k = 0; k < 3; k++) R[k] /= length;
+				float* out = &face.rgba[(size_t(row.y) * face.width + x) * 4];
+				prefilteredRadiance(source, R, roughness * roughness, numSamples, out);
+				for (int k = 0; k < 3; k++) out[k] = std::pow(std::max(out[k], 0.0f), 1.0f / 2.2f);
+			}
+		}
+	};
+	if (numThreads == 0) {
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < numThreads; i++) {
+		threads.emplace_back(work);
+	}
+	work();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	return chain;
+}
+
+/// <summary>
+/// Builds the split-sum BRDF table: for N.V (x) and perceptual roughness (y),
+/// the scale and bias to F0 of the directional albedo of the GGX BRDF.
+/// </summary>
+/// <param name="size"> the width and height of the table </param>
+/// <param name="numSamples"> GGX samples per entry </param>
+/// <returns> size * size RG pairs, row by row </returns>
+inline std::vector<float> buildEnvBrdfTable(int size, unsigned numSamples) {
+	std::vector<float> table(size_t(size) * size * 2);
+	for (int y = 0; y < size; y++) {
+		float roughness = (y + 0.5f) / size;
+		float alpha = roughness * roughness;
+		float k = alpha * 0.5f; // Smith-Schlick k for image based lighting
+		for (int x = 0; x < size; x++) {
+			float dotNV = (x + 0.5f) / size;
+			float V[3] = { std::sqrt(1.0f - dotNV * dotNV), 0.0f, dotNV };
+			float scale = 0.0f, bias = 0.0f;
+			for (unsigned i = 0; i < numSamples; i++) {
+				float xi[2], H[3];
+				hammersley(i, numSamples, xi);
+				float dotNH = sampleGGX(xi, alpha, H);
+				float dotVH = V[0] * H[0] + V[1] * H[1] + V[2] * H[2];
+				float dotNL = 2.0f * dotVH * H[2] - V[2];
+				if (dotNL <= 0.0f) {
+					continue;
+				}
+				float G = dotNL / (dotNL * (1.0f - k) + k) * dotNV / (dotNV * (1.0f - k) + k);
+				float visibility = G * std::max(dotVH, 0.0f) / (dotNH * dotNV);
+				float fresnel = std::pow(1.0f - std::max(dotVH, 0.0f), 5.0f);
+				scale += (1.0f - fresnel) * visibility;
+				bias += fresnel * visibility;
+			}
+			table[(size_t(y) * size + x) * 2 + 0] = scale / numSamples;
+			table[(size_t(y) * size + x) * 2 + 1] = bias / numSamples;
+		}
+	}
+	return table;
+}
+
+/// <summary>
+/// Brute force GGX prefiltered radiance in the direction R: the average of every
+/// texel of the source weighted by D(H) N.L and its solid angle. This is the
+/// reference the importance sampled levels are checked against.
+/// </summary>
+/// <param name="faces"> the source in linear color </param>
+inline void referenceRadiance(const CubeLevel& faces, const float* R, float alpha, float* out) {
+	double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+	double weight = 0.0;
+	int size = faces[0].width;
+	for (int f = 0; f < 6; f++) {
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				float L[3];
+				float u = (x + 0.5f) / size, v = (y + 0.5f) / size;
+				cubeDirection(f, u, v, L);
+				float length2 = L[0] * L[0] + L[1] * L[1] + L[2] * L[2];
+				float length = std::sqrt(length2);
+				float dotNL = (L[0] * R[0] + L[1] * R[1] + L[2] * R[2]) / length;
+				if (dotNL <= 0.0f) {
+					continue;
+				}
+				// solid angle of the texel: (2 / size)^2 / |L|^3 on the unit cube
+				float solidAngle = 4.0f / (size * size * length2 * length);
+				float dotNH = std::sqrt(0.5f * (1.0f + dotNL)); // H is halfway between L and N = V
+				double w = double(ggxD(dotNH, alpha)) * dotNL * solidAngle;
+				const float* c = faces[f].texel(x, y);
+				for (int k = 0; k < 4; k++) sum[k] += c[k] * w;
+				weight += w;
+			}
+		}
+	}
+	for (int k = 0; k < 4; k++) out[k] = weight > 0.0 ? float(sum[k] / weight) : 0.0f;
+}
@@ -9,7 +9,7 @@ uniform int isDirectionalLight; // Flag to toggle environment map
 void main() {
     // Sample the environment map using the direction vector
     if (isDirectionalLight == 1)
-        color = texture(env, texCoord);
+        color = textureLod(env, texCoord, 0.0); // the next levels are prefiltered for the water
     else
         color = vec4(0.15, 0.15, 0.15, 1.0);
 }
\ No newline at end of file
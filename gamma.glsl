@@ -0,0 +1,13 @@
+///////////////////////////////////////
+// Gamma correction helper functions //
+///////////////////////////////////////
+// source: https://learnopengl.com/Advanced-Lighting/Gamma-Correction
+
+vec3 powVec3(vec3 v, float p) {
+    return vec3(pow(v.x, p), pow(v.y, p), pow(v.z, p));
+}
+const float gamma = 2.2;
+
+vec3 toSRGB(vec3 v)   {
+    return powVec3(v, 1.0 / gamma);
+}
@@ -0,0 +1,320 @@
+// --------------------------------------------------------------------------------
+// GPU timing of the render passes.
+//
+// Every pass owns a ring of GL_TIME_ELAPSED queries, one per frame in flight. A
+// query is read back when its slot comes around again a few frames later, so
+// timing never waits for the GPU. The results are averaged until the next
+// report. Time elapsed queries cannot nest: the passes are timed one after
+// the other. A pass can also count the samples that pass the depth test
+// (GL_SAMPLES_PASSED), the fragments it shades, to measure overdraw, and
+// with GL_ARB_pipeline_statistics_query the work of every stage: the patches
+// and evaluations of the tessellation, the primitives out of the geometry
+// shader, through the clipper, and the fragment shader invocations. Unlike
+// the samples passed, the fragment invocations may include the fragments the
+// early depth test later rejects, depending on the driver.
+//
+// When tracing is compiled in (trace.h), every pass also writes GL_TIMESTAMP
+// queries at its start and end, read back with the time elapsed, and is added
+// to the GPU track of the trace. The GPU clock is mapped to the clock of the
+// trace by reading both at once when the timing is turned on and at every
+// report, which keeps the drift between them small.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <trace.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Times named passes on the GPU.
+/// </summary>
+class GpuTimers {
+public:
+	static const int FramesInFlight = 4;
+
+	/// <summary>
+	/// The pipeline statistics counted for a pass.
+	/// </summary>
+	enum PipelineStatistic {
+		VertexInvocations,
+		TessControlPatches,
+		TessEvaluationInvocations,
+		GeometryPrimitives,
+		ClippingInputPrimitives,
+		ClippingOutputPrimitives,
+		FragmentInvocations,
+		NumPipelineStatistics
+	};
+	static const char* PipelineStatisticName(int statistic) {
+		const char* names[NumPipelineStatistics] = { "vertex invocations", "tess control patches", "tess evaluation invocations",
+			"geometry primitives", "clipping input", "clipping output", "fragment invocations" };
+		return names[statistic];
+	}
+
+	/// <summary>
+	/// Turns the timing on or off, the passes are not timed while it is off.
+	/// </summary>
+	void SetEnabled(bool enable) {
+		enabled = enable;
+		for (Pass& pass : passes) {
+			for (bool& issued : pass.issued) issued = false;
+			ResetTotals(pass);
+		}
+		if (enabled) {
+			Calibrate();
+		}
+	}
+	bool IsEnabled() const { return enabled; }
+
+	/// <summary>
+	/// Starts timing a pass. The previous result of its slot is collected first.
+	/// </summary>
+	/// <param name="name"> the name of the pass </param>
+	/// <param name="countFragments"> whether to count the samples that pass the depth test too </param>
+	/// <param name="countPipeline"> whether to count the pipeline statistics too, if the driver supports them </param>
+	void Begin(const char* name, bool countFragments = false, bool countPipeline = false) {
+		if (!enabled) {
+			return;
+		}
+		active = FindPass(name);
+		Pass& pass = passes[active];
+		int slot = frame % FramesInFlight;
+		if (pass.issued[slot]) {
+			GLint available = GL_FALSE;
+			glGetQueryObjectiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available && pass.countFragments) {
+				glGetQueryObjectiv(pass.fragmentQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			}
+			if (available && pass.countPipeline) {
+				glGetQueryObjectiv(pass.pipelineQueries[slot][NumPipelineStatistics - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			}
+			if (available) {
+				GLuint64 nanoseconds = 0;
+				glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &nanoseconds);
+				pass.totalMs += nanoseconds * 1e-6;
+				if (pass.countFragments) {
+					GLuint64 fragments = 0;
+					glGetQueryObjectui64v(pass.fragmentQueries[slot], GL_QUERY_RESULT, &fragments);
+					pass.totalFragments += double(fragments);
+				}
+				if (pass.countPipeline) {
+					for (int statistic = 0; statistic < NumPipelineStatistics; statistic++) {
+						GLuint64 count = 0;
+						glGetQueryObjectui64v(pass.pipelineQueries[slot][statistic], GL_QUERY_RESULT, &count);
+						pass.totalStatistics[statistic] += double(count);
+					}
+				}
+				if constexpr (TraceEnabled) {
+					GLint ended = GL_FALSE;
+					glGetQueryObjectiv(pass.timestampQueries[slot][1], GL_QUERY_RESULT_AVAILABLE, &ended);
+					if (ended) {
+						GLuint64 begin = 0, end = 0;
+						glGetQueryObjectui64v(pass.timestampQueries[slot][0], GL_QUERY_RESULT, &begin);
+						glGetQueryObjectui64v(pass.timestampQueries[slot][1], GL_QUERY_RESULT, &end);
+						Tracer::GpuZone(pass.traceName, int64_t(begin) + clockOffset, int64_t(end) + clockOffset);
+					}
+				}
+				pass.samples++;
+			}
+		}
+		if (countFragments && !pass.countFragments) {
+			glGenQueries(FramesInFlight, pass.fragmentQueries);
+			for (bool& issued : pass.issued) issued = false;
+			pass.countFragments = true;
+		}
+		if (countPipeline && !pass.countPipeline && GLEW_ARB_pipeline_statistics_query) {
+			glGenQueries(FramesInFlight * NumPipelineStatistics, &pass.pipelineQueries[0][0]);
+			for (bool& issued : pass.issued) issued = false;
+			pass.countPipeline = true;
+		}
+		if constexpr (TraceEnabled) {
+			glQueryCounter(pass.timestampQueries[slot][0], GL_TIMESTAMP);
+		}
+		glBeginQuery(GL_TIME_ELAPSED, pass.queries[slot]);
+		if (pass.countFragments) {
+			glBeginQuery(GL_SAMPLES_PASSED, pass.fragmentQueries[slot]);
+		}
+		if (pass.countPipeline) {
+			for (int statistic = 0; statistic < NumPipelineStatistics; statistic++) {
+				glBeginQuery(pipelineTargets[statistic], pass.pipelineQueries[slot][statistic]);
+			}
+		}
+		pass.issued[slot] = true;
+	}
+
+	/// <summary>
+	/// Ends the pass started by the last Begin().
+	/// </summary>
+	void End() {
+		if (!enabled || active < 0) {
+			return;
+		}
+		glEndQuery(GL_TIME_ELAPSED);
+		if (passes[active].countFragments) {
+			glEndQuery(GL_SAMPLES_PASSED);
+		}
+		if (passes[active].countPipeline) {
+			for (int statistic = 0; statistic < NumPipelineStatistics; statistic++) {
+				glEndQuery(pipelineTargets[statistic]);
+			}
+		}
+		if constexpr (TraceEnabled) {
+			glQueryCounter(passes[active].timestampQueries[frame % FramesInFlight][1], GL_TIMESTAMP);
+		}
+		active = -1;
+	}
+
+	/// <summary>
+	/// Moves to the next slot of the rings, call once per frame.
+	/// </summary>
+	void EndFrame() { frame++; }
+
+	/// <summary>
+	/// The average number of fragments a pass counted since the last report, 0 if it does not count them.
+	/// </summary>
+	double AverageFragments(const char* name) const {
+		for (const Pass& pass : passes) {
+			if (pass.name == name && pass.samples > 0) {
+				return pass.totalFragments / pass.samples;
+			}
+		}
+		return 0.0;
+	}
+
+	/// <summary>
+	/// The average GPU time of a pass since the last report, in milliseconds.
+	/// </summary>
+	double AverageMs(const char* name) const {
+		for (const Pass& pass : passes) {
+			if (pass.name == name && pass.samples > 0) {
+				return pass.totalMs / pass.samples;
+			}
+		}
+		return 0.0;
+	}
+
+	/// <summary>
+	/// The average of a pipeline statistic of a pass since the last report, 0 if it does not count them.
+	/// </summary>
+	double AverageStatistic(const char* name, PipelineStatistic statistic) const {
+		for (const Pass& pass : passes) {
+			if (pass.name == name && pass.samples > 0) {
+				return pass.totalStatistics[statistic] / pass.samples;
+			}
+		}
+		return 0.0;
+	}
+
+	/// <summary>
+	/// The number of frames averaged since the last report.
+	/// </summary>
+	int Samples(const char* name) const {
+		for (const Pass& pass : passes) {
+			if (pass.name == name) {
+				return pass.samples;
+			}
+		}
+		return 0;
+	}
+
+	/// <summary>
+	/// Prints the average time of every pass since the last report, and resets the averages.
+	/// </summary>
+	void Report(std::ostream& out) {
+		double total = 0.0;
+		out << "gpu ms:";
+		for (Pass& pass : passes) {
+			double average = pass.samples > 0 ? pass.totalMs / pass.samples : 0.0;
+			out << " " << pass.name << " " << average;
+			if (pass.countFragments && pass.samples > 0) {
+				out << " (" << (long long)(pass.totalFragments / pass.samples) << " fragments)";
+			}
+			total += average;
+		}
+		out << ", total " << total << std::endl;
+		for (Pass& pass : passes) {
+			if (pass.countPipeline && pass.samples > 0) {
+				out << "  " << pass.name << ":";
+				for (int statistic = 0; statistic < NumPipelineStatistics; statistic++) {
+					out << (statistic > 0 ? ", " : " ") << (long long)(pass.totalStatistics[statistic] / pass.samples) << " "
+						<< PipelineStatisticName(statistic);
+				}
+				out << std::endl;
+			}
+			ResetTotals(pass);
+		}
+		Calibrate();
+	}
+
+private:
+	struct Pass {
+		std::string name;
+		const char* traceName;				// the name given to Begin(), for the trace
+		GLuint queries[FramesInFlight];
+		GLuint timestampQueries[FramesInFlight][2];	// start and end
+		GLuint fragmentQueries[FramesInFlight];
+		GLuint pipelineQueries[FramesInFlight][NumPipelineStatistics];
+		bool countFragments = false;
+		bool countPipeline = false;
+		bool issued[FramesInFlight] = {};
+		double totalMs = 0.0;
+		double totalFragments = 0.0;
+		double totalStatistics[NumPipelineStatistics] = {};
+		int samples = 0;
+	};
+
+	static constexpr GLenum pipelineTargets[NumPipelineStatistics] = {
+		GL_VERTEX_SHADER_INVOCATIONS_ARB,
+		GL_TESS_CONTROL_SHADER_PATCHES_ARB,
+		GL_TESS_EVALUATION_SHADER_INVOCATIONS_ARB,
+		GL_GEOMETRY_SHADER_PRIMITIVES_EMITTED_ARB,
+		GL_CLIPPING_INPUT_PRIMITIVES_ARB,
+		GL_CLIPPING_OUTPUT_PRIMITIVES_ARB,
+		GL_FRAGMENT_SHADER_INVOCATIONS_ARB,
+	};
+
+	static void ResetTotals(Pass& pass) {
+		pass.totalMs = 0.0;
+		pass.totalFragments = 0.0;
+		for (double& total : pass.totalStatistics) total = 0.0;
+		pass.samples = 0;
+	}
+
+	int FindPass(const char* name) {
+		for (size_t i = 0; i < passes.size(); i++) {
+			if (passes[i].name == name) {
+				return int(i);
+			}
+		}
+		passes.emplace_back();
+		passes.back().name = name;
+		passes.back().traceName = name;
+		glGenQueries(FramesInFlight, passes.back().queries);
+		if constexpr (TraceEnabled) {
+			glGenQueries(FramesInFlight * 2, &passes.back().timestampQueries[0][0]);
+		}
+		return int(passes.size() - 1);
+	}
+
+	/// <summary>
+	/// Maps the GPU clock to the clock of the trace.
+	/// </summary>
+	void Calibrate() {
+		if constexpr (TraceEnabled) {
+			GLint64 gpuNow = 0;
+			glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+			clockOffset = Tracer::Now() - int64_t(gpuNow);
+		}
+	}
+
+	std::vector<Pass> passes;
+	int frame = 0;
+	int active = -1;
+	bool enabled = false;
+	int64_t clockOffset = 0;	// trace time minus GPU time, in nanoseconds
+};
@@ -0,0 +1,43 @@
+#version 330 core
+
+// One level of the min depth pyramid for the screen space reflections.
+// Level 0 copies the depth buffer, every next level keeps the nearest depth
+// of the 2x2 texels under it (3 for the last row or column of an odd size).
+// Only the source level is accessible in the source texture, so texelFetch
+// uses level 0.
+
+layout(location=0) out float minDepth;
+
+uniform sampler2D source;	// the depth buffer for level 0, the previous level otherwise
+uniform int reduce;			// 0 to copy, 1 to reduce
+uniform ivec2 sourceSize;
+
+float sourceDepth(ivec2 p) {
+    return texelFetch(source, min(p, sourceSize - 1), 0).r;
+}
+
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    if (reduce == 0) {
+        minDepth = sourceDepth(p);
+        return;
+    }
+
+    ivec2 s = p * 2;
+    float z = min(min(sourceDepth(s), sourceDepth(s + ivec2(1, 0))),
+                  min(sourceDepth(s + ivec2(0, 1)), sourceDepth(s + ivec2(1, 1))));
+
+    // odd sizes: the last texels of the source have no level texel of their own
+    bool extraColumn = (sourceSize.x & 1) == 1 && s.x + 3 == sourceSize.x;
+    bool extraRow = (sourceSize.y & 1) == 1 && s.y + 3 == sourceSize.y;
+    if (extraColumn) {
+        z = min(z, min(sourceDepth(s + ivec2(2, 0)), sourceDepth(s + ivec2(2, 1))));
+    }
+    if (extraRow) {
+        z = min(z, min(sourceDepth(s + ivec2(0, 2)), sourceDepth(s + ivec2(1, 2))));
+    }
+    if (extraColumn && extraRow) {
+        z = min(z, sourceDepth(s + ivec2(2, 2)));
+    }
+    minDepth = z;
+}
@@ -0,0 +1,148 @@
+// --------------------------------------------------------------------------------
+// Perceptual comparison of rendered images with reference images.
+//
+// compareImages() computes the structural similarity (SSIM) of the luma of two
+// RGB8 images with the usual 11x11 Gaussian window (sigma 1.5), along with the
+// root mean square and the largest difference of the channels. SSIM follows
+// the local mean, contrast and structure the eye is sensitive to, so dithering
+// or a slightly moved wave crest costs little while a lost highlight or a
+// seam costs a lot; the worst 8x8 block is reported next to the mean so a
+// small, local break is not averaged away by a large, unchanged image.
+//
+// The images are rows of width * 3 bytes, the first row at the top.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+/// <summary>
+/// The differences between two images.
+/// </summary>
+struct ImageDiff {
+	double ssim = 1.0;			// mean SSIM of the luma, 1 for identical images
+	double minBlockSsim = 1.0;	// the lowest mean SSIM of an 8x8 block
+	double rmse = 0.0;			// root mean square difference of the channels, 0..255
+	int maxError = 0;			// largest difference of a channel
+};
+
+namespace imageCompareDetail {
+
+/// <summary>
+/// Blurs a single channel image in place with a separable Gaussian, clamping at the borders.
+/// </summary>
+inline void gaussianBlur(std::vector<float>& image, int width, int height) {
+	const int radius = 5;
+	float weights[2 * radius + 1];
+	float sum = 0.0f;
+	for (int i = -radius; i <= radius; i++) {
+		weights[i + radius] = std::exp(-float(i * i) / (2.0f * 1.5f * 1.5f));
+		sum += weights[i + radius];
+	}
+	for (float& w : weights) {
+		w /= sum;
+	}
+	std::vector<float> temp(image.size());
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			float value = 0.0f;
+			for (int i = -radius; i <= radius; i++) {
+				int sx = std::min(std::max(x + i, 0), width - 1);
+				value += weights[i + radius] * image[size_t(y) * width + sx];
+			}
+			temp[size_t(y) * width + x] = value;
+		}
+	}
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			float value = 0.0f;
+			for (int i = -radius; i <= radius; i++) {
+				int sy = std::min(std::max(y + i, 0), height - 1);
+				value += weights[i + radius] * temp[size_t(sy) * width + x];
+			}
+			image[size_t(y) * width + x] = value;
+		}
+	}
+}
+
+}
+
+/// <summary>
+/// Compares two RGB8 images of the same size.
+/// </summary>
+/// <param name="a"> the rendered image </param>
+/// <param name="b"> the reference image </param>
+/// <param name="diffImage"> if not null, receives the SSIM map as an RGB8 image, darker where the images differ </param>
+inline ImageDiff compareImages(const unsigned char* a, const unsigned char* b, int width, int height, std::vector<unsigned char>* diffImage = nullptr) {
+	using namespace imageCompareDetail;
+	ImageDiff diff;
+	size_t pixels = size_t(width) * height;
+	if (pixels == 0) {
+		return diff;
+	}
+	std::vector<float> lumaA(pixels), lumaB(pixels);
+	double squaredError = 0.0;
+	for (size_t p = 0; p < pixels; p++) {
+		const unsigned char* pa = a + p * 3;
+		const unsigned char* pb = b + p * 3;
+		for (int c = 0; c < 3; c++) {
+			int error = std::abs(int(pa[c]) - int(pb[c]));
+			squaredError += double(error) * error;
+			diff.maxError = std::max(diff.maxError, error);
+		}
+		lumaA[p] = 0.299f * pa[0] + 0.587f * pa[1] + 0.114f * pa[2];
+		lumaB[p] = 0.299f * pb[0] + 0.587f * pb[1] + 0.114f * pb[2];
+	}
+	diff.rmse = std::sqrt(squaredError / (pixels * 3));
+
+	std::vector<float> meanA = lumaA, meanB = lumaB, squareA(pixels), squareB(pixels), product(pixels);
+	for (size_t p = 0; p < pixels; p++) {
+		squareA[p] = lumaA[p] * lumaA[p];
+		squareB[p] = lumaB[p] * lumaB[p];
+		product[p] = lumaA[p] * lumaB[p];
+	}
+	for (std::vector<float>* image : { &meanA, &meanB, &squareA, &squareB, &product }) {
+		gaussianBlur(*image, width, height);
+	}
+
+	// the constants of Wang et al. for a dynamic range of 255
+	const float c1 = (0.01f * 255.0f) * (0.01f * 255.0f);
+	const float c2 = (0.03f * 255.0f) * (0.03f * 255.0f);
+	const int block = 8;
+	int blocksX = (width + block - 1) / block;
+	int blocksY = (height + block - 1) / block;
+	std::vector<double> blockSums(size_t(blocksX) * blocksY, 0.0);
+	std::vector<int> blockCounts(blockSums.size(), 0);
+	if (diffImage) {
+		diffImage->resize(pixels * 3);
+	}
+	double total = 0.0;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			size_t p = size_t(y) * width + x;
+			float ma = meanA[p], mb = meanB[p];
+			float varianceA = std::max(squareA[p] - ma * ma, 0.0f);
+			float varianceB = std::max(squareB[p] - mb * mb, 0.0f);
+			float covariance = product[p] - ma * mb;
+			float ssim = ((2.0f * ma * mb + c1) * (2.0f * covariance + c2)) / ((ma * ma + mb * mb + c1) * (varianceA + varianceB + c2));
+			total += ssim;
+			size_t b = size_t(y / block) * blocksX + x / block;
+			blockSums[b] += ssim;
+			blockCounts[b]++;
+			if (diffImage) {
+				unsigned char v = (unsigned char)(std::min(std::max(ssim, 0.0f), 1.0f) * 255.0f + 0.5f);
+				(*diffImage)[p * 3] = 255;
+				(*diffImage)[p * 3 + 1] = v;
+				(*diffImage)[p * 3 + 2] = v;
+			}
+		}
+	}
+	diff.ssim = total / pixels;
+	for (size_t b = 0; b < blockSums.size(); b++) {
+		diff.minBlockSsim = std::min(diff.minBlockSsim, blockSums[b] / blockCounts[b]);
+	}
+	return diff;
+}
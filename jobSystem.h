@@ -0,0 +1,276 @@
+// --------------------------------------------------------------------------------
+// A work-stealing job system for the CPU work of the frames.
+//
+// A fixed set of workers and the thread that owns the system each have a
+// deque of jobs. A thread pushes the jobs it forks to the back of its own
+// deque and takes them back from there, so nested fork/join work stays on the
+// thread that has it in cache; an idle thread steals from the front of the
+// other deques, which holds the oldest and usually largest jobs. Threads that
+// are not part of the system push to the deque of the owner.
+//
+// Jobs are forked into a JobHandle and joined with Wait(), which runs jobs
+// instead of blocking until the handle is done, so a job may fork and wait on
+// other jobs. Like TaskPool, jobs must not call OpenGL.
+//
+// Every job is a zone of the trace (trace.h) named after it, on the thread
+// that ran it, and so is the time the threads spend waiting in Wait().
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// The jobs forked into it, done when all of them have run. Copies refer to
+/// the same jobs.
+/// </summary>
+class JobHandle {
+public:
+	/// <summary>
+	/// Whether every job of the handle has run, true for a handle without jobs.
+	/// </summary>
+	bool Done() const { return !pending || pending->load(std::memory_order_acquire) == 0; }
+
+	/// <summary>
+	/// Whether jobs were ever forked into the handle.
+	/// </summary>
+	bool Valid() const { return pending != nullptr; }
+
+private:
+	friend class JobSystem;
+	std::shared_ptr<std::atomic<int>> pending;
+};
+
+/// <summary>
+/// A fixed size pool of workers with one job deque per thread.
+/// </summary>
+class JobSystem {
+public:
+	/// <summary>
+	/// Starts the workers. The calling thread becomes the owner of the system,
+	/// it runs jobs too while it waits.
+	/// </summary>
+	/// <param name="numWorkers"> the number of workers, 0 for one per hardware thread besides the caller </param>
+	explicit JobSystem(unsigned numWorkers = 0) {
+		if (numWorkers == 0) {
+			numWorkers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+			numWorkers = std::max(numWorkers, 1u);
+		}
+		for (unsigned i = 0; i <= numWorkers; i++) {
+			threads.emplace_back(new ThreadState());
+		}
+		Bind(0);
+		for (unsigned i = 1; i <= numWorkers; i++) {
+			workers.emplace_back(&JobSystem::Work, this, int(i));
+		}
+	}
+
+	/// <summary>
+	/// Runs the jobs still queued and joins the workers.
+	/// </summary>
+	~JobSystem() {
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		if (CurrentSystem() == this) {
+			CurrentSystem() = nullptr;
+		}
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	/// <summary>
+	/// Forks a job into a handle.
+	/// </summary>
+	/// <param name="handle"> the handle to join the job with </param>
+	/// <param name="name"> the name of the job in the trace, a string literal </param>
+	/// <param name="job"> a callable without arguments </param>
+	void Run(JobHandle& handle, const char* name, std::function<void()> job) {
+		if (!handle.pending) {
+			handle.pending = std::make_shared<std::atomic<int>>(0);
+		}
+		handle.pending->fetch_add(1, std::memory_order_relaxed);
+		ThreadState& thread = *threads[ThreadIndex()];
+		{
+			std::lock_guard<std::mutex> lock(thread.mutex);
+			thread.jobs.push_back(Job{ name, std::move(job), handle.pending });
+		}
+		queued.fetch_add(1, std::memory_order_release);
+		{
+			// no worker can be between its check of queued and its wait
+			std::lock_guard<std::mutex> lock(sleepMutex);
+		}
+		wake.notify_one();
+	}
+
+	/// <summary>
+	/// Forks a job into a new handle.
+	/// </summary>
+	/// <param name="name"> the name of the job in the trace, a string literal </param>
+	/// <param name="job"> a callable without arguments </param>
+	/// <returns> the handle of the job </returns>
+	JobHandle Run(const char* name, std::function<void()> job) {
+		JobHandle handle;
+		Run(handle, name, std::move(job));
+		return handle;
+	}
+
+	/// <summary>
+	/// Runs jobs until every job of the handle has run.
+	/// </summary>
+	void Wait(const JobHandle& handle) {
+		if (handle.Done()) {
+			return;
+		}
+		TRACE_SCOPE("wait");
+		int index = ThreadIndex();
+		while (!handle.Done()) {
+			if (!RunOne(index)) {
+				// the last jobs of the handle run on other threads
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	/// <summary>
+	/// Splits [0, count) into ranges of at most grain items run as jobs, and
+	/// waits for all of them.
+	/// </summary>
+	/// <param name="name"> the name of the jobs in the trace, a string literal </param>
+	/// <param name="count"> the number of items </param>
+	/// <param name="grain"> the most items per job </param>
+	/// <param name="job"> called with the begin and end of every range </param>
+	template <class RangeJob>
+	void ParallelFor(const char* name, size_t count, size_t grain, RangeJob job) {
+		grain = std::max(grain, size_t(1));
+		if (count <= grain) {
+			if (count > 0) {
+				job(size_t(0), count);
+			}
+			return;
+		}
+		JobHandle handle;
+		for (size_t begin = 0; begin < count; begin += grain) {
+			size_t end = std::min(begin + grain, count);
+			Run(handle, name, [&job, begin, end] { job(begin, end); });
+		}
+		Wait(handle);
+	}
+
+	/// <summary>
+	/// The number of threads that run jobs, the workers and the owner.
+	/// </summary>
+	unsigned Size() const { return unsigned(threads.size()); }
+
+private:
+	struct Job {
+		const char* name;
+		std::function<void()> run;
+		std::shared_ptr<std::atomic<int>> pending;
+	};
+
+	struct ThreadState {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	/// <summary>
+	/// The system the calling thread belongs to, and its deque in it.
+	/// </summary>
+	static JobSystem*& CurrentSystem() {
+		thread_local JobSystem* system = nullptr;
+		return system;
+	}
+	static int& CurrentIndex() {
+		thread_local int index = 0;
+		return index;
+	}
+
+	void Bind(int index) {
+		CurrentSystem() = this;
+		CurrentIndex() = index;
+	}
+
+	int ThreadIndex() const { return CurrentSystem() == this ? CurrentIndex() : 0; }
+
+	void Work(int index) {
+		Bind(index);
+		Tracer::SetThreadName("worker " + std::to_string(index));
+		while (true) {
+			if (RunOne(index)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			wake.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+			if (stopping && queued.load(std::memory_order_acquire) == 0) {
+				return;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Runs the newest job of the thread's deque, or else steals the oldest job
+	/// of another deque.
+	/// </summary>
+	/// <returns> false if there was no job anywhere </returns>
+	bool RunOne(int index) {
+		if (queued.load(std::memory_order_acquire) == 0) {
+			return false;
+		}
+		Job job;
+		bool found = false;
+		{
+			ThreadState& own = *threads[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty()) {
+				job = std::move(own.jobs.back());
+				own.jobs.pop_back();
+				found = true;
+			}
+		}
+		for (size_t i = 1; !found && i < threads.size(); i++) {
+			ThreadState& victim = *threads[(index + i) % threads.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty()) {
+				job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+				found = true;
+			}
+		}
+		if (!found) {
+			return false;
+		}
+		queued.fetch_sub(1, std::memory_order_relaxed);
+
+		{
+			TraceZone zone(job.name);
+			job.run();
+		}
+		job.pending->fetch_sub(1, std::memory_order_release);
+		return true;
+	}
+
+	std::vector<std::unique_ptr<ThreadState>> threads;	// 0 is the owner
+	std::vector<std::thread> workers;
+	std::atomic<int> queued{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
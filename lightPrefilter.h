@@ -0,0 +1,321 @@
+// --------------------------------------------------------------------------------
+// Prefiltering of textured area lights for LTC shading.
+//
+// Following "Real-Time Polygonal-Light Shading with Linearly Transformed Cosines"
+// (Heitz et al. 2016, section 5.2), the light texture is padded with a border
+// and each mip level is blurred with a Gaussian instead of a box filter. The
+// shader picks the level from the distance between the shading point and the
+// light plane in LTC space, so the blur matches the width of the cosine lobe.
+//
+// The chain is built incrementally: level i is level i-1 blurred by the extra
+// Gaussian needed to double its width, then decimated by 2.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/// <summary>
+/// The fraction of the padded texture used by the border on each side.
+/// The light itself covers [AREA_LIGHT_BORDER, 1 - AREA_LIGHT_BORDER].
+/// Keep in sync with the shaders.
+/// </summary>
+const float AREA_LIGHT_BORDER = 0.125f;
+
+/// <summary>
+/// One level of the prefiltered chain, RGBA floats in [0, 1].
+/// </summary>
+struct FilteredLevel {
+	int width = 0;
+	int height = 0;
+	std::vector<float> rgba;
+
+	const float* texel(int x, int y) const {
+		x = std::min(std::max(x, 0), width - 1);
+		y = std::min(std::max(y, 0), height - 1);
+		return &rgba[(size_t(y) * width + x) * 4];
+	}
+};
+
+/// <summary>
+/// Bilinear lookup with clamp to edge, uv in [0, 1].
+/// </summary>
+inline void sampleBilinear(const FilteredLevel& level, float u, float v, float* out) {
+	float x = u * level.width - 0.5f;
+	float y = v * level.height - 0.5f;
+	int x0 = int(std::floor(x));
+	int y0 = int(std::floor(y));
+	float fx = x - x0;
+	float fy = y - y0;
+	const float* a = level.texel(x0, y0);
+	const float* b = level.texel(x0 + 1, y0);
+	const float* c = level.texel(x0, y0 + 1);
+	const float* d = level.texel(x0 + 1, y0 + 1);
+	for (int i = 0; i < 4; i++) {
+		float top = a[i] + (b[i] - a[i]) * fx;
+		float bottom = c[i] + (d[i] - c[i]) * fx;
+		out[i] = top + (bottom - top) * fy;
+	}
+}
+
+/// <summary>
+/// Separable Gaussian blur with clamp to edge.
+/// </summary>
+/// <param name="level"> the level to blur in place </param>
+/// <param name="sigma"> the standard deviation in texels </param>
+inline void gaussianBlur(FilteredLevel& level, float sigma) {
+	int radius = std::max(1, int(std::ceil(3.0f * sigma)));
+	std::vector<float> kernel(2 * radius + 1);
+	float sum = 0.0f;
+	for (int i = -radius; i <= radius; i++) {
+		kernel[i + radius] = std::exp(-0.5f * i * i / (sigma * sigma));
+		sum += kernel[i + radius];
+	}
+	for (float& k : kernel) {
+		k /= sum;
+	}
+
+	std::vector<float> temp(level.rgba.size());
+	for (int pass = 0; pass < 2; pass++) {
+		const std::vector<float>& src = pass == 0 ? level.rgba : temp;
+		std::vector<float>& dst = pass == 0 ? temp : level.rgba;
+		for (int y = 0; y < level.height; y++) {
+			for (int x = 0; x < level.width; x++) {
+				float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				for (int k = -radius; k <= radius; k++) {
+					int sx = pass == 0 ? std::min(std::max(x + k, 0), level.width - 1) : x;
+					int sy = pass == 1 ? std::min(std::max(y + k, 0), level.height - 1) : y;
+					const float* s = &src[(size_t(sy) * level.width + sx) * 4];
+					float w = kernel[k + radius];
+					for (int c = 0; c < 4; c++) acc[c] += s[c] * w;
+				}
+				float* d = &dst[(size_t(y) * level.width + x) * 4];
+				for (int c = 0; c < 4; c++) d[c] = acc[c];
+			}
+		}
+	}
+}
+
+/// <summary>
+/// Halves the resolution of a level (2x2 average, clamped for odd sizes).
+/// </summary>
+inline FilteredLevel decimate(const FilteredLevel& level) {
+	FilteredLevel half;
+	half.width = std::max(1, level.width / 2);
+	half.height = std::max(1, level.height / 2);
+	half.rgba.resize(size_t(half.width) * half.height * 4);
+	for (int y = 0; y < half.height; y++) {
+		for (int x = 0; x < half.width; x++) {
+			const float* a = level.texel(2 * x, 2 * y);
+			const float* b = level.texel(2 * x + 1, 2 * y);
+			const float* c = level.texel(2 * x, 2 * y + 1);
+			const float* d = level.texel(2 * x + 1, 2 * y + 1);
+			float* out = &half.rgba[(size_t(y) * half.width + x) * 4];
+			for (int i = 0; i < 4; i++) out[i] = 0.25f * (a[i] + b[i] + c[i] + d[i]);
+		}
+	}
+	return half;
+}
+
+/// <summary>
+/// Converts a level back to RGBA8.
+/// </summary>
+inline void levelToRGBA8(const FilteredLevel& level, unsigned char* out) {
+	for (size_t i = 0; i < level.rgba.size(); i++) {
+		out[i] = (unsigned char)(std::min(std::max(level.rgba[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+}
+
+/// <summary>
+/// Copies the texel rectangle [x0, x1) x [y0, y1) of an RGBA8 image to floats.
+/// </summary>
+inline FilteredLevel cropLight(const unsigned char* image, int width, int x0, int y0, int x1, int y1) {
+	FilteredLevel source;
+	source.width = x1 - x0;
+	source.height = y1 - y0;
+	source.rgba.resize(size_t(source.width) * source.height * 4);
+	for (int y = 0; y < source.height; y++) {
+		const unsigned char* row = image + (size_t(y0 + y) * width + x0) * 4;
+		for (int i = 0; i < source.width * 4; i++) {
+			source.rgba[size_t(y) * source.width * 4 + i] = row[i] / 255.0f;
+		}
+	}
+	return source;
+}
+
+/// <summary>
+/// Resamples the light into a padded base level with the light covering
+/// innerWidth x innerHeight texels. The border repeats the edge, fading to the
+/// mean color of the light at the outer rim: lookups projecting just outside the
+/// light return the blurred edge, and the coarsest levels converge to the light
+/// average like the cosine integral does for distant lights.
+/// </summary>
+/// <param name="source"> the light image </param>
+/// <param name="innerWidth"> width of the light inside the border </param>
+/// <param name="innerHeight"> height of the light inside the border </param>
+inline FilteredLevel padLight(FilteredLevel source, int innerWidth, int innerHeight) {
+	// box filter down to the working resolution so the resample does not alias
+	while (source.width > 2 * innerWidth || source.height > 2 * innerHeight) {
+		source = decimate(source);
+	}
+
+	float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (size_t i = 0; i < source.rgba.size(); i++) {
+		mean[i % 4] += source.rgba[i];
+	}
+	for (float& m : mean) {
+		m /= float(source.width) * source.height;
+	}
+
+	FilteredLevel base;
+	float innerFraction = 1.0f - 2.0f * AREA_LIGHT_BORDER;
+	base.width = int(std::ceil(innerWidth / innerFraction));
+	base.height = int(std::ceil(innerHeight / innerFraction));
+	base.rgba.resize(size_t(base.width) * base.height * 4);
+	for (int y = 0; y < base.height; y++) {
+		for (int x = 0; x < base.width; x++) {
+			float u = ((x + 0.5f) / base.width - AREA_LIGHT_BORDER) / innerFraction;
+			float v = ((y + 0.5f) / base.height - AREA_LIGHT_BORDER) / innerFraction;
+			float* texel = &base.rgba[(size_t(y) * base.width + x) * 4];
+			sampleBilinear(source, std::min(std::max(u, 0.0f), 1.0f), std::min(std::max(v, 0.0f), 1.0f), texel);
+
+			// 0 on the light edge, 1 from halfway through the border
+			float outside = std::max(std::max(-u, u - 1.0f), std::max(-v, v - 1.0f));
+			float fade = std::min(std::max(2.0f * outside * innerFraction / AREA_LIGHT_BORDER, 0.0f), 1.0f);
+			for (int c = 0; c < 4; c++) {
+				texel[c] += (mean[c] - texel[c]) * fade;
+			}
+		}
+	}
+	return base;
+}
+
+/// <summary>
+/// Creates the padded base level of a whole image. The light is scaled so its
+/// longer side is at most maxSize texels.
+/// </summary>
+/// <param name="image"> RGBA8 image data </param>
+/// <param name="width"> image width </param>
+/// <param name="height"> image height </param>
+/// <param name="maxSize"> the maximum size of the light inside the border </param>
+inline FilteredLevel createPaddedBase(const unsigned char* image, int width, int height, int maxSize) {
+	float scale = std::min(1.0f, float(maxSize) / std::max(width, height));
+	int innerWidth = std::max(1, int(width * scale + 0.5f));
+	int innerHeight = std::max(1, int(height * scale + 0.5f));
+	return padLight(cropLight(image, width, 0, 0, width, height), innerWidth, innerHeight);
+}
+
+/// <summary>
+/// Builds the Gaussian prefiltered chain from the padded base level. Level i is
+/// blurred with a Gaussian of 2^i base texels.
+/// </summary>
+/// <param name="base"> the padded base level </param>
+/// <returns> all the levels down to 1x1 </returns>
+inline std::vector<FilteredLevel> buildPrefilteredChain(const FilteredLevel& base) {
+	std::vector<FilteredLevel> levels;
+	levels.push_back(base);
+
+	while (levels.back().width > 1 || levels.back().height > 1) {
+		// widen from 1 to 2 texels of the current level, then decimate
+		FilteredLevel next = levels.back();
+		gaussianBlur(next, std::sqrt(3.0f));
+		levels.push_back(decimate(next));
+	}
+	return levels;
+}
+
+/// <summary>
+/// Trilinear lookup in the chain, mirroring textureLod() in the shader.
+/// </summary>
+inline void sampleChain(const std::vector<FilteredLevel>& levels, float u, float v, float lod, float* out) {
+	lod = std::min(std::max(lod, 0.0f), float(levels.size() - 1));
+	int lower = int(std::floor(lod));
+	int upper = std::min(lower + 1, int(levels.size()) - 1);
+	float t = lod - lower;
+	float a[4], b[4];
+	sampleBilinear(levels[lower], u, v, a);
+	sampleBilinear(levels[upper], u, v, b);
+	for (int i = 0; i < 4; i++) out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// LTC space lookup, shared by the shaders and the CPU reference.
+
+struct LightVec3 {
+	double x, y, z;
+};
+
+inline LightVec3 lightSub(const LightVec3& a, const LightVec3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline double lightDot(const LightVec3& a, const LightVec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline LightVec3 lightCross(const LightVec3& a, const LightVec3& b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+
+/// <summary>
+/// Computes the texture coordinates and the level of detail of a light given by
+/// three of its corners in LTC (cosine) space: p1 the origin of the uv space,
+/// p2 along u and p4 along v. This is the CPU version of the shader lookup.
+/// </summary>
+/// <param name="filterScale"> maps the normalized plane distance to a blur width </param>
+/// <param name="innerSize"> the width of the light inside the border, in base texels </param>
+inline void prefilteredLookup(const LightVec3& p1, const LightVec3& p2, const LightVec3& p4,
+	float filterScale, float innerSize, float& u, float& v, float& lod) {
+	LightVec3 V1 = lightSub(p2, p1);
+	LightVec3 V2 = lightSub(p4, p1);
+	LightVec3 planeOrtho = lightCross(V1, V2);
+	double planeAreaSquared = lightDot(planeOrtho, planeOrtho);
+	double planeDistxPlaneArea = lightDot(planeOrtho, p1);
+
+	// orthonormal projection of the shading point (the origin) onto the light
+	double s = planeDistxPlaneArea / planeAreaSquared;
+	LightVec3 P = lightSub({ planeOrtho.x * s, planeOrtho.y * s, planeOrtho.z * s }, p1);
+
+	double dotV1V2 = lightDot(V1, V2);
+	double invDotV1V1 = 1.0 / lightDot(V1, V1);
+	LightVec3 V2o = lightSub(V2, { V1.x * dotV1V2 * invDotV1V1, V1.y * dotV1V2 * invDotV1V1, V1.z * dotV1V2 * invDotV1V1 });
+	double pv = lightDot(V2o, P) / lightDot(V2o, V2o);
+	double pu = lightDot(V1, P) * invDotV1V1 - dotV1V2 * invDotV1V1 * pv;
+
+	// distance to the plane relative to the size of the light
+	double d = std::fabs(planeDistxPlaneArea) / std::pow(planeAreaSquared, 0.75);
+
+	float innerFraction = 1.0f - 2.0f * AREA_LIGHT_BORDER;
+	u = AREA_LIGHT_BORDER + innerFraction * float(pu);
+	v = AREA_LIGHT_BORDER + innerFraction * float(pv);
+	lod = std::log2(std::max(float(filterScale * d * innerSize), 1e-6f));
+}
+
+/// <summary>
+/// Brute force reference: the clamped cosine weighted average of the unfiltered
+/// light texture over the light polygon in LTC space.
+/// </summary>
+/// <param name="steps"> the number of integration steps along each side </param>
+inline void referenceLightColor(const FilteredLevel& light, const LightVec3& p1, const LightVec3& p2, const LightVec3& p4,
+	int steps, float* out) {
+	LightVec3 V1 = lightSub(p2, p1);
+	LightVec3 V2 = lightSub(p4, p1);
+	LightVec3 normal = lightCross(V1, V2);
+	double acc[4] = { 0, 0, 0, 0 };
+	double total = 0;
+
+	for (int j = 0; j < steps; j++) {
+		for (int i = 0; i < steps; i++) {
+			double u = (i + 0.5) / steps;
+			double v = (j + 0.5) / steps;
+			LightVec3 q = { p1.x + V1.x * u + V2.x * v, p1.y + V1.y * u + V2.y * v, p1.z + V1.z * u + V2.z * v };
+			double r2 = lightDot(q, q);
+			double r = std::sqrt(r2);
+			double cosine = std::max(q.z / r, 0.0);
+			double solidAngle = std::fabs(lightDot(normal, q)) / (r2 * r);
+			double w = cosine * solidAngle;
+
+			float texel[4];
+			sampleBilinear(light, float(u), float(v), texel);
+			for (int c = 0; c < 4; c++) acc[c] += w * texel[c];
+			total += w;
+		}
+	}
+	for (int c = 0; c < 4; c++) {
+		out[c] = total > 0 ? float(acc[c] / total) : 0.0f;
+	}
+}
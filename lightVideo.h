@@ -0,0 +1,175 @@
+// --------------------------------------------------------------------------------
+// Background decoding of animated area light textures.
+//
+// The frames of an image sequence (a printf pattern such as "panels/%04d.png")
+// are decoded with lodepng on a worker thread and converted by a caller supplied
+// function, typically into the packed prefiltered levels of the light texture.
+// Finished frames wait in a small queue; the render thread takes them with Pop()
+// without ever blocking, and the buffers are recycled so the steady state does
+// not allocate. The sequence loops when the next frame is missing.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <lodepng.h>
+#include <trace.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Converts a decoded RGBA8 image into the frame that is handed to the render thread.
+/// Returns false to skip the image.
+/// </summary>
+typedef std::function<bool(const std::vector<unsigned char>& image, unsigned width, unsigned height, std::vector<unsigned char>& frame)> LightVideoConvert;
+
+/// <summary>
+/// Decodes an image sequence on a background thread.
+/// </summary>
+class LightVideoDecoder {
+public:
+	~LightVideoDecoder() { Stop(); }
+
+	/// <summary>
+	/// Returns true if the file name looks like an image sequence pattern.
+	/// </summary>
+	static bool IsSequence(const char* filename) { return std::string(filename).find('%') != std::string::npos; }
+
+	/// <summary>
+	/// Formats the file name of a frame.
+	/// </summary>
+	static std::string FrameName(const std::string& pattern, int index) {
+		char name[1024];
+		snprintf(name, sizeof(name), pattern.c_str(), index);
+		return name;
+	}
+
+	/// <summary>
+	/// Starts decoding the sequence.
+	/// </summary>
+	/// <param name="filePattern"> printf pattern of the frame file names, frames are numbered from 0 </param>
+	/// <param name="convertFunc"> called on the decode thread for every frame </param>
+	/// <param name="queueSize"> the number of frames decoded ahead </param>
+	/// <returns> true if the first frame exists </returns>
+	bool Start(const std::string& filePattern, LightVideoConvert convertFunc, int queueSize = 3) {
+		Stop();
+		std::ifstream first(FrameName(filePattern, 0), std::ios::binary);
+		if (!first) {
+			std::cerr << "Error: Failed to open the first frame of " << filePattern << std::endl;
+			return false;
+		}
+		pattern = filePattern;
+		convert = convertFunc;
+		maxQueued = queueSize;
+		running = true;
+		worker = std::thread(&LightVideoDecoder::Run, this);
+		return true;
+	}
+
+	/// <summary>
+	/// Stops the decode thread and drops the queued frames.
+	/// </summary>
+	void Stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		wake.notify_all();
+		if (worker.joinable()) {
+			worker.join();
+		}
+		ready.clear();
+	}
+
+	/// <summary>
+	/// Takes the oldest decoded frame, if any, without blocking.
+	/// The previous contents of frame are recycled by the decoder.
+	/// </summary>
+	/// <param name="frame"> receives the frame </param>
+	/// <returns> true if a frame was available </returns>
+	bool Pop(std::vector<unsigned char>& frame) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (ready.empty()) {
+				return false;
+			}
+			frame.swap(ready.front());
+			spare.push_back(std::move(ready.front()));
+			ready.pop_front();
+		}
+		wake.notify_all();
+		return true;
+	}
+
+	/// <summary>
+	/// Decode statistics, updated by the decode thread.
+	/// </summary>
+	std::atomic<int> decodedFrames{ 0 };
+	std::atomic<long long> decodeMicroseconds{ 0 };	// decode and convert time of the decoded frames
+
+private:
+	void Run() {
+		Tracer::SetThreadName("light video");
+		std::vector<unsigned char> image;
+		int index = 0;
+		while (true) {
+			std::vector<unsigned char> frame;
+			{
+				// wait for room in the queue
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return !running || int(ready.size()) < maxQueued; });
+				if (!running) {
+					return;
+				}
+				if (!spare.empty()) {
+					frame.swap(spare.back());
+					spare.pop_back();
+				}
+			}
+
+			TRACE_SCOPE("decode light frame");
+			auto start = std::chrono::steady_clock::now();
+			unsigned width, height;
+			image.clear();
+			unsigned error = lodepng::decode(image, width, height, FrameName(pattern, index));
+			if (error) {
+				if (index == 0) {
+					std::cerr << "Error: Failed to decode " << FrameName(pattern, 0) << ": " << lodepng_error_text(error) << std::endl;
+					return;
+				}
+				index = 0; // end of the sequence, loop
+				continue;
+			}
+			index++;
+			if (!convert(image, width, height, frame)) {
+				continue;
+			}
+			auto end = std::chrono::steady_clock::now();
+			decodeMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+			decodedFrames++;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			ready.push_back(std::move(frame));
+		}
+	}
+
+	std::string pattern;
+	LightVideoConvert convert;
+	int maxQueued = 3;
+	bool running = false;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::vector<unsigned char>> ready;	// decoded frames, oldest first
+	std::vector<std::vector<unsigned char>> spare;	// buffers given back by Pop()
+};
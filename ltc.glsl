@@ -0,0 +1,59 @@
+// Linearly transformed cosines: the look up table and the integration over a
+// polygon, shared by the variants of the water (tessShader.frag).
+// source: Real-Time Polygonal-Light Shading with Linearly Transformed Cosines, Heitz et al. 2016
+
+// LTC look up table, layer 0: Minv, layer 1: norm, fresnel, 0, sphere scale.
+uniform sampler2DArray ltcLut;
+uniform float ltcLutSize; // ltc_texture size. LUT = look up table
+const float PI = 3.14159265;
+
+// map [0, 1] table coordinates onto the texel centers of the look up table.
+vec2 ltcLutCoord(vec2 uv) {
+    return uv * ((ltcLutSize - 1.0) / ltcLutSize) + 0.5 / ltcLutSize;
+}
+
+// LTC inverse matrix from the first layer of the look up table.
+mat3 ltcInverse(vec4 t1) {
+    return mat3(vec3(t1.x, 0.0, t1.y),
+                vec3(0.0 , 1.0, 0.0),
+                vec3(t1.z, 0.0, t1.w));
+}
+
+// the (T1, T2, N) basis around the normal that the LTC space is aligned with.
+// It only depends on the fragment, so it is built once for all the lights.
+mat3 shadingBasis(vec3 N, vec3 V) {
+    vec3 T1 = normalize(V - N * dot(V, N));
+    vec3 T2 = cross(N, T1);
+    return transpose(mat3(T1, T2, N));
+}
+
+// Approximate edge integral (replacing acos with a rational function)
+// source: https://learnopengl.com/Guest-Articles/2022/Area-Lights
+vec3 integrateEdgeVec(vec3 v1, vec3 v2){
+    float x = dot(v1, v2);
+    float y = abs(x);
+    float a = 0.8543985 + (0.4965155 + 0.0145206*y)*y;
+    float b = 3.4175940 + (4.1616724 + y)*y;
+    float v = a / b;
+    float theta_sintheta = (x > 0.0)
+        ? v
+        : 0.5 * inversesqrt(max(1.0 - x*x, 1e-7)) - v;
+    return cross(v1, v2) * theta_sintheta;
+}
+
+// Horizon clipped form factor of the sphere with vector form factor length len
+// and elevation cosine z. This is the closed form the old ltc2.w table was
+// integrated from, so it replaces one table fetch per integral with a few ALU ops.
+// source: Moving Frostbite to Physically Based Rendering 3.0, listing 7
+float integrateClippedSphere(float len, float z) {
+    if (z * z > len) {
+        return len * max(z, 0.0); // the sphere is fully above or below the horizon
+    }
+    float sinSigmaSqr = min(len, 0.9999);
+    float sinTheta = sqrt(max(1.0 - z * z, 1e-7));
+    float x = sqrt(1.0 / sinSigmaSqr - 1.0);
+    float y = clamp(-x * (z / sinTheta), -1.0, 1.0);
+    float sinThetaSqrtY = sinTheta * sqrt(1.0 - y * y);
+    float formFactor = (z * acos(y) - x * sinThetaSqrtY) * sinSigmaSqr + atan(sinThetaSqrtY / x);
+    return max(formFactor, 0.0) / PI;
+}
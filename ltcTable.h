@@ -0,0 +1,206 @@
+// --------------------------------------------------------------------------------
+// Compact binary storage for the LTC look up tables.
+//
+// The fitted tables used to be compiled into the program as literal floats
+// (LTC.h). They are now shipped as a small binary blob that is loaded at startup
+// and regenerated offline by tools/ltcFit.cpp.
+//
+// File layout (little endian):
+//   LTCFileHeader
+//   ltc1: size * size * 4 values (inverse matrix: m00, m02, m20, m22)
+//   ltc2: size * size * 4 values (norm, fresnel, 0, horizon clipped sphere scale)
+// Values are 32-bit floats, or 16-bit halfs when LTC_FLAG_HALF is set.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+const char LTC_FILE_MAGIC[4] = { 'L', 'T', 'C', 'B' };
+const uint32_t LTC_FILE_VERSION = 1;
+const uint32_t LTC_FLAG_HALF = 1u << 0;
+
+/// <summary>
+/// The header at the start of every .ltc file.
+/// </summary>
+struct LTCFileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t size;		// the tables are size x size texels
+	uint32_t flags;		// LTC_FLAG_*
+};
+
+/// <summary>
+/// The two LTC tables, always expanded to floats in memory.
+/// </summary>
+struct LTCTable {
+	int size = 0;
+	std::vector<float> ltc1;
+	std::vector<float> ltc2;
+};
+
+/// <summary>
+/// Converts a float to an IEEE half (round to nearest even).
+/// </summary>
+/// <param name="value"> the float to convert </param>
+/// <returns> the half bits </returns>
+inline uint16_t floatToHalf(float value) {
+	uint32_t f;
+	memcpy(&f, &value, sizeof(f));
+	uint32_t sign = (f >> 16) & 0x8000u;
+	int32_t exponent = int32_t((f >> 23) & 0xFFu) - 127 + 15;
+	uint32_t mantissa = f & 0x7FFFFFu;
+
+	if (((f >> 23) & 0xFFu) == 0xFFu) { // inf or nan
+		return uint16_t(sign | 0x7C00u | (mantissa ? 0x200u : 0u));
+	}
+	if (exponent >= 31) { // overflow
+		return uint16_t(sign | 0x7C00u);
+	}
+	if (exponent <= 0) { // denormal or zero
+		if (exponent < -10) {
+			return uint16_t(sign);
+		}
+		mantissa |= 0x800000u;
+		uint32_t shift = uint32_t(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1u);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1u))) {
+			half++;
+		}
+		return uint16_t(sign | half);
+	}
+
+	uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1FFFu;
+	if (rest > 0x1000u || (rest == 0x1000u && (half & 1u))) {
+		half++; // may carry into the exponent, which is still correct
+	}
+	return uint16_t(half);
+}
+
+/// <summary>
+/// Converts an IEEE half to a float.
+/// </summary>
+/// <param name="half"> the half bits </param>
+/// <returns> the float value </returns>
+inline float halfToFloat(uint16_t half) {
+	uint32_t sign = uint32_t(half & 0x8000u) << 16;
+	uint32_t exponent = (half >> 10) & 0x1Fu;
+	uint32_t mantissa = half & 0x3FFu;
+	uint32_t f;
+
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			f = sign;
+		}
+		else { // normalize the denormal
+			exponent = 127 - 15 + 1;
+			while ((mantissa & 0x400u) == 0) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			mantissa &= 0x3FFu;
+			f = sign | (exponent << 23) | (mantissa << 13);
+		}
+	}
+	else if (exponent == 31) {
+		f = sign | 0x7F800000u | (mantissa << 13);
+	}
+	else {
+		f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	}
+
+	float value;
+	memcpy(&value, &f, sizeof(value));
+	return value;
+}
+
+/// <summary>
+/// Loads the LTC tables from a .ltc file.
+/// </summary>
+/// <param name="filename"> the file to load </param>
+/// <param name="table"> the destination table </param>
+/// <returns> true on success </returns>
+inline bool loadLTCTable(const char* filename, LTCTable& table) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) {
+		std::cerr << "Error: Failed to open LTC table: " << filename << std::endl;
+		return false;
+	}
+
+	LTCFileHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || memcmp(header.magic, LTC_FILE_MAGIC, 4) != 0 || header.version != LTC_FILE_VERSION) {
+		std::cerr << "Error: Not a valid LTC table: " << filename << std::endl;
+		return false;
+	}
+	if (header.size == 0 || header.size > 1024) {
+		std::cerr << "Error: Unsupported LTC table size " << header.size << ": " << filename << std::endl;
+		return false;
+	}
+
+	size_t count = size_t(header.size) * header.size * 4;
+	table.size = int(header.size);
+	table.ltc1.resize(count);
+	table.ltc2.resize(count);
+
+	if (header.flags & LTC_FLAG_HALF) {
+		std::vector<uint16_t> halfs(count * 2);
+		file.read(reinterpret_cast<char*>(halfs.data()), halfs.size() * sizeof(uint16_t));
+		for (size_t i = 0; i < count; i++) {
+			table.ltc1[i] = halfToFloat(halfs[i]);
+			table.ltc2[i] = halfToFloat(halfs[count + i]);
+		}
+	}
+	else {
+		file.read(reinterpret_cast<char*>(table.ltc1.data()), count * sizeof(float));
+		file.read(reinterpret_cast<char*>(table.ltc2.data()), count * sizeof(float));
+	}
+
+	if (!file) {
+		std::cerr << "Error: LTC table is truncated: " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Writes the LTC tables to a .ltc file.
+/// </summary>
+/// <param name="filename"> the file to write </param>
+/// <param name="table"> the tables to store </param>
+/// <param name="useHalf"> store 16-bit halfs instead of 32-bit floats </param>
+/// <returns> true on success </returns>
+inline bool saveLTCTable(const char* filename, const LTCTable& table, bool useHalf) {
+	std::ofstream file(filename, std::ios::binary);
+	if (!file) {
+		std::cerr << "Error: Failed to create LTC table: " << filename << std::endl;
+		return false;
+	}
+
+	LTCFileHeader header;
+	memcpy(header.magic, LTC_FILE_MAGIC, 4);
+	header.version = LTC_FILE_VERSION;
+	header.size = uint32_t(table.size);
+	header.flags = useHalf ? LTC_FLAG_HALF : 0u;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	if (useHalf) {
+		std::vector<uint16_t> halfs;
+		halfs.reserve(table.ltc1.size() + table.ltc2.size());
+		for (float v : table.ltc1) halfs.push_back(floatToHalf(v));
+		for (float v : table.ltc2) halfs.push_back(floatToHalf(v));
+		file.write(reinterpret_cast<const char*>(halfs.data()), halfs.size() * sizeof(uint16_t));
+	}
+	else {
+		file.write(reinterpret_cast<const char*>(table.ltc1.data()), table.ltc1.size() * sizeof(float));
+		file.write(reinterpret_cast<const char*>(table.ltc2.data()), table.ltc2.size() * sizeof(float));
+	}
+	return bool(file);
+}
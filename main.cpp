@@ -13,15 +13,41 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <vector>
 
 #include <lodepng.h>
 
-#include <LTC.h>
+#include <ltcTable.h>
+#include <lightPrefilter.h>
+#include <envPrefilter.h>
+#include <shIrradiance.h>
+#include <lightVideo.h>
+#include <shaderBuild.h>
+#include <shaderReload.h>
+#include <shaderVariants.h>
+#include <taskPool.h>
+#include <textureCache.h>
+#include <gpuTimer.h>
+#include <renderQueue.h>
+#include <waveCapture.h>
+#include <waveField.h>
+#include <jobSystem.h>
+#include <trace.h>
+#include <cameraPath.h>
+#include <imageCompare.h>
 
 using namespace std;
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
+/// <summary>
+/// The window title, the draw statistics of the frame are appended to it.
+/// </summary>
+const char* windowTitle = "CS5610 - Final Project";
+
 /// <summary>
 /// The window width and height.
 /// </summary>
@@ -65,16 +91,31 @@ float* waveAmplitude = new float[numOfWaves];
 float* waveFrequency = new float[numOfWaves];
 float* waveSpeed = new float[numOfWaves];
 cyVec2f* waveDirection = new cyVec2f[numOfWaves];
+float* waveSlopeTail = new float[numOfWaves];
+
+/// <summary>
+/// The waves evaluated on the CPU (waveField.h), for game logic that needs the
+/// height and normal of the water at many points per tick.
+/// </summary>
+WaveField waveField;
+
+/// <summary>
+/// Roughness of calm water, widened per fragment by the filtered wave slopes.
+/// </summary>
+float baseRoughness = 0.2f;
 
 /// <summary>
-/// Program object used for managing shaders.
+/// The water programs: tessShader.* built with the flags of the features in
+/// use (waterDefines()), one variant per combination, and the variant of the
+/// current settings. The settings only mark the variant stale, it is selected
+/// once at the start of the next frame.
 /// </summary>
-cy::GLSLProgram prog;
-cy::GLSLProgram triangleLineProg;
-cy::GLSLProgram altProg;
+ProgramVariants waterVariants;
+cy::GLSLProgram* waterProg = nullptr;
+bool waterVariantStale = false;
 
 /// <summary>
-/// The condition to show triangulation.
+/// The condition to show triangulation, drawn by the water shaders over the water.
 /// </summary>
 bool showTriangulation = false;
 
@@ -151,8 +192,24 @@ cy::GLSLProgram cubeProg;
 /// <summary>
 /// The cube map textures for the skybox.
 /// Contain all of the sides of the skybox.
+/// Level 0 is the skybox itself and the next levels are prefiltered with GGX
+/// lobes of increasing roughness (envPrefilter.h) for the water reflections.
 /// </summary>
 cy::GLTextureCubeMap envMap;
+const int envRoughnessLevels = 6;
+const unsigned envPrefilterSamples = 64;
+int envMapLevels = 1;
+
+/// <summary>
+/// The split-sum BRDF table: scale and bias to F0 by N.V and roughness.
+/// </summary>
+GLuint envBrdfLut;
+const int envBrdfLutSize = 32;
+
+/// <summary>
+/// The diffuse light of the skybox for the ambient term, as spherical harmonics (shIrradiance.h).
+/// </summary>
+float skySH[9][3];
 
 /// <summary>
 /// The vertices of the skybox.
@@ -173,15 +230,30 @@ GLuint cubeVAO;
 /// Just area light things.
 /// </summary>
 cy::GLSLProgram areaLightProg;
-cyGLTexture2D AL_Tex;
+GLuint AL_Tex; // the Gaussian prefiltered light textures, one array layer per light, see lightPrefilter.h
 cy::TriMesh areaLightMesh;
 cy::Vec3f* areaLightVertices;
 cy::Vec2f* areaLightTextures;
-cyVec2f* areaLightTexCorners;
-cyVec3f* areaLight4Corners;
+cy::Vec3f* areaLightLayerCoords; // per vertex uv and layer in AL_Tex
 GLuint areaLightVAO;
 int areaLightNumVert;
-cy::Vec3f* areaLightUniqueVert;
+
+/// <summary>
+/// The area lights as the shaders see them: the std140 AreaLights uniform block,
+/// shared by the water variants. Per light, the 4 corners and the map from the
+/// light's (u, v) to its layer of AL_Tex.
+/// </summary>
+const int maxAreaLights = 6; // MAX_AREA_LIGHTS in the shaders
+struct AreaLightBlock {
+	float verts[maxAreaLights * 4][4];			// xyz, w unused
+	float uvTransform[maxAreaLights * 2][4];	// (uv of corner 0, u axis), (v axis, layer, unused)
+};
+AreaLightBlock areaLightBlock;
+GLuint areaLightUBO;
+const GLuint areaLightBlockBinding = 0;
+float areaLightUVRect[maxAreaLights][4]; // min uv, max uv of each light in the source image
+int numAreaLights = 0;		// lights in the obj file
+int activeAreaLights = 0;	// lights the shaders loop over, l cycles it to measure the cost per light
 
 /// <summary>
 /// condition to use for end result.
@@ -192,10 +264,329 @@ bool isTexturedLight = false;
 
 
 /// <summary>
-/// ltc1 and ltc2 are the two textures used for Minv of the area light.
+/// The LTC look up table as a 2 layer RGBA16F array texture.
+/// layer 0 (ltc1) holds Minv of the area light, layer 1 (ltc2) the norm and fresnel.
 /// </summary>
-cy::GLTexture2D ltc1;
-cy::GLTexture2D ltc2;
+GLuint ltcLut;
+
+/// <summary>
+/// Startup timing, time to first frame is what the kiosk users wait for.
+/// </summary>
+chrono::steady_clock::time_point startupTime;
+chrono::steady_clock::time_point assetsLoadedTime;
+bool firstFrameShown = false;
+
+/// <summary>
+/// The fitted LTC tables, loaded at startup (see tools/ltcFit.cpp).
+/// </summary>
+LTCTable ltcTable;
+const char* ltcTablePath = "ltc/ggx_64.ltc";
+
+/// <summary>
+/// Textured area light filtering.
+/// The filter scale converts the normalized distance to the light plane into
+/// the footprint of the blur; 0.58 is the best fit of tools/lightFilterCheck.cpp.
+/// The light texture can be stored compressed to save bandwidth, at the cost of
+/// some banding in the smooth coarse levels.
+/// </summary>
+float areaLightFilterScale = 0.58f;
+int areaLightTexMaxSize = 512;
+bool compressAreaLightTex = false;
+
+/// <summary>
+/// The texture cache (textureCache.h). The skybox and a static light texture
+/// are stored fully mipped in their GPU format after the first run, so later
+/// runs skip the PNG decoding, the filtering and the driver compression.
+/// The skybox is compressed to DXT1 when the driver supports S3TC.
+/// </summary>
+bool useTextureCache = true;
+const char* textureCacheDir = "textureCache";
+const char* textureCacheVersion = "2"; // change it when the way the textures are built changes
+bool compressSkybox = true;
+
+/// <summary>
+/// The program binary cache (shaderBuild.h), off with --no-shader-cache, and
+/// the hot reload of the shaders (shaderReload.h), h toggles it.
+/// </summary>
+bool useShaderCache = true;
+const char* shaderCacheDir = "shaderCache";
+ShaderReloader shaderReloader;
+bool reloadShaders = true;
+
+/// <summary>
+/// The water variant that branches on the directional light, the reflections
+/// and the number of lights at run time, as one program per light type did
+/// before the variants. --uber-shader selects it, to compare with the
+/// specialized variants.
+/// </summary>
+bool useUberShader = false;
+
+/// <summary>
+/// The prefiltered chains of all the area lights for the current frame of the light texture.
+/// </summary>
+struct AreaLightLayers {
+	int innerWidth = 0;					// size of the lights inside the border, fixed by the first frame
+	int innerHeight = 0;
+	std::vector<uint64_t> hashes;		// hash of the pixels each chain was built from
+	std::vector<std::vector<FilteredLevel>> chains;
+};
+AreaLightLayers areaLightLayers;
+
+/// <summary>
+/// Animated area lights. When argv[3] is an image sequence pattern such as
+/// panels/%04d.png, the frames are decoded and prefiltered on a background
+/// thread (lightVideo.h) and streamed into AL_Tex through a ring of pixel
+/// buffer objects, so the render thread never waits for the decoding or the
+/// transfer. Video lights are never compressed, the driver would have to
+/// compress every frame.
+/// </summary>
+LightVideoDecoder lightVideo;
+bool isLightVideo = false;
+float lightVideoFps = 30.0f;
+const int lightVideoPBOCount = 3;
+GLuint lightVideoPBO[lightVideoPBOCount];
+GLsync lightVideoFence[lightVideoPBOCount] = {};
+int lightVideoPBOIndex = 0;
+size_t lightVideoFrameSize = 0;
+std::vector<size_t> lightVideoLevelOffsets;	// byte offset of every mip level in a packed frame
+std::vector<int> lightVideoLevelWidths;
+std::vector<int> lightVideoLevelHeights;
+std::vector<unsigned char> lightVideoFrame;	// the last frame taken from the decoder
+float lightVideoNextFrame = 0.0f;
+float lightVideoReportTime = 0.0f;
+int lightVideoUploads = 0;
+long long lightVideoUploadMicroseconds = 0;
+
+/// <summary>
+/// Screen space reflections of the area lights on the water, r cycles the presets.
+/// When they are on, the scene is drawn into sceneFBO with the water normal,
+/// roughness and cube map reflection in two more color targets. The depth
+/// buffer is reduced into a min depth pyramid (hiZ.frag), which ssr.frag
+/// traces the reflected rays through before compositing into the window,
+/// keeping the cube map reflection where a ray misses or leaves the screen.
+/// </summary>
+struct SSRPreset {
+	const char* name;
+	int maxIterations;		// steps through the pyramid per ray
+	float maxRoughness;		// rougher water keeps the cube map reflection
+	float maxDistance;		// length of the rays in view space
+	float colorLodScale;	// blur of the reflected scene per unit of roughness, 0 skips the scene mips
+};
+const SSRPreset ssrPresets[] = {
+	{ "off", 0, 0.0f, 0.0f, 0.0f },
+	{ "low", 32, 0.3f, 60.0f, 0.0f },
+	{ "medium", 48, 0.5f, 120.0f, 4.0f },
+	{ "high", 96, 0.7f, 200.0f, 6.0f },
+};
+const int numSSRPresets = sizeof(ssrPresets) / sizeof(ssrPresets[0]);
+int ssrPreset = 0;
+float ssrThickness = 0.5f; // view space depth behind a surface still counted as a hit
+cy::GLSLProgram hiZProg;
+cy::GLSLProgram ssrProg;
+GLuint sceneFBO = 0;
+GLuint sceneColorTex, gbufferNormalTex, gbufferReflectionTex, sceneDepthTex;
+GLuint hiZFBO;
+GLuint hiZTex;
+int hiZLevels = 0;
+int ssrWidth = 0, ssrHeight = 0;
+GLuint screenVAO;
+
+/// <summary>
+/// Depth pre-pass of the water, p toggles it. The tessellated waves are drawn
+/// once with depthPrepass.frag to fill the depth buffer, then shaded with the
+/// depth test against it, so the crests hidden behind nearer waves are never
+/// lit. The GPU timer report gives the overdraw of the forward pass.
+/// </summary>
+cy::GLSLProgram depthPrepassProg;
+bool useDepthPrepass = false;
+
+/// <summary>
+/// GPU time of the render passes (gpuTimer.h), g toggles the report. The
+/// tessellated passes also count their pipeline statistics, and the report
+/// starts with the average frame time.
+/// </summary>
+GpuTimers gpuTimers;
+float gpuTimerReportTime = 0.0f;
+double frameMsTotal = 0.0;
+int frameMsCount = 0;
+
+/// <summary>
+/// The tessellation sweep, started by --sweep table.csv. Every combination of
+/// sweepTessLevels and sweepInnerRadii is drawn from the start camera at a
+/// fixed time for sweepFrames frames after a warm up; the frame time, the GPU
+/// time and the pipeline statistics of the water are averaged, the image is
+/// compared to the one of the first, densest setting, and a row is written.
+/// The program exits at the end of the table.
+/// </summary>
+struct SweepSetting {
+	int tessLevel;
+	float innerRadius;
+	float outerRadius;
+};
+const int sweepTessLevels[] = { 32, 16, 8, 4, 2, 1 };
+const float sweepInnerRadii[] = { 20.0f, 10.0f, 5.0f, 1.0f };
+const float sweepRadiusSpan = 19.0f;	// outer minus inner radius, as the arrow keys keep it
+const int sweepWarmupFrames = GpuTimers::FramesInFlight + 2;
+const int sweepFrames = 24;
+const float sweepTime = 10.0f;
+const char* sweepPath = nullptr;
+ofstream sweepFile;
+std::vector<SweepSetting> sweepSettings;
+size_t sweepIndex = 0;
+int sweepFrame = 0;
+double sweepFrameMs = 0.0;
+std::vector<unsigned char> sweepReference;	// the image of the first setting
+
+/// <summary>
+/// Camera paths (cameraPath.h). --path file.txt plays a path in a loop in
+/// place of the mouse and keys, and k records the camera into the file of
+/// --record (cameraPath.txt by default) until it is pressed again.
+/// </summary>
+CameraPath cameraPath;
+const char* cameraPathFile = nullptr;
+const char* cameraRecordFile = "cameraPath.txt";
+bool recordingCameraPath = false;
+float cameraRecordStart = 0.0f;
+float cameraRecordLast = 0.0f;
+const float cameraRecordInterval = 0.1f;	// seconds between the recorded keys
+
+/// <summary>
+/// The flythrough benchmark, started by --bench results.txt with a --path.
+/// The path is replayed once for every configuration of benchConfigs, with a
+/// fixed step of path and water time per frame so every run draws the same
+/// frames, and the time between the frames is written as one line of average
+/// and percentiles per configuration. The program exits at the end.
+/// </summary>
+struct BenchConfig {
+	bool textured;
+	bool directional;
+	bool triangulation;
+};
+const float benchStep = 1.0f / 60.0f;
+const int benchWarmupFrames = GpuTimers::FramesInFlight + 2;
+const char* benchResultsPath = nullptr;
+ofstream benchFile;
+std::vector<BenchConfig> benchConfigs;
+size_t benchIndex = 0;
+int benchFrame = 0;
+std::vector<double> benchFrameMs;
+chrono::steady_clock::time_point benchLastFrame;
+
+/// <summary>
+/// The golden image test, started by --golden goldens/cases.txt. Every case of
+/// the file is drawn at its time and camera with its settings; after a warm up
+/// the frame time is averaged and the image is compared (imageCompare.h) with
+/// the PNG named after the case next to the file. A case fails below its SSIM
+/// thresholds and leaves its image and SSIM map next to the golden. With
+/// --golden-update the images are written as the new goldens instead. The
+/// program exits with 1 if a case failed, else with goldenSkippedExitCode if a
+/// case has no golden yet.
+/// </summary>
+struct GoldenCase {
+	string name;
+	float time;
+	CameraKey camera;
+	bool textured;
+	bool directional;
+	bool triangulation;
+	int tessLevel;
+	float innerRadius;
+	double minSsim;			// the lowest mean SSIM that passes
+	double minBlockSsim;	// the lowest SSIM of an 8x8 block that passes
+};
+const int goldenWarmupFrames = GpuTimers::FramesInFlight + 2;
+const int goldenFrames = 16;
+const char* goldenCasesPath = nullptr;
+string goldenDirectory;
+bool updateGoldens = false;
+std::vector<GoldenCase> goldenCases;
+size_t goldenIndex = 0;
+int goldenFrame = 0;
+double goldenFrameMs = 0.0;
+int goldenFailures = 0;
+int goldenSkipped = 0;					// the cases without a golden
+const int goldenSkippedExitCode = 2;	// no case failed, but some have no golden
+
+/// <summary>
+/// Capture of the displaced water for the game logic (waveCapture.h), c toggles
+/// it. The patches within waveCaptureRadius of the camera are tessellated
+/// again every frame into a transform feedback ring, and the surface read back
+/// two frames later keeps the camera above the waves.
+/// </summary>
+cy::GLSLProgram waveCaptureProg;
+WaveCapture waveCapture;
+bool useWaveCapture = false;
+float waveCaptureRadius = 4.0f;
+float cameraClearance = 0.5f;					// height kept between the camera and the waves
+std::vector<GLint> waveCaptureFirsts;			// first vertex of every patch captured
+std::vector<GLsizei> waveCaptureCounts;
+std::vector<WaveCapture::Vertex> waveSurface;	// the last capture read back, 3 vertices per triangle
+float waveCaptureReportTime = 0.0f;
+
+/// <summary>
+/// The draw packets of the frame (renderQueue.h), and the draw calls and state
+/// changes of the last frame shown in the window title.
+/// </summary>
+RenderQueue renderQueue;
+int shownDrawCalls = -1;
+int shownStateChanges = -1;
+
+/// <summary>
+/// The transformations of a frame, built by frameView() and sent to the shaders by quadMVP().
+/// </summary>
+struct FrameView {
+	cy::Matrix4f modelMatrix;
+	cy::Matrix4f viewMatrix;
+	cy::Matrix4f projectionMatrix;
+	cy::Vec3f eye;
+	cy::Vec3f lightDirWorld;
+	float pixelAngle;	// used to filter out sub-pixel waves
+	float nearClip;
+};
+
+/// <summary>
+/// The CPU work of a frame: the camera movement, the transformations and the
+/// culling of the captured patches. It runs as a job while the main thread
+/// submits the frame before, o toggles the overlap. The inputs are copied when
+/// the job starts, the job only writes the results, and the main thread applies
+/// them when the frame begins. cameraRevision counts the camera changes of the
+/// mouse, which make the transformations of a job out of date.
+/// </summary>
+struct FrameSimulation {
+	// inputs
+	float deltaTime = 0.0f;
+	bool forward = false, back = false, left = false, right = false, up = false, down = false;
+	cy::Vec3f position;
+	cy::Vec3f frontVector;
+	cy::Vec3f rightVector;
+	int cameraRevision = 0;
+	unsigned width = 0, height = 0;
+	bool capture = false;
+	float captureRadius = 0.0f;
+	// results
+	cy::Vec3f move;
+	FrameView view;
+	std::vector<GLint> captureFirsts;
+	std::vector<GLsizei> captureCounts;
+};
+FrameSimulation simulation;
+int cameraRevision = 0;
+bool overlapSimulation = true;
+
+/// <summary>
+/// The job system of the per-frame CPU work (jobSystem.h).
+/// </summary>
+JobSystem jobs;
+JobHandle simulationJob;
+
+/// <summary>
+/// The trace of the frames, the passes and the loading (trace.h), written to
+/// trace0.json, trace1.json... by j and at exit, each with the events since
+/// the one before. The passes are on the GPU track while g times them.
+/// Builds with NDEBUG compile the tracing out.
+/// </summary>
+const char* tracePrefix = "trace";
+int traceFiles = 0;
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -275,6 +666,30 @@ void createRandomDirections( int numOfWaves, cyVec2f* directionArr) {
 	}
 }
 
+/// <summary>
+/// This method computes the suffix sums of the wave slope variances.
+/// The tessellation shader drops waves it cannot resolve and adds the
+/// variance of everything it dropped to the roughness in one lookup.
+/// </summary>
+/// <param name="numOfWaves"> the number of waves </param>
+/// <param name="amplitudes"> the wave amplitudes </param>
+/// <param name="frequencies"> the wave frequencies, sorted ascending </param>
+/// <param name="tailArr"> the array to be filled </param>
+void createSlopeVarianceTail(int numOfWaves, const float* amplitudes, const float* frequencies, float* tailArr) {
+	if (numOfWaves < 1) {
+		cerr << "Error: number of waves must be at least 1." << endl;
+		return;
+	}
+	// mean of (exp(sin(x) - 1) * cos(x))^2 over a period, the slope shape of one wave
+	const float slopeShapeVariance = 0.1076f;
+	float tail = 0.0f;
+	for (int i = numOfWaves - 1; i >= 0; i--) {
+		float slope = amplitudes[i] * frequencies[i];
+		tail += slopeShapeVariance * slope * slope;
+		tailArr[i] = tail;
+	}
+}
+
 /// <summary>
 /// This method handles the uniform setter for the quad program.
 /// </summary>
@@ -294,6 +709,7 @@ void handleQuadMVPProgUniforms(cy::GLSLProgram& progName, cyMatrix4f modelMatrix
 	progName["constShininess"] = 256.0f;
 	progName["constLightIntensity"] = 1.0f;
 	progName["constAmbientLight"] = 0.5f;
+	progName["baseRoughness"] = baseRoughness;
 }
 
 /// <summary>
@@ -301,21 +717,20 @@ void handleQuadMVPProgUniforms(cy::GLSLProgram& progName, cyMatrix4f modelMatrix
 /// </summary>
 /// <param name="progName"> program used </param>
 void handleAreaLightProgUniforms(cy::GLSLProgram& progName) {
-	// area light setup for main program
-	progName.SetUniform("areaLightVerts", areaLightUniqueVert, 24);
-	if (isTexturedLight) {
-		progName.SetUniform("areaLightTexCorners", areaLightTexCorners, 4);
-		progName.SetUniform("areaLight4Corners", areaLight4Corners, 4);
-	}
-
-	ltc1.Bind(1);
-	progName["ltc1"] = 1;
-	ltc2.Bind(2);
-	progName["ltc2"] = 2;
-
+	// area light setup for main program, the corners are in the AreaLights block
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, ltcLut);
+	progName["ltcLut"] = 1;
+	progName["ltcLutSize"] = float(ltcTable.size);
+
+	// the light texture stays on unit 0 between frames, the light panels sample it too
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, AL_Tex);
+	areaLightProg["areaLightTex"] = 0;
+	areaLightProg["useTexture"] = isTexturedLight ? 1 : 0;
 	if (isTexturedLight) {
-		AL_Tex.Bind(0);
-		prog["areaLightTex"] = 0;
+		progName["areaLightTex"] = 0;
+		progName["areaLightFilterScale"] = areaLightFilterScale;
 	}
 }
 
@@ -329,25 +744,22 @@ void waveUniformUpdate(cy::GLSLProgram& progName) {
 	progName.SetUniform1("waveAmplitude", waveAmplitude, numOfWaves);
 	progName.SetUniform1("waveFrequency", waveFrequency, numOfWaves);
 	progName.SetUniform1("waveSpeed", waveSpeed, numOfWaves);
+	progName.SetUniform1("waveSlopeTail", waveSlopeTail, numOfWaves);
 }
 
 /// <summary>
 /// This method handles the uniform setter for tessellation and radius.
 /// </summary>
 void updateTessAndRadiusUniforms() {
-	if (isTexturedLight) {
-		prog["tessLevel"] = tessLevel;
-		prog["innerRadius"] = innerRadius;
-		prog["outerRadius"] = outerRadius;
-	}
-	else {
-		altProg["tessLevel"] = tessLevel;
-		altProg["innerRadius"] = innerRadius;
-		altProg["outerRadius"] = outerRadius;
-	}
-	triangleLineProg["tessLevel"] = tessLevel;
-	triangleLineProg["innerRadius"] = innerRadius;
-	triangleLineProg["outerRadius"] = outerRadius;
+	(*waterProg)["tessLevel"] = tessLevel;
+	(*waterProg)["innerRadius"] = innerRadius;
+	(*waterProg)["outerRadius"] = outerRadius;
+	depthPrepassProg["tessLevel"] = tessLevel;
+	depthPrepassProg["innerRadius"] = innerRadius;
+	depthPrepassProg["outerRadius"] = outerRadius;
+	waveCaptureProg["tessLevel"] = tessLevel;
+	waveCaptureProg["innerRadius"] = innerRadius;
+	waveCaptureProg["outerRadius"] = outerRadius;
 }
 
 /// <summary>
@@ -376,105 +788,417 @@ void cubemapMatrix(cy::Matrix4f view, cy::Matrix4f projection) {
 }
 
 /// <summary>
-/// This method handles the uniform setter for triangleLineProg MVPs.
+/// This method handles the uniform setter for the screen space reflections.
 /// </summary>
-/// <param name="model"> the model matrix to use </param>
-/// <param name="view"> the view matrix to use </param>
-/// <param name="projection"> the projection matrix to use </param>
-void lineMVP(cy::Matrix4f model, cy::Matrix4f view, cy::Matrix4f projection) {
-	triangleLineProg["modelMat"] = model;
-	triangleLineProg["viewMat"] = view;
-	triangleLineProg["projectionMat"] = projection;
-	triangleLineProg["lineOffset"] = cy::Vec4f(0.0f, 0.0f, -0.1f, 0.0f);
+/// <param name="view"> view matrix </param>
+/// <param name="projection"> projection matrix </param>
+/// <param name="nearClip"> the near clipping plane, the reflected rays are clipped there </param>
+void ssrMatrix(cy::Matrix4f view, cy::Matrix4f projection, float nearClip) {
+	ssrProg["viewMat"] = view;
+	ssrProg["projectionMat"] = projection;
+	ssrProg["invProjectionMat"] = projection.GetInverse();
+	ssrProg["nearClip"] = nearClip;
 }
 
 /// <summary>
-/// This method handles the MVP for the quad.
+/// This method builds the transformations of a frame seen from a camera.
+/// It only reads its arguments, so it can run in a job.
 /// </summary>
-void quadMVP() {
+/// <param name="eye"> the camera position </param>
+/// <param name="front"> the camera front vector </param>
+/// <param name="right"> the camera right vector </param>
+/// <param name="width"> the window width </param>
+/// <param name="height"> the window height </param>
+/// <returns> the transformations </returns>
+FrameView frameView(cy::Vec3f eye, cy::Vec3f front, cy::Vec3f right, unsigned width, unsigned height) {
+	FrameView view;
 	// Model transformation
-	cy::Matrix4f modelMatrix;
-	modelMatrix.SetIdentity();
-	
-	cy:cyVec3f eye = camPosition;
-	cy::Vec3f center = camPosition + frontVector;
-	cy::Vec3f up = rightVector.Cross(frontVector).GetNormalized();
-	cy::Matrix4f viewMatrix = cy::Matrix4f::View(eye, center, up);
+	view.modelMatrix.SetIdentity();
+
+	view.eye = eye;
+	cy::Vec3f center = eye + front;
+	cy::Vec3f up = right.Cross(front).GetNormalized();
+	view.viewMatrix = cy::Matrix4f::View(eye, center, up);
 
 	// Projection transformation
 	float fov = 40.0f;										// Field of view in degrees
-	float aspectRatio = ((float)windowWidth) / windowHeight;		// Aspect ratio (width/height)
-	float nearClip = 0.1f;									// Near clipping plane
+	float aspectRatio = ((float)width) / height;			// Aspect ratio (width/height)
+	view.nearClip = 0.1f;									// Near clipping plane
 	float farClip = 1000.0f;								// Far clipping plane
-	cy::Matrix4f projectionMatrix = cy::Matrix4f::Perspective(deg2rad(fov), aspectRatio, nearClip, farClip);
+	view.projectionMatrix = cy::Matrix4f::Perspective(deg2rad(fov), aspectRatio, view.nearClip, farClip);
 
-	cy::Vec3f lightDirWorld = cy::Vec3f(0.0f, 0.0f, -1.0f).GetNormalized();
+	view.lightDirWorld = cy::Vec3f(0.0f, 0.0f, -1.0f).GetNormalized();
+	view.pixelAngle = deg2rad(fov) / height;
+	return view;
+}
 
-	if (isTexturedLight) {
-		handleQuadMVPProgUniforms(prog, modelMatrix, viewMatrix, projectionMatrix, lightDirWorld, eye);
-	}
-	else {
-		handleQuadMVPProgUniforms(altProg, modelMatrix, viewMatrix, projectionMatrix, lightDirWorld, eye);
-	}
+/// <summary>
+/// This method sends the transformations of a frame to the shaders.
+/// </summary>
+/// <param name="view"> the transformations </param>
+void quadMVP(const FrameView& view) {
+	const cy::Matrix4f& modelMatrix = view.modelMatrix;
+	const cy::Matrix4f& viewMatrix = view.viewMatrix;
+	const cy::Matrix4f& projectionMatrix = view.projectionMatrix;
+	cy::Vec3f eye = view.eye;
+	cy::Vec3f lightDirWorld = view.lightDirWorld;
+	float pixelAngle = view.pixelAngle;
+
+	handleQuadMVPProgUniforms(*waterProg, modelMatrix, viewMatrix, projectionMatrix, lightDirWorld, eye);
+	(*waterProg)["pixelAngle"] = pixelAngle;
 
-	lineMVP(modelMatrix, viewMatrix, projectionMatrix);
-	triangleLineProg["cameraVec"] = eye;
+	depthPrepassProg["modelMat"] = modelMatrix;
+	depthPrepassProg["viewMat"] = viewMatrix;
+	depthPrepassProg["projectionMat"] = projectionMatrix;
+	depthPrepassProg["cameraVec"] = eye;
+	depthPrepassProg["pixelAngle"] = pixelAngle;
+
+	// the same tessellation and wave filtering as the water that is shown
+	waveCaptureProg["modelMat"] = modelMatrix;
+	waveCaptureProg["cameraVec"] = eye;
+	waveCaptureProg["pixelAngle"] = pixelAngle;
 
 	cubemapMatrix(viewMatrix, projectionMatrix);
 
 	areaLightMatrix(modelMatrix, viewMatrix, projectionMatrix);
+
+	ssrMatrix(viewMatrix, projectionMatrix, view.nearClip);
 }
 
 /// <summary>
-/// Helper method to draw the cubemap.
+/// This method handles the MVP for the quad, from the camera as it is now.
 /// </summary>
-void drawCubemap() {
-	// draw cubemap
-	glDepthMask(GL_FALSE);
-	cubeProg.Bind();
-	envMap.Bind(0);
-	cubeProg["env"] = 0;
+void quadMVP() {
+	quadMVP(frameView(camPosition, frontVector, rightVector, windowWidth, windowHeight));
+}
 
-	// use glDrawArrays here to draw the environment
-	glBindVertexArray(cubeVAO);
-	glDrawArrays(GL_TRIANGLES, 0, cubeNumVert);
-	glDepthMask(GL_TRUE);
+/// <summary>
+/// The color targets of the scene for a draw, as a count of color attachments
+/// of sceneFBO, 0 when the scene is drawn into the window. Only the water
+/// writes the normal and reflection targets of the screen space reflections.
+/// </summary>
+/// <param name="water"> whether the draw is the water </param>
+/// <returns> the number of draw buffers </returns>
+int sceneDrawBuffers(bool water) {
+	if (ssrPreset == 0) {
+		return 0;
+	}
+	return water ? 3 : 1;
 }
 
 /// <summary>
-/// Helper method to draw the triangulation.
+/// This method selects the color targets of the scene outside of the render queue.
 /// </summary>
-void drawTriangulation() {
-	triangleLineProg.Bind();
-	glDrawArrays(GL_PATCHES, 0, totalNumVert);
+/// <param name="water"> whether the water targets are written </param>
+void setSceneDrawBuffers(bool water) {
+	if (ssrPreset == 0) {
+		return;
+	}
+	const GLenum buffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+	glDrawBuffers(sceneDrawBuffers(water), buffers);
 }
 
 /// <summary>
-/// Helper method to draw the quad when tessellation = true.
+/// This method sets the units of the prefiltered environment and the BRDF table for the water.
+/// Units 0 and 1 hold the area light texture and the LTC table.
 /// </summary>
-void drawWaterQuad() {
+/// <param name="progName"> program used </param>
+void setEnvironmentUniforms(cy::GLSLProgram& progName) {
+	progName["env"] = 2;
+	progName["envMaxLod"] = float(envMapLevels - 1);
+	progName["envBrdfLut"] = 3;
+}
 
-	glPatchParameteri(GL_PATCH_VERTICES, 3);
-	glBindVertexArray(waterVAO);
+/// <summary>
+/// This method sets the ambient light of the skybox.
+/// </summary>
+/// <param name="progName"> program used </param>
+void setSkySHUniform(cy::GLSLProgram& progName) {
+	progName.Bind();
+	glUniform3fv(glGetUniformLocation(progName.GetID(), "skySH"), 9, &skySH[0][0]);
+}
+
+/// <summary>
+/// This method connects the AreaLights uniform block of a program to the area light buffer.
+/// </summary>
+/// <param name="progName"> program used </param>
+void bindAreaLightBlock(cy::GLSLProgram& progName) {
+	GLuint blockIndex = glGetUniformBlockIndex(progName.GetID(), "AreaLights");
+	if (blockIndex != GL_INVALID_INDEX) {
+		glUniformBlockBinding(progName.GetID(), blockIndex, areaLightBlockBinding);
+	}
+}
+
+/// <summary>
+/// The #define lines of the water variant for the current settings, see tessShader.frag.
+/// </summary>
+std::string waterDefines() {
+	if (useUberShader) {
+		return shaderDefine("TEXTURED_LIGHT", isTexturedLight ? 1 : 0) + shaderDefine("UBER_SHADER", 1);
+	}
+	return shaderDefine("TEXTURED_LIGHT", isTexturedLight ? 1 : 0)
+		+ shaderDefine("DIRECTIONAL", isDirectionalLight ? 1 : 0)
+		+ shaderDefine("ENV_REFLECT", ssrPreset == 0 ? 1 : 0)
+		+ shaderDefine("NUM_LIGHTS", activeAreaLights);
+}
+
+/// <summary>
+/// This method sets every uniform of a water variant from the current settings.
+/// The variants not in use keep old values, so it runs whenever the variant changes.
+/// </summary>
+/// <param name="progName"> the water variant </param>
+void setupWaterProgram(cy::GLSLProgram& progName) {
+	bindAreaLightBlock(progName);
+	setSkySHUniform(progName);
+	setEnvironmentUniforms(progName);
+	handleAreaLightProgUniforms(progName);
+	waveUniformUpdate(progName);
+	progName["showTriangulation"] = showTriangulation ? 1 : 0;
+	progName["time"] = timePassed;
+	if (useUberShader) {
+		// the features the specialized variants have as constants
+		progName["isDirectionalLight"] = isDirectionalLight ? 1 : 0;
+		progName["ssrEnabled"] = ssrPreset != 0 ? 1 : 0;
+		progName["numLights"] = activeAreaLights;
+	}
+	quadMVP();
+	updateTessAndRadiusUniforms();
+}
+
+/// <summary>
+/// This method switches the water to the variant of the current settings,
+/// built on first use (shaderVariants.h). If it fails to build, the water
+/// keeps the variant it has.
+/// </summary>
+void selectWaterProgram() {
+	waterVariantStale = false;
+	cy::GLSLProgram* program = waterVariants.Get(waterDefines(), useShaderCache ? shaderCacheDir : nullptr, &shaderReloader);
+	if (program) {
+		waterProg = program;
+	}
+	setupWaterProgram(*waterProg);
+}
+
+/// <summary>
+/// Records the cubemap, drawn at the far plane without writing depth.
+/// </summary>
+/// <param name="queue"> the render queue </param>
+/// <param name="pass"> the position of the pass in the frame </param>
+void drawCubemap(RenderQueue& queue, int pass) {
+	DrawPacket packet;
+	packet.pass = pass;
+	packet.program = cubeProg.GetID();
+	packet.vao = cubeVAO;
+	packet.Texture(0, GL_TEXTURE_CUBE_MAP, envMap.GetID());
+	packet.depthWrite = false;
+	packet.drawBuffers = sceneDrawBuffers(false);
+	packet.count = cubeNumVert;
+	queue.Add(packet);
+}
+
+/// <summary>
+/// Records the depth of the water, drawn before it is shaded.
+/// </summary>
+/// <param name="queue"> the render queue </param>
+/// <param name="pass"> the position of the pass in the frame </param>
+void drawDepthPrepass(RenderQueue& queue, int pass) {
+	DrawPacket packet;
+	packet.pass = pass;
+	packet.program = depthPrepassProg.GetID();
+	packet.vao = waterVAO;
+	packet.colorWrite = false;
+	packet.mode = GL_PATCHES;
+	packet.patchVertices = 3;
+	packet.count = totalNumVert;
+	queue.Add(packet);
+}
+
+/// <summary>
+/// Records the water quad, tessellated.
+/// After the depth pre-pass, only the fragments at the stored depth pass the test.
+/// </summary>
+/// <param name="queue"> the render queue </param>
+/// <param name="pass"> the position of the pass in the frame </param>
+void drawWaterQuad(RenderQueue& queue, int pass) {
+	DrawPacket packet;
+	packet.pass = pass;
+	packet.program = waterProg->GetID();
+	packet.vao = waterVAO;
 	if (isTexturedLight) {
-		prog.Bind();
-		prog["env"] = 0;
-		
+		packet.Texture(0, GL_TEXTURE_2D_ARRAY, AL_Tex);
+	}
+	packet.Texture(1, GL_TEXTURE_2D_ARRAY, ltcLut);
+	packet.Texture(2, GL_TEXTURE_CUBE_MAP, envMap.GetID());
+	packet.Texture(3, GL_TEXTURE_2D, envBrdfLut);
+	packet.depthWrite = !useDepthPrepass;
+	packet.drawBuffers = sceneDrawBuffers(true);
+	packet.mode = GL_PATCHES;
+	packet.patchVertices = 3;
+	packet.count = totalNumVert;
+	queue.Add(packet);
+}
+
+/// <summary>
+/// Records the area light panels.
+/// </summary>
+/// <param name="queue"> the render queue </param>
+/// <param name="pass"> the position of the pass in the frame </param>
+void drawAreaLight(RenderQueue& queue, int pass) {
+	DrawPacket packet;
+	packet.pass = pass;
+	packet.program = areaLightProg.GetID();
+	packet.vao = areaLightVAO;
+	packet.Texture(0, GL_TEXTURE_2D_ARRAY, AL_Tex);
+	packet.drawBuffers = sceneDrawBuffers(false);
+	packet.count = areaLightNumVert;
+	queue.Add(packet);
+}
+
+/// <summary>
+/// Creates a window sized render texture with the given number of mip levels.
+/// </summary>
+/// <returns> the texture </returns>
+GLuint createRenderTexture(GLenum internalFormat, GLenum format, GLenum type, int levels) {
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	for (int level = 0; level < levels; level++) {
+		glTexImage2D(GL_TEXTURE_2D, level, internalFormat, std::max(ssrWidth >> level, 1), std::max(ssrHeight >> level, 1), 0, format, type, nullptr);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, levels > 1 ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return texture;
+}
+
+/// <summary>
+/// This method creates the render targets of the screen space reflections at
+/// the size of the window, again whenever the window size changes.
+/// </summary>
+/// <returns> true if the frame buffers are complete </returns>
+bool ssrSetup() {
+	int width = glutGet(GLUT_WINDOW_WIDTH);
+	int height = glutGet(GLUT_WINDOW_HEIGHT);
+	if (sceneFBO != 0 && width == ssrWidth && height == ssrHeight) {
+		return true;
+	}
+	if (sceneFBO != 0) {
+		GLuint textures[5] = { sceneColorTex, gbufferNormalTex, gbufferReflectionTex, sceneDepthTex, hiZTex };
+		glDeleteTextures(5, textures);
+		glDeleteFramebuffers(1, &sceneFBO);
+		glDeleteFramebuffers(1, &hiZFBO);
 	}
 	else {
-		altProg.Bind();
-		altProg["env"] = 0;
+		glGenVertexArrays(1, &screenVAO);
+	}
+	ssrWidth = width;
+	ssrHeight = height;
+	hiZLevels = 1;
+	while ((std::max(ssrWidth, ssrHeight) >> hiZLevels) > 0) {
+		hiZLevels++;
+	}
+
+	// the scene color has mips for the reflections of rough water
+	sceneColorTex = createRenderTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, hiZLevels);
+	gbufferNormalTex = createRenderTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT, 1);
+	gbufferReflectionTex = createRenderTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT, 1);
+	sceneDepthTex = createRenderTexture(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, 1);
+	hiZTex = createRenderTexture(GL_R32F, GL_RED, GL_FLOAT, hiZLevels);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenFramebuffers(1, &sceneFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sceneColorTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gbufferNormalTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gbufferReflectionTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, sceneDepthTex, 0);
+	GLenum sceneStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	glGenFramebuffers(1, &hiZFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, hiZFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiZTex, 0);
+	GLenum hiZStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (sceneStatus != GL_FRAMEBUFFER_COMPLETE || hiZStatus != GL_FRAMEBUFFER_COMPLETE) {
+		cerr << "Error: Screen space reflection frame buffers are incomplete (" << hex << sceneStatus << ", " << hiZStatus << dec << ")" << endl;
+		return false;
 	}
-	glDrawArrays(GL_PATCHES, 0, totalNumVert);
+	return true;
 }
 
 /// <summary>
-/// This method draws the area light.
+/// This method builds the min depth pyramid from the depth of the scene, one
+/// level per pass. The level read is made the only level of hiZTex while the
+/// next one is written, so the pass never samples the level it renders to.
+/// </summary>
+void buildHiZ() {
+	TRACE_SCOPE("buildHiZ");
+	glBindFramebuffer(GL_FRAMEBUFFER, hiZFBO);
+	glDisable(GL_DEPTH_TEST);
+	glBindVertexArray(screenVAO);
+	hiZProg.Bind();
+	hiZProg["source"] = 0;
+	glActiveTexture(GL_TEXTURE0);
+	for (int level = 0; level < hiZLevels; level++) {
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiZTex, level);
+		glViewport(0, 0, std::max(ssrWidth >> level, 1), std::max(ssrHeight >> level, 1));
+		if (level == 0) {
+			glBindTexture(GL_TEXTURE_2D, sceneDepthTex);
+			hiZProg["reduce"] = 0;
+			glUniform2i(glGetUniformLocation(hiZProg.GetID(), "sourceSize"), ssrWidth, ssrHeight);
+		}
+		else {
+			glBindTexture(GL_TEXTURE_2D, hiZTex);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+			hiZProg["reduce"] = 1;
+			glUniform2i(glGetUniformLocation(hiZProg.GetID(), "sourceSize"), std::max(ssrWidth >> (level - 1), 1), std::max(ssrHeight >> (level - 1), 1));
+		}
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+	glBindTexture(GL_TEXTURE_2D, hiZTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hiZLevels - 1);
+	glViewport(0, 0, ssrWidth, ssrHeight);
+	glEnable(GL_DEPTH_TEST);
+}
+
+/// <summary>
+/// This method traces the reflections of the water and composites the scene into the window.
 /// </summary>
-void drawAreaLight() {
-	glBindVertexArray(areaLightVAO);
-	areaLightProg.Bind();
-	glDrawArrays(GL_TRIANGLES, 0, areaLightNumVert);
+void drawReflections() {
+	TRACE_SCOPE("drawReflections");
+	const SSRPreset& preset = ssrPresets[ssrPreset];
+	if (preset.colorLodScale > 0.0f) {
+		glBindTexture(GL_TEXTURE_2D, sceneColorTex);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDisable(GL_DEPTH_TEST);
+	glBindVertexArray(screenVAO);
+	ssrProg.Bind();
+	const GLuint textures[4] = { sceneColorTex, hiZTex, gbufferNormalTex, gbufferReflectionTex };
+	for (int unit = 0; unit < 4; unit++) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, textures[unit]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	ssrProg["sceneColor"] = 0;
+	ssrProg["hiZ"] = 1;
+	ssrProg["gbufferNormal"] = 2;
+	ssrProg["gbufferReflection"] = 3;
+	ssrProg["hiZLevels"] = hiZLevels;
+	ssrProg["maxIterations"] = preset.maxIterations;
+	ssrProg["maxRoughness"] = preset.maxRoughness;
+	ssrProg["maxDistance"] = preset.maxDistance;
+	ssrProg["thickness"] = ssrThickness;
+	ssrProg["colorLodScale"] = preset.colorLodScale;
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glEnable(GL_DEPTH_TEST);
 }
 
 /// <summary>
@@ -494,89 +1218,1002 @@ void cameraVectors() {
 /// <summary>
 /// This method handles the camera movement.
 /// </summary>
-/// <param name="deltaTime"> time passed </param>
-void cameraMovement(float deltaTime) {
-	float moveSpeed = 10.0f * deltaTime; // Speed of camera movement
+/// <param name="sim"> the keys held down, the camera vectors and the time passed </param>
+/// <returns> the distance the camera moves </returns>
+cy::Vec3f cameraMovement(const FrameSimulation& sim) {
+	float moveSpeed = 10.0f * sim.deltaTime; // Speed of camera movement
+	cy::Vec3f move(0.0f, 0.0f, 0.0f);
 
 	// Handle camera movement
-	if (wPressed) {
-		camPosition += frontVector * moveSpeed;
+	if (sim.forward) {
+		move += sim.frontVector * moveSpeed;
+	}
+	if (sim.back) {
+		move -= sim.frontVector * moveSpeed;
+	}
+	if (sim.left) {
+		move -= sim.rightVector * moveSpeed;
+	}
+	if (sim.right) {
+		move += sim.rightVector * moveSpeed;
+	}
+	if (sim.up) {
+		move += upVector * moveSpeed;
+	}
+	if (sim.down) {
+		move -= upVector * moveSpeed;
+	}
+	return move;
+}
+
+/// <summary>
+/// This method uploads the next decoded video frame of the area lights, if it is due.
+/// It never waits: when no frame is decoded yet, or the pixel buffer to fill is
+/// still being read by the GPU, the current frame simply stays on the lights.
+/// The copy into the texture is done by the GPU from the pixel buffer object.
+/// </summary>
+/// <param name="time"> the time passed </param>
+void updateLightVideo(float time) {
+	if (!isLightVideo || time < lightVideoNextFrame) {
+		return;
+	}
+
+	GLsync& fence = lightVideoFence[lightVideoPBOIndex];
+	if (fence) {
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+			return;
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+	if (!lightVideo.Pop(lightVideoFrame)) {
+		return;
+	}
+
+	TRACE_SCOPE("updateLightVideo");
+	auto start = chrono::steady_clock::now();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, lightVideoPBO[lightVideoPBOIndex]);
+	// the fence above guarantees the GPU is done with this buffer
+	void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, lightVideoFrameSize, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (dst) {
+		memcpy(dst, lightVideoFrame.data(), lightVideoFrameSize);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, AL_Tex);
+		for (size_t level = 0; level < lightVideoLevelOffsets.size(); level++) {
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, GLint(level), 0, 0, 0, lightVideoLevelWidths[level], lightVideoLevelHeights[level], numAreaLights,
+				GL_RGBA, GL_UNSIGNED_BYTE, (void*)lightVideoLevelOffsets[level]);
+		}
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		lightVideoPBOIndex = (lightVideoPBOIndex + 1) % lightVideoPBOCount;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	lightVideoUploadMicroseconds += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+	lightVideoUploads++;
+	TRACE_COUNTER("texture upload bytes", lightVideoFrameSize);
+
+	lightVideoNextFrame = std::max(lightVideoNextFrame + 1.0f / lightVideoFps, time - 1.0f / lightVideoFps);
+
+	// throughput: how fast the decode thread and the upload could go, and what is shown
+	if (time - lightVideoReportTime >= 2.0f) {
+		double decodeSeconds = lightVideo.decodeMicroseconds.exchange(0) / 1e6;
+		int decoded = lightVideo.decodedFrames.exchange(0);
+		double uploadSeconds = lightVideoUploadMicroseconds / 1e6;
+		cout << "light video: decode " << (decodeSeconds > 0.0 ? decoded / decodeSeconds : 0.0) << " fps, upload "
+			<< (uploadSeconds > 0.0 ? lightVideoUploads / uploadSeconds : 0.0) << " fps, shown "
+			<< lightVideoUploads / (time - lightVideoReportTime) << " fps" << endl;
+		lightVideoUploads = 0;
+		lightVideoUploadMicroseconds = 0;
+		lightVideoReportTime = time;
+	}
+}
+
+/// <summary>
+/// This method picks the patches to capture, the ones within the capture radius
+/// of the camera. The water is not moved sideways by the waves, so the patches
+/// are picked by their undisplaced triangles, in ranges run as jobs.
+/// </summary>
+/// <param name="sim"> the camera and radius, receives the patches </param>
+/// <param name="eye"> the camera position </param>
+void selectCapturePatches(FrameSimulation& sim, cy::Vec3f eye) {
+	const size_t grain = 4096;
+	size_t numPatches = size_t(totalNumVert / 3);
+	std::vector<std::vector<GLint>> rangeFirsts((numPatches + grain - 1) / grain);
+	float radius = sim.captureRadius;
+	jobs.ParallelFor("capture culling", numPatches, grain, [&](size_t begin, size_t end) {
+		std::vector<GLint>& firsts = rangeFirsts[begin / grain];
+		for (size_t patch = begin; patch < end; patch++) {
+			int first = int(patch * 3);
+			float minX = std::min({ vertices[first].x, vertices[first + 1].x, vertices[first + 2].x });
+			float maxX = std::max({ vertices[first].x, vertices[first + 1].x, vertices[first + 2].x });
+			float minZ = std::min({ vertices[first].z, vertices[first + 1].z, vertices[first + 2].z });
+			float maxZ = std::max({ vertices[first].z, vertices[first + 1].z, vertices[first + 2].z });
+			float dx = std::max({ minX - eye.x, eye.x - maxX, 0.0f });
+			float dz = std::max({ minZ - eye.z, eye.z - maxZ, 0.0f });
+			if (dx * dx + dz * dz <= radius * radius) {
+				firsts.push_back(first);
+			}
+		}
+	});
+	sim.captureFirsts.clear();
+	for (const std::vector<GLint>& firsts : rangeFirsts) {
+		sim.captureFirsts.insert(sim.captureFirsts.end(), firsts.begin(), firsts.end());
+	}
+	sim.captureCounts.assign(sim.captureFirsts.size(), 3);
+}
+
+/// <summary>
+/// This method captures the displaced water of the patches picked by the simulation of the frame.
+/// </summary>
+void captureWaveSurface() {
+	TRACE_SCOPE("captureWaveSurface");
+	TRACE_COUNTER("patches captured", waveCaptureFirsts.size());
+	if (waveCaptureFirsts.empty()) {
+		return;
+	}
+
+	// the most triangles a patch is tessellated into: 3 n^2 / 2 for the inner level n
+	int maxLevel = std::min(tessLevel + 4, 64);
+	waveCapture.Reserve(waveCaptureFirsts.size() * 3 * ((3 * maxLevel * maxLevel + 1) / 2));
+	waveCaptureProg.Bind();
+	glBindVertexArray(waterVAO);
+	glPatchParameteri(GL_PATCH_VERTICES, 3);
+	waveCapture.Capture([] {
+		glMultiDrawArrays(GL_PATCHES, waveCaptureFirsts.data(), waveCaptureCounts.data(), GLsizei(waveCaptureFirsts.size()));
+	});
+}
+
+/// <summary>
+/// This method finds the height of the captured water surface at a point.
+/// </summary>
+/// <param name="x"> the x coordinate </param>
+/// <param name="z"> the z coordinate </param>
+/// <param name="height"> receives the height </param>
+/// <returns> true if the point is on the captured patches </returns>
+bool waveSurfaceHeight(float x, float z, float& height) {
+	for (size_t i = 0; i + 2 < waveSurface.size(); i += 3) {
+		const float* a = waveSurface[i].position;
+		const float* b = waveSurface[i + 1].position;
+		const float* c = waveSurface[i + 2].position;
+		float area = (b[0] - a[0]) * (c[2] - a[2]) - (c[0] - a[0]) * (b[2] - a[2]);
+		if (area == 0.0f) {
+			continue;
+		}
+		float u = ((b[0] - x) * (c[2] - z) - (c[0] - x) * (b[2] - z)) / area;
+		float v = ((c[0] - x) * (a[2] - z) - (a[0] - x) * (c[2] - z)) / area;
+		float w = 1.0f - u - v;
+		if (u >= 0.0f && v >= 0.0f && w >= 0.0f) {
+			height = u * a[1] + v * b[1] + w * c[1];
+			return true;
+		}
 	}
-	if (sPressed) {
-		camPosition -= frontVector * moveSpeed;
+	return false;
+}
+
+/// <summary>
+/// This method reads back the water captured two frames ago, if the GPU is
+/// done with it, and keeps the camera above it.
+/// </summary>
+/// <param name="time"> the time passed </param>
+void readWaveSurface(float time) {
+	TRACE_SCOPE("readWaveSurface");
+	float height;
+	if (waveCapture.Read(waveSurface) && waveSurfaceHeight(camPosition.x, camPosition.z, height)) {
+		camPosition.y = std::max(camPosition.y, height + cameraClearance);
+	}
+	if (time - waveCaptureReportTime >= 2.0f) {
+		cout << waveCaptureFirsts.size() << " patches captured, ";
+		waveCapture.Report(cout, time - waveCaptureReportTime);
+		waveCaptureReportTime = time;
+	}
+}
+
+/// <summary>
+/// This method handles the time calculations.
+/// </summary>
+/// <param name="deltaTime"> receives the time since the last frame </param>
+/// <returns> time passed </returns>
+float timeCalculations(float& deltaTime) {
+	static int prevTime = glutGet(GLUT_ELAPSED_TIME);
+	int currentTime = glutGet(GLUT_ELAPSED_TIME);
+	deltaTime = (currentTime - prevTime) / 1000.0f;
+	prevTime = currentTime;
+	timePassed += deltaTime;  // Accumulate time
+
+	return timePassed;
+}
+
+/// <summary>
+/// This method runs the CPU work of a frame. It only touches the frame
+/// simulation and the data that does not change after loading.
+/// </summary>
+/// <param name="sim"> the inputs and results </param>
+void simulateFrame(FrameSimulation& sim) {
+	sim.move = cameraMovement(sim);
+	cy::Vec3f eye = sim.position + sim.move;
+	sim.view = frameView(eye, sim.frontVector, sim.rightVector, sim.width, sim.height);
+	if (sim.capture) {
+		selectCapturePatches(sim, eye);
+	}
+}
+
+/// <summary>
+/// This method copies the inputs of the next frame and starts its simulation
+/// as a job. The time of the frame is not known yet, the last one is used.
+/// </summary>
+/// <param name="deltaTime"> the time since the last frame </param>
+void startSimulation(float deltaTime) {
+	simulation.deltaTime = deltaTime;
+	simulation.forward = wPressed;
+	simulation.back = sPressed;
+	simulation.left = aPressed;
+	simulation.right = dPressed;
+	simulation.up = spacePressed;
+	simulation.down = shiftPressed;
+	simulation.position = camPosition;
+	simulation.frontVector = frontVector;
+	simulation.rightVector = rightVector;
+	simulation.cameraRevision = cameraRevision;
+	simulation.width = windowWidth;
+	simulation.height = windowHeight;
+	simulation.capture = useWaveCapture;
+	simulation.captureRadius = waveCaptureRadius;
+	simulationJob = jobs.Run("simulate frame", [] { simulateFrame(simulation); });
+}
+
+/// <summary>
+/// This method waits for the simulation of this frame and applies it. It runs
+/// now if it was not started during the last frame.
+/// </summary>
+/// <param name="deltaTime"> the time since the last frame </param>
+void finishSimulation(float deltaTime) {
+	TRACE_SCOPE("finishSimulation");
+	if (!simulationJob.Valid()) {
+		startSimulation(deltaTime);
+	}
+	jobs.Wait(simulationJob);
+	simulationJob = JobHandle();
+
+	// the mouse may have moved the camera while the job ran, the move adds to it
+	camPosition += simulation.move;
+	if (simulation.cameraRevision == cameraRevision) {
+		quadMVP(simulation.view);
+	}
+	else {
+		quadMVP();
+	}
+	waveCaptureFirsts.swap(simulation.captureFirsts);
+	waveCaptureCounts.swap(simulation.captureCounts);
+	if (!simulation.capture) {
+		waveCaptureFirsts.clear();
+		waveCaptureCounts.clear();
+	}
+}
+
+/// <summary>
+/// The passes of a frame. Each pass records its draws with the state they
+/// need, so they can be drawn in any order; a pass with an enabled flag is
+/// skipped while it is off.
+/// </summary>
+struct RenderPass {
+	const char* name;
+	void (*draw)(RenderQueue& queue, int pass);
+	const bool* enabled;
+	bool tessellated;	// the GPU timers count its pipeline statistics
+};
+const RenderPass renderPasses[] = {
+	{ "areaLights", drawAreaLight, nullptr, false },
+	{ "depthPrepass", drawDepthPrepass, &useDepthPrepass, true },
+	{ "water", drawWaterQuad, nullptr, true },
+	{ "sky", drawCubemap, nullptr, false },
+};
+const int numRenderPasses = sizeof(renderPasses) / sizeof(renderPasses[0]);
+
+/// <summary>
+/// The order of the passes, as indices into renderPasses.
+/// By default the opaque light panels are drawn first so the early depth test
+/// rejects the water behind them, and the sky last at the far plane.
+/// </summary>
+std::vector<int> renderOrder = { 0, 1, 2, 3 };
+const char* renderOrderPath = "renderOrder.txt";
+
+/// <summary>
+/// This method reads the order of the passes, one pass name per line, # starts
+/// a comment. The default order is kept if the file is missing or invalid.
+/// </summary>
+/// <param name="path"> the file to read </param>
+void loadRenderOrder(const char* path) {
+	ifstream file(path);
+	if (!file) {
+		return;
+	}
+	std::vector<int> order;
+	string line;
+	while (getline(file, line)) {
+		line = line.substr(0, line.find('#'));
+		size_t begin = line.find_first_not_of(" \t\r");
+		if (begin == string::npos) {
+			continue;
+		}
+		string name = line.substr(begin, line.find_last_not_of(" \t\r") + 1 - begin);
+		int pass = 0;
+		while (pass < numRenderPasses && name != renderPasses[pass].name) {
+			pass++;
+		}
+		if (pass == numRenderPasses) {
+			cerr << "Error: Unknown render pass \"" << name << "\" in " << path << ", using the default order" << endl;
+			return;
+		}
+		order.push_back(pass);
+	}
+	renderOrder = order;
+}
+
+/// <summary>
+/// This method shows the draw calls and state changes of the last frame in the window title.
+/// </summary>
+void showRenderStats() {
+	const RenderQueueStats& stats = renderQueue.Stats();
+	if (stats.drawCalls == shownDrawCalls && stats.StateChanges() == shownStateChanges) {
+		return;
+	}
+	shownDrawCalls = stats.drawCalls;
+	shownStateChanges = stats.StateChanges();
+	string title = string(windowTitle) + " | " + to_string(stats.drawCalls) + " draws, " + to_string(stats.StateChanges()) + " state changes ("
+		+ to_string(stats.programBinds) + " programs, " + to_string(stats.vaoBinds) + " vertex arrays, "
+		+ to_string(stats.textureBinds) + " textures, " + to_string(stats.rasterStateChanges) + " raster)";
+	glutSetWindowTitle(title.c_str());
+}
+
+/// <summary>
+/// This method switches between the textured and the plain area lights.
+/// </summary>
+void setTexturedLight(bool textured) {
+	isTexturedLight = textured;
+	waterVariantStale = true;
+}
+
+/// <summary>
+/// This method turns the directional light on or off.
+/// </summary>
+void setDirectionalLight(bool directional) {
+	isDirectionalLight = directional;
+	cubeProg["isDirectionalLight"] = isDirectionalLight ? 1 : 0;
+	waterVariantStale = true;
+}
+
+/// <summary>
+/// This method shows or hides the triangulation, the other water variants
+/// get the setting when they are selected.
+/// </summary>
+void setShowTriangulation(bool show) {
+	showTriangulation = show;
+	(*waterProg)["showTriangulation"] = showTriangulation ? 1 : 0;
+}
+
+/// <summary>
+/// This method moves the camera to a key of a path.
+/// </summary>
+void setCamera(const CameraKey& key) {
+	camPosition = key.position;
+	theta = key.theta;
+	phi = key.phi;
+	cameraVectors();
+	cameraRevision++;
+	quadMVP();
+}
+
+/// <summary>
+/// This method moves the camera to the path at a time.
+/// </summary>
+/// <param name="time"> the time on the path </param>
+void applyCameraPath(float time) {
+	setCamera(cameraPath.Sample(time));
+}
+
+/// <summary>
+/// This method starts or stops recording the camera. The path is written
+/// when the recording stops.
+/// </summary>
+void toggleCameraRecording() {
+	recordingCameraPath = !recordingCameraPath;
+	if (recordingCameraPath) {
+		cameraPath.Clear();
+		cameraRecordStart = timePassed;
+		cameraRecordLast = timePassed - cameraRecordInterval;
+		cout << "recording the camera" << endl;
+		return;
+	}
+	cameraPath.Add(CameraKey{ timePassed - cameraRecordStart, camPosition, theta, phi });
+	if (cameraPath.Save(cameraRecordFile)) {
+		cout << cameraPath.Size() << " camera keys written to " << cameraRecordFile << endl;
+	}
+}
+
+/// <summary>
+/// This method adds a key to the camera recording when one is due.
+/// </summary>
+/// <param name="time"> the time passed </param>
+void recordCamera(float time) {
+	if (time - cameraRecordLast >= cameraRecordInterval) {
+		cameraPath.Add(CameraKey{ time - cameraRecordStart, camPosition, theta, phi });
+		cameraRecordLast = time;
+	}
+}
+
+/// <summary>
+/// This method applies the configuration of the benchmark at benchIndex.
+/// </summary>
+void applyBenchConfig() {
+	const BenchConfig& config = benchConfigs[benchIndex];
+	setTexturedLight(config.textured);
+	setDirectionalLight(config.directional);
+	setShowTriangulation(config.triangulation);
+	benchFrame = 0;
+	benchFrameMs.clear();
+}
+
+/// <summary>
+/// The name of a benchmark configuration, a single word so the results split on spaces.
+/// </summary>
+string benchConfigName(const BenchConfig& config) {
+	return string(config.textured ? "textured" : "plain") + (config.directional ? "+directional" : "") +
+		(config.triangulation ? "+triangulation" : "");
+}
+
+/// <summary>
+/// This method opens the results of the benchmark and applies its first configuration.
+/// </summary>
+/// <returns> false if the results cannot be written </returns>
+bool startBench() {
+	benchFile.open(benchResultsPath);
+	if (!benchFile) {
+		cerr << "Error: Could not write " << benchResultsPath << endl;
+		return false;
+	}
+	for (bool textured : { false, true }) {
+		for (bool directional : { true, false }) {
+			for (bool triangulation : { false, true }) {
+				benchConfigs.push_back({ textured, directional, triangulation });
+			}
+		}
+	}
+	benchFile << "# flythrough " << cameraPathFile << ", " << cameraPath.EndTime() - cameraPath.StartTime() << " s at "
+		<< 1.0f / benchStep << " frames per second of path time, " << windowWidth << "x" << windowHeight
+		<< ", tess level " << tessLevel << ", radii " << innerRadius << " " << outerRadius
+		<< (useUberShader ? ", uber shader" : ", specialized shader variants") << endl;
+	benchFile << "# " << glGetString(GL_RENDERER) << endl;
+	benchFile << left << setw(40) << "config" << right << setw(8) << "frames";
+	for (const char* column : { "avgMs", "p50Ms", "p95Ms", "p99Ms", "maxMs", "gpuMs" }) {
+		benchFile << setw(10) << column;
 	}
-	if (aPressed) {
-		camPosition -= rightVector * moveSpeed;
+	benchFile << endl << fixed << setprecision(3);
+	gpuTimers.SetEnabled(true);
+	benchIndex = 0;
+	applyBenchConfig();
+	cout << "bench: " << benchConfigs.size() << " configurations into " << benchResultsPath << endl;
+	return true;
+}
+
+/// <summary>
+/// This method writes the line of the configuration just replayed.
+/// </summary>
+void writeBenchResult() {
+	std::vector<double> sorted = benchFrameMs;
+	std::sort(sorted.begin(), sorted.end());
+	auto percentile = [&](double p) {
+		// nearest rank
+		size_t rank = size_t(std::ceil(p / 100.0 * sorted.size()));
+		return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+	};
+	double total = 0.0;
+	for (double ms : sorted) {
+		total += ms;
 	}
-	if (dPressed) {
-		camPosition += rightVector * moveSpeed;
+	double gpuMs = 0.0;
+	for (const RenderPass& pass : renderPasses) {
+		gpuMs += gpuTimers.AverageMs(pass.name);
+	}
+	string name = benchConfigName(benchConfigs[benchIndex]);
+	benchFile << left << setw(40) << name << right << setw(8) << sorted.size() << setw(10) << total / sorted.size()
+		<< setw(10) << percentile(50.0) << setw(10) << percentile(95.0) << setw(10) << percentile(99.0)
+		<< setw(10) << sorted.back() << setw(10) << gpuMs << endl;
+	cout << "bench " << benchIndex + 1 << "/" << benchConfigs.size() << ": " << name << ", " << total / sorted.size()
+		<< " ms average, " << percentile(99.0) << " ms p99" << endl;
+}
+
+/// <summary>
+/// This method moves the benchmark on by one frame: it records the time of
+/// the last frame and, after the last frame of a configuration, writes its
+/// line and applies the next one. Call it at the start of the frame.
+/// </summary>
+/// <returns> the time on the path of this frame </returns>
+float benchStepFrame() {
+	auto now = chrono::steady_clock::now();
+	if (benchFrame > benchWarmupFrames) {
+		benchFrameMs.push_back(chrono::duration<double, milli>(now - benchLastFrame).count());
+	}
+	benchLastFrame = now;
+	int measured = benchFrame - benchWarmupFrames;
+	float time = cameraPath.StartTime() + std::max(measured, 0) * benchStep;
+	if (time > cameraPath.EndTime() + 0.5f * benchStep) {
+		writeBenchResult();
+		benchIndex++;
+		if (benchIndex == benchConfigs.size()) {
+			benchFile.close();
+			cout << "bench written to " << benchResultsPath << endl;
+			glutLeaveMainLoop();
+			return cameraPath.StartTime();
+		}
+		applyBenchConfig();
+		time = cameraPath.StartTime();
+		measured = -benchWarmupFrames;
+	}
+	if (measured == 0) {
+		// drop the GPU results of the warm up, and of the configuration before
+		gpuTimers.SetEnabled(true);
+	}
+	benchFrame++;
+	return time;
+}
+
+/// <summary>
+/// This method reads the image drawn into the back buffer, the first row at the top.
+/// </summary>
+/// <param name="image"> receives windowWidth * windowHeight RGB8 pixels </param>
+void readFrame(std::vector<unsigned char>& image) {
+	size_t row = size_t(windowWidth) * 3;
+	image.resize(row * windowHeight);
+	glReadBuffer(GL_BACK);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, windowWidth, windowHeight, GL_RGB, GL_UNSIGNED_BYTE, image.data());
+	for (size_t y = 0; y < windowHeight / 2; y++) {
+		std::swap_ranges(image.begin() + y * row, image.begin() + (y + 1) * row, image.begin() + (windowHeight - 1 - y) * row);
+	}
+}
+
+/// <summary>
+/// This method applies the case of the golden image test at goldenIndex.
+/// </summary>
+void applyGoldenCase() {
+	const GoldenCase& test = goldenCases[goldenIndex];
+	setTexturedLight(test.textured);
+	setDirectionalLight(test.directional);
+	setShowTriangulation(test.triangulation);
+	tessLevel = test.tessLevel;
+	innerRadius = test.innerRadius;
+	outerRadius = test.innerRadius + sweepRadiusSpan;
+	updateTessAndRadiusUniforms();
+	setCamera(test.camera);
+	goldenFrame = 0;
+	goldenFrameMs = 0.0;
+}
+
+/// <summary>
+/// This method reads the cases of the golden image test and applies the first.
+/// </summary>
+/// <returns> false, with an error printed, if the cases cannot be read </returns>
+bool startGoldenTest() {
+	ifstream file(goldenCasesPath);
+	if (!file) {
+		cerr << "Error: Could not open " << goldenCasesPath << endl;
+		return false;
+	}
+	string path = goldenCasesPath;
+	size_t slash = path.find_last_of("/\\");
+	goldenDirectory = slash == string::npos ? "" : path.substr(0, slash + 1);
+	string line;
+	int lineNumber = 0;
+	while (getline(file, line)) {
+		lineNumber++;
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == string::npos || line[first] == '#') {
+			continue;
+		}
+		istringstream fields(line);
+		GoldenCase test;
+		int textured, directional, triangulation;
+		CameraKey& camera = test.camera;
+		if (!(fields >> test.name >> test.time >> camera.position.x >> camera.position.y >> camera.position.z >> camera.theta >> camera.phi
+			>> textured >> directional >> triangulation >> test.tessLevel >> test.innerRadius >> test.minSsim >> test.minBlockSsim)) {
+			cerr << "Error: " << goldenCasesPath << ":" << lineNumber << ": expected name time x y z theta phi textured directional "
+				"triangulation tessLevel innerRadius minSsim minBlockSsim" << endl;
+			return false;
+		}
+		camera.time = test.time;
+		test.textured = textured != 0;
+		test.directional = directional != 0;
+		test.triangulation = triangulation != 0;
+		goldenCases.push_back(test);
+	}
+	if (goldenCases.empty()) {
+		cerr << "Error: " << goldenCasesPath << " has no cases" << endl;
+		return false;
+	}
+	gpuTimers.SetEnabled(true);
+	goldenIndex = 0;
+	goldenFailures = 0;
+	goldenSkipped = 0;
+	applyGoldenCase();
+	cout << "golden images: " << goldenCases.size() << " cases from " << goldenCasesPath << (updateGoldens ? ", updating" : "") << endl;
+	cout << left << setw(28) << "case" << right << setw(10) << "ssim" << setw(10) << "minBlock" << setw(8) << "rmse"
+		<< setw(6) << "max" << setw(10) << "frameMs" << setw(10) << "gpuMs" << "  result" << endl;
+	return true;
+}
+
+/// <summary>
+/// This method compares the image of the current case with its golden, or
+/// writes it as the golden, and prints its line.
+/// </summary>
+/// <param name="image"> the image drawn </param>
+void checkGoldenCase(const std::vector<unsigned char>& image) {
+	const GoldenCase& test = goldenCases[goldenIndex];
+	string goldenPath = goldenDirectory + test.name + ".png";
+	double gpuMs = 0.0;
+	for (const RenderPass& pass : renderPasses) {
+		gpuMs += gpuTimers.AverageMs(pass.name);
+	}
+	cout << left << setw(28) << test.name << right << fixed;
+	if (updateGoldens) {
+		unsigned error = lodepng::encode(goldenPath, image, windowWidth, windowHeight, LCT_RGB);
+		cout << setw(44) << "" << setprecision(3) << setw(10) << goldenFrameMs / goldenFrames << setw(10) << gpuMs << "  "
+			<< (error ? "not written: " + string(lodepng_error_text(error)) : "written") << defaultfloat << endl;
+		goldenFailures += error ? 1 : 0;
+		return;
+	}
+
+	std::vector<unsigned char> golden;
+	unsigned width = 0, height = 0;
+	unsigned error = lodepng::decode(golden, width, height, goldenPath, LCT_RGB);
+	string result;
+	ImageDiff diff;
+	std::vector<unsigned char> ssimMap;
+	bool skipped = !ifstream(goldenPath);
+	if (skipped) {
+		// a first run, not a regression
+		result = "skipped, no golden: run --golden-update";
+		goldenSkipped++;
+	}
+	else if (error) {
+		result = "FAIL, the golden can't be read: " + string(lodepng_error_text(error));
+	}
+	else if (width != windowWidth || height != windowHeight) {
+		result = "FAIL, the golden is " + to_string(width) + "x" + to_string(height);
+	}
+	else {
+		diff = compareImages(image.data(), golden.data(), windowWidth, windowHeight, &ssimMap);
+		bool passed = diff.ssim >= test.minSsim && diff.minBlockSsim >= test.minBlockSsim;
+		result = passed ? "pass" : "FAIL";
+	}
+	if (result != "pass" && !skipped) {
+		// the image and where it differs, to look at next to the golden
+		goldenFailures++;
+		lodepng::encode(goldenDirectory + test.name + ".actual.png", image, windowWidth, windowHeight, LCT_RGB);
+		if (!ssimMap.empty()) {
+			lodepng::encode(goldenDirectory + test.name + ".ssim.png", ssimMap, windowWidth, windowHeight, LCT_RGB);
+		}
 	}
-	if (spacePressed) {
-		camPosition += upVector * moveSpeed;
+	cout << setprecision(4) << setw(10) << diff.ssim << setw(10) << diff.minBlockSsim << setprecision(2) << setw(8) << diff.rmse
+		<< setw(6) << diff.maxError << setprecision(3) << setw(10) << goldenFrameMs / goldenFrames << setw(10) << gpuMs
+		<< "  " << result << defaultfloat << endl;
+}
+
+/// <summary>
+/// This method moves the golden image test on by one frame. After the last
+/// frame of a case, it checks the image and applies the next case. Call it
+/// after drawing, before swapping the buffers.
+/// </summary>
+/// <param name="frameMs"> the time of the last frame </param>
+void goldenStep(double frameMs) {
+	goldenFrame++;
+	if (goldenFrame == goldenWarmupFrames) {
+		// drop the GPU results of the warm up, and of the case before
+		gpuTimers.SetEnabled(true);
+		return;
+	}
+	if (goldenFrame > goldenWarmupFrames) {
+		goldenFrameMs += frameMs;
+	}
+	if (goldenFrame < goldenWarmupFrames + goldenFrames) {
+		return;
+	}
+
+	std::vector<unsigned char> image;
+	readFrame(image);
+	checkGoldenCase(image);
+	goldenIndex++;
+	if (goldenIndex < goldenCases.size()) {
+		applyGoldenCase();
+		return;
+	}
+	cout << goldenCases.size() - goldenFailures - goldenSkipped << " of " << goldenCases.size() << " cases "
+		<< (updateGoldens ? "written" : "passed");
+	if (goldenSkipped > 0) {
+		cout << ", " << goldenSkipped << " skipped without a golden, write them with --golden-update";
+	}
+	cout << endl;
+	glutLeaveMainLoop(); // main returns the result
+}
+
+/// <summary>
+/// This method applies the setting of the sweep at sweepIndex.
+/// </summary>
+void applySweepSetting() {
+	const SweepSetting& setting = sweepSettings[sweepIndex];
+	tessLevel = setting.tessLevel;
+	innerRadius = setting.innerRadius;
+	outerRadius = setting.outerRadius;
+	updateTessAndRadiusUniforms();
+	sweepFrame = 0;
+	sweepFrameMs = 0.0;
+}
+
+/// <summary>
+/// This method opens the table of the sweep and applies its first setting.
+/// </summary>
+/// <returns> false if the table cannot be written </returns>
+bool startSweep() {
+	sweepFile.open(sweepPath);
+	if (!sweepFile) {
+		cerr << "Error: Could not write " << sweepPath << endl;
+		return false;
+	}
+	for (float inner : sweepInnerRadii) {
+		for (int level : sweepTessLevels) {
+			sweepSettings.push_back({ level, inner, inner + sweepRadiusSpan });
+		}
+	}
+	sweepFile << "tessLevel,innerRadius,outerRadius,frameMs,gpuMs,waterMs";
+	for (int statistic = 0; statistic < GpuTimers::NumPipelineStatistics; statistic++) {
+		sweepFile << "," << GpuTimers::PipelineStatisticName(statistic);
+	}
+	sweepFile << ",samplesPassed,rmse,maxError,changedPixels" << endl;
+	sweepFile << fixed << setprecision(3);
+	gpuTimers.SetEnabled(true);
+	sweepIndex = 0;
+	applySweepSetting();
+	cout << "sweep: " << sweepSettings.size() << " settings into " << sweepPath << endl;
+	return true;
+}
+
+/// <summary>
+/// This method moves the sweep on by one frame. After the last frame of a
+/// setting, it reads the image back, writes the row and applies the next setting.
+/// Call it after drawing, before swapping the buffers.
+/// </summary>
+/// <param name="frameMs"> the time of the last frame </param>
+void sweepStep(double frameMs) {
+	sweepFrame++;
+	if (sweepFrame == sweepWarmupFrames) {
+		// drop the GPU results of the warm up, and of the setting before
+		gpuTimers.SetEnabled(true);
+		return;
+	}
+	if (sweepFrame > sweepWarmupFrames) {
+		sweepFrameMs += frameMs;
+	}
+	if (sweepFrame < sweepWarmupFrames + sweepFrames) {
+		return;
+	}
+
+	std::vector<unsigned char> image;
+	readFrame(image);
+	if (sweepIndex == 0) {
+		sweepReference = image;
+	}
+	double squaredError = 0.0;
+	int maxError = 0;
+	size_t changedPixels = 0;
+	for (size_t pixel = 0; pixel < image.size(); pixel += 3) {
+		int pixelError = 0;
+		for (size_t c = pixel; c < pixel + 3; c++) {
+			int error = std::abs(int(image[c]) - int(sweepReference[c]));
+			squaredError += double(error) * error;
+			pixelError = std::max(pixelError, error);
+		}
+		maxError = std::max(maxError, pixelError);
+		changedPixels += pixelError > 8 ? 1 : 0;
+	}
+
+	const SweepSetting& setting = sweepSettings[sweepIndex];
+	double gpuMs = 0.0;
+	for (const RenderPass& pass : renderPasses) {
+		gpuMs += gpuTimers.AverageMs(pass.name);
+	}
+	sweepFile << setting.tessLevel << "," << setting.innerRadius << "," << setting.outerRadius << ","
+		<< sweepFrameMs / sweepFrames << "," << gpuMs << "," << gpuTimers.AverageMs("water");
+	for (int statistic = 0; statistic < GpuTimers::NumPipelineStatistics; statistic++) {
+		sweepFile << "," << gpuTimers.AverageStatistic("water", GpuTimers::PipelineStatistic(statistic));
+	}
+	sweepFile << "," << gpuTimers.AverageFragments("water") << "," << sqrt(squaredError / image.size()) << "," << maxError << ","
+		<< double(changedPixels) / (image.size() / 3) << endl;
+	cout << "sweep " << sweepIndex + 1 << "/" << sweepSettings.size() << ": tess level " << setting.tessLevel << ", radii "
+		<< setting.innerRadius << " " << setting.outerRadius << ", water " << gpuTimers.AverageMs("water") << " ms" << endl;
+
+	sweepIndex++;
+	if (sweepIndex == sweepSettings.size()) {
+		sweepFile.close();
+		cout << "sweep written to " << sweepPath << endl;
+		glutLeaveMainLoop();
+		return;
+	}
+	applySweepSetting();
+}
+
+/// <summary>
+/// This method writes the events traced since the last trace file to the next one.
+/// </summary>
+void writeTrace() {
+	if (!TraceEnabled) {
+		cout << "tracing is compiled out, build without NDEBUG or with TRACE_ENABLED=1" << endl;
+		return;
+	}
+	string path = string(tracePrefix) + to_string(traceFiles++) + ".json";
+	size_t dropped = 0;
+	int events = Tracer::Write(path.c_str(), &dropped);
+	if (events < 0) {
+		cerr << "Error: Could not write " << path << endl;
+		return;
 	}
-	if (shiftPressed) {
-		camPosition -= upVector * moveSpeed;
+	cout << events << " events traced to " << path;
+	if (dropped > 0) {
+		cout << " (" << dropped << " dropped, the buffers were full)";
 	}
-}
-
-/// <summary>
-/// This method handles the time calculations.
-/// </summary>
-/// <returns> time passed </returns>
-float timeCalculations() {
-	static int prevTime = glutGet(GLUT_ELAPSED_TIME);
-	int currentTime = glutGet(GLUT_ELAPSED_TIME);
-	float deltaTime = (currentTime - prevTime) / 1000.0f;
-	prevTime = currentTime;
-	timePassed += deltaTime;  // Accumulate time
-
-	cameraMovement(deltaTime);
-
-	return timePassed;
+	cout << endl;
 }
 
 /// <summary>
 /// Handles the display callback for rendering.
 /// </summary>
 void handleDisplay() {
-	quadMVP();
+	TRACE_SCOPE("handleDisplay");
+	if (reloadShaders) {
+		shaderReloader.Poll();
+	}
+	float deltaTime;
+	float time = timeCalculations(deltaTime);
+	float frameMs = deltaTime * 1000.0f;
+	if (sweepPath) {
+		// the sweep draws the same frame for every setting
+		timePassed = sweepTime;
+		time = sweepTime;
+		deltaTime = 0.0f;
+	}
+	else if (benchResultsPath) {
+		// the water moves with the path, by a fixed step per frame
+		time = benchStepFrame();
+		timePassed = time;
+		deltaTime = 0.0f;
+	}
+	else if (goldenCasesPath) {
+		time = goldenCases[goldenIndex].time;
+		timePassed = time;
+		deltaTime = 0.0f;
+	}
+	finishSimulation(deltaTime);
+	if (benchResultsPath) {
+		applyCameraPath(time);
+	}
+	else if (goldenCasesPath) {
+		setCamera(goldenCases[goldenIndex].camera);
+	}
+	else if (cameraPathFile) {
+		float duration = cameraPath.EndTime() - cameraPath.StartTime();
+		applyCameraPath(cameraPath.StartTime() + (duration > 0.0f ? fmod(time, duration) : 0.0f));
+	}
+	if (recordingCameraPath) {
+		recordCamera(time);
+	}
+	updateLightVideo(time);
+	(*waterProg)["time"] = time;
+	depthPrepassProg["time"] = time;
+	waveCaptureProg["time"] = time;
+	if (useWaveCapture) {
+		readWaveSurface(time);
+	}
 
-	float time = timeCalculations();
-	if (isTexturedLight) {
-		prog["time"] = time;
+	// the next frame is simulated on the workers while this one is submitted
+	if (overlapSimulation) {
+		startSimulation(deltaTime);
 	}
-	else {
-		altProg["time"] = time;
+
+	// the reflections are traced from the scene drawn into sceneFBO
+	if (ssrPreset != 0 && !ssrSetup()) {
+		ssrPreset = 0;
+		waterVariantStale = true;
+	}
+	if (waterVariantStale) {
+		selectWaterProgram();
+	}
+	if (ssrPreset != 0) {
+		glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
 	}
-	triangleLineProg["time"] = time;
 
 	// Clear the viewport
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glClearColor(0.4, 0.7, 0.8, 1);	// background color
-
-	AL_Tex.Bind(0);
-	if (isTexturedLight){
-		prog["areaLightTex"] = 0;
+	if (ssrPreset != 0) {
+		const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		setSceneDrawBuffers(true);
+		glClearBufferfv(GL_COLOR, 1, zero);
+		glClearBufferfv(GL_COLOR, 2, zero);
+		setSceneDrawBuffers(false);
 	}
-	areaLightProg["areaLightTex"] = 0;
 
-	if (isTexturedLight) {
-		areaLightProg["useTexture"] = 1;
+	// the passes record their draws, the queue submits them sorted by state
+	for (int position = 0; position < (int)renderOrder.size(); position++) {
+		const RenderPass& pass = renderPasses[renderOrder[position]];
+		if (pass.enabled && !*pass.enabled) {
+			continue;
+		}
+		pass.draw(renderQueue, position);
 	}
-	else {
-		areaLightProg["useTexture"] = 0;
+	// the fragments counted are the ones that pass the depth test, the ones shaded
+	{
+		TRACE_SCOPE("flush render queue");
+		renderQueue.Flush([](int position) {
+			gpuTimers.End();
+			if (position >= 0) {
+				const RenderPass& pass = renderPasses[renderOrder[position]];
+				gpuTimers.Begin(pass.name, true, pass.tessellated);
+			}
+		});
+	}
+	TRACE_COUNTER("draw calls", renderQueue.Stats().drawCalls);
+	TRACE_COUNTER("state changes", renderQueue.Stats().StateChanges());
+	TRACE_COUNTER("patches submitted", renderQueue.Stats().patches);
+	showRenderStats();
+
+	if (useWaveCapture) {
+		gpuTimers.Begin("waveCapture");
+		captureWaveSurface();
+		gpuTimers.End();
+	}
+
+	if (ssrPreset != 0) {
+		gpuTimers.Begin("hi-z");
+		buildHiZ();
+		gpuTimers.End();
+		gpuTimers.Begin("reflections");
+		drawReflections();
+		gpuTimers.End();
 	}
 
-	drawWaterQuad();
-	// show triangulation
-	if (showTriangulation) {
-		drawTriangulation();
+	if (sweepPath) {
+		sweepStep(frameMs);
+	}
+	else if (goldenCasesPath) {
+		goldenStep(frameMs);
 	}
-	drawAreaLight();
-	drawCubemap();
 
 	// Swap buffers
-	glutSwapBuffers();
+	{
+		TRACE_SCOPE("glutSwapBuffers");
+		glutSwapBuffers();
+	}
+	gpuTimers.EndFrame();
+	frameMsTotal += frameMs;
+	frameMsCount++;
+	if (gpuTimers.IsEnabled() && !sweepPath && time - gpuTimerReportTime >= 2.0f) {
+		// the fragments that pass the depth test in the pre-pass are the ones the
+		// forward pass shades, their ratio to the visible ones is the overdraw
+		double visible = gpuTimers.AverageFragments("water");
+		if (useDepthPrepass && visible > 0.0) {
+			cout << "water overdraw without the pre-pass: " << gpuTimers.AverageFragments("depthPrepass") / visible << endl;
+		}
+		cout << "frame ms: " << (frameMsCount > 0 ? frameMsTotal / frameMsCount : 0.0) << ", tess level " << tessLevel
+			<< ", radii " << innerRadius << " " << outerRadius << endl;
+		frameMsTotal = 0.0;
+		frameMsCount = 0;
+		gpuTimers.Report(cout);
+		gpuTimerReportTime = time;
+	}
+	if (!firstFrameShown) {
+		glFinish();
+		firstFrameShown = true;
+		auto now = chrono::steady_clock::now();
+		cout << "time to first frame: " << chrono::duration<double, milli>(now - startupTime).count() << " ms (first frame "
+			<< chrono::duration<double, milli>(now - assetsLoadedTime).count() << " ms)" << endl;
+	}
 	glutPostRedisplay();
 }
 
@@ -594,7 +2231,7 @@ void keyboardInput(unsigned char key, int x, int y) {
 		break;
 	case 't': case 'T': // t or T
 		// show triangulation
-		showTriangulation = !showTriangulation;
+		setShowTriangulation(!showTriangulation);
 		glutPostRedisplay();
 		break;
 	case 'w': case 'W':
@@ -619,37 +2256,71 @@ void keyboardInput(unsigned char key, int x, int y) {
 		break;
 	case 'q': case 'Q':
 		// textured area lights
-		isTexturedLight = !isTexturedLight;
-		if (isTexturedLight) {
-			prog.Bind();
-			handleAreaLightProgUniforms(prog);
-			waveUniformUpdate(prog);
-		}
-		else {
-			altProg.Bind();
-			handleAreaLightProgUniforms(altProg);
-			waveUniformUpdate(altProg);
-		}
-		quadMVP();
-		updateTessAndRadiusUniforms();
+		setTexturedLight(!isTexturedLight);
+		glutPostRedisplay();
+		break;
+	case 'l': case 'L':
+		// number of area lights, to measure the cost of each additional light
+		activeAreaLights = activeAreaLights % std::max(numAreaLights, 1) + 1;
+		waterVariantStale = true;
+		cout << "area lights: " << activeAreaLights << endl;
 		glutPostRedisplay();
 		break;
 	case 'e': case 'E':
 		// directional light
-		isDirectionalLight = !isDirectionalLight;
-		if (isDirectionalLight) {
-			prog["isDirectionalLight"] = 1;
-			altProg["isDirectionalLight"] = 1;
-			cubeProg["isDirectionalLight"] = 1;
-		}
-		else {
-			prog["isDirectionalLight"] = 0;
-			altProg["isDirectionalLight"] = 0;
-			cubeProg["isDirectionalLight"] = 0;
+		setDirectionalLight(!isDirectionalLight);
+		glutPostRedisplay();
+		break;
+	case 'r': case 'R':
+		// screen space reflections preset
+		ssrPreset = (ssrPreset + 1) % numSSRPresets;
+		if (ssrPreset != 0 && !ssrSetup()) {
+			ssrPreset = 0;
 		}
-		quadMVP();
+		waterVariantStale = true;
+		cout << "screen space reflections: " << ssrPresets[ssrPreset].name << endl;
+		glutPostRedisplay();
+		break;
+	case 'p': case 'P':
+		// depth pre-pass of the water
+		useDepthPrepass = !useDepthPrepass;
+		cout << "depth pre-pass: " << (useDepthPrepass ? "on" : "off") << endl;
 		glutPostRedisplay();
 		break;
+	case 'g': case 'G':
+		// gpu time of the passes
+		gpuTimers.SetEnabled(!gpuTimers.IsEnabled());
+		gpuTimerReportTime = timePassed;
+		frameMsTotal = 0.0;
+		frameMsCount = 0;
+		cout << "gpu timers: " << (gpuTimers.IsEnabled() ? "on" : "off") << endl;
+		break;
+	case 'c': case 'C':
+		// capture of the water around the camera for the CPU
+		useWaveCapture = !useWaveCapture;
+		waveCaptureReportTime = timePassed;
+		cout << "wave capture: " << (useWaveCapture ? "on" : "off") << endl;
+		break;
+	case 'o': case 'O':
+		// simulation of the next frame during the submission of this one
+		overlapSimulation = !overlapSimulation;
+		cout << "simulation overlap: " << (overlapSimulation ? "on" : "off") << endl;
+		break;
+	case 'j': case 'J':
+		// the trace since the last one
+		writeTrace();
+		break;
+	case 'h': case 'H':
+		// hot reload of the shaders
+		reloadShaders = !reloadShaders;
+		cout << "shader hot reload: " << (reloadShaders ? "on" : "off") << endl;
+		break;
+	case 'k': case 'K':
+		// camera path recording
+		if (!benchResultsPath) {
+			toggleCameraRecording();
+		}
+		break;
 	}
 }
 
@@ -787,9 +2458,11 @@ void mouseMotion(int x, int y) {
 
 		// adjusting front vector
 		cameraVectors();
+		cameraRevision++;
 	}
 	else if (isRightButton) {
 		camPosition += frontVector * dy * 0.1f;
+		cameraRevision++;
 	}
 
 	// modify MVP on every mouse motion
@@ -831,41 +2504,307 @@ void decodeOneStep(const char* filename, vector<unsigned char>& imageArray, unsi
 }
 
 /// <summary>
-/// This method initializes cube mapping.
+/// This method uploads all the levels of a texture into the bound texture of target.
+/// When desc.format is 0 the images are compressed data in desc.internalFormat,
+/// otherwise they are pixels the driver converts (and compresses) on upload.
+/// </summary>
+/// <param name="target"> GL_TEXTURE_CUBE_MAP or GL_TEXTURE_2D_ARRAY </param>
+/// <param name="desc"> the texture format </param>
+/// <param name="images"> per level, then per face: the image data (all layers for arrays) </param>
+/// <param name="imageSizes"> per level, the bytes of one image </param>
+void uploadTextureImages(GLenum target, const TextureCacheDesc& desc, const std::vector<const unsigned char*>& images, const std::vector<size_t>& imageSizes) {
+	for (uint32_t level = 0; level < desc.levels; level++) {
+		GLsizei width = std::max(1u, desc.width >> level);
+		GLsizei height = std::max(1u, desc.height >> level);
+		for (uint32_t face = 0; face < desc.faces; face++) {
+			const unsigned char* data = images[level * desc.faces + face];
+			GLsizei size = GLsizei(imageSizes[level]);
+			if (target == GL_TEXTURE_2D_ARRAY) {
+				if (desc.format == 0) {
+					glCompressedTexImage3D(target, level, desc.internalFormat, width, height, desc.layers, 0, size, data);
+				}
+				else {
+					glTexImage3D(target, level, desc.internalFormat, width, height, desc.layers, 0, desc.format, desc.type, data);
+				}
+			}
+			else {
+				GLenum imageTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+				if (desc.format == 0) {
+					glCompressedTexImage2D(imageTarget, level, desc.internalFormat, width, height, 0, size, data);
+				}
+				else {
+					glTexImage2D(imageTarget, level, desc.internalFormat, width, height, 0, desc.format, desc.type, data);
+				}
+			}
+		}
+	}
+	glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, GLint(desc.levels - 1));
+}
+
+/// <summary>
+/// This method reads back all the levels of the bound texture of target, in the
+/// format the driver stores them, for the texture cache.
+/// </summary>
+/// <param name="target"> GL_TEXTURE_CUBE_MAP or GL_TEXTURE_2D_ARRAY </param>
+/// <param name="desc"> the texture format it was uploaded with, receives the stored format </param>
+/// <param name="images"> per level, the data of every face one after the other </param>
+/// <returns> the bytes the texture takes on the GPU </returns>
+size_t readTextureImages(GLenum target, TextureCacheDesc& desc, std::vector<std::vector<unsigned char>>& images) {
+	GLenum firstTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+	GLint compressed = GL_FALSE;
+	glGetTexLevelParameteriv(firstTarget, 0, GL_TEXTURE_COMPRESSED, &compressed);
+	if (compressed) {
+		desc.format = 0;
+		desc.type = 0;
+	}
+
+	size_t total = 0;
+	images.assign(desc.levels, std::vector<unsigned char>());
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (uint32_t level = 0; level < desc.levels; level++) {
+		size_t imageSize = size_t(std::max(1u, desc.width >> level)) * std::max(1u, desc.height >> level) * std::max(1u, desc.layers) * 4;
+		if (compressed) {
+			GLint compressedSize = 0;
+			glGetTexLevelParameteriv(firstTarget, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressedSize);
+			imageSize = size_t(compressedSize);
+		}
+		images[level].resize(imageSize * desc.faces);
+		for (uint32_t face = 0; face < desc.faces; face++) {
+			GLenum imageTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+			unsigned char* data = images[level].data() + face * imageSize;
+			if (compressed) {
+				glGetCompressedTexImage(imageTarget, level, data);
+			}
+			else {
+				glGetTexImage(imageTarget, level, GL_RGBA, GL_UNSIGNED_BYTE, data);
+			}
+		}
+		total += images[level].size();
+	}
+	return total;
+}
+
+/// <summary>
+/// Returns the bytes a cached texture takes on the GPU, as it is uploaded without conversion.
 /// </summary>
-void cubeMapping() {
+size_t cachedTextureSize(const CachedTexture& texture) {
+	size_t total = 0;
+	for (size_t size : texture.imageSizes) {
+		total += size * texture.desc.faces;
+	}
+	return total;
+}
 
-	envMap.Initialize();
+/// <summary>
+/// This method reports how long a texture took to load and how much memory it takes on the GPU.
+/// </summary>
+void reportTextureLoad(const char* name, bool cacheHit, chrono::steady_clock::time_point start, size_t gpuBytes, size_t rgba8Bytes) {
+	cout << name << ": " << (cacheHit ? "cache hit" : "cache miss") << ", "
+		<< chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms, "
+		<< gpuBytes / 1024 << " KB in video memory (" << rgba8Bytes / 1024 << " KB as RGBA8)" << endl;
+	TRACE_COUNTER("texture upload bytes", gpuBytes);
+}
 
-	for (int i = 0; i < 6; i++) {
-		// load image from file
-		unsigned sideWidth;
-		unsigned sideHeight;
-		std::vector<unsigned char> sideImage;
+/// <summary>
+/// Returns the cache key of the skybox: the side images and the format.
+/// </summary>
+std::string skyboxCacheKey() {
+	std::string key = std::string("skybox;") + textureCacheVersion + ";";
+	for (const string& side : sideCubes) {
+		addCacheKeySource(key, side);
+	}
+	key += "ggx " + std::to_string(envRoughnessLevels) + " " + std::to_string(envPrefilterSamples) + ";";
+	key += compressSkybox && GLEW_EXT_texture_compression_s3tc ? "dxt1" : "rgba8";
+	return key;
+}
+
+/// <summary>
+/// Returns the cache key of the area light texture: the light image, the
+/// obj file the light rectangles come from and the filtering options.
+/// </summary>
+std::string areaLightCacheKey(const std::string& objFile, const std::string& imageFile) {
+	std::string key = std::string("arealight;") + textureCacheVersion + ";";
+	addCacheKeySource(key, objFile);
+	addCacheKeySource(key, imageFile);
+	key += "size " + std::to_string(areaLightTexMaxSize) + ";border " + std::to_string(AREA_LIGHT_BORDER) + ";";
+	key += compressAreaLightTex ? (GLEW_EXT_texture_compression_s3tc ? "dxt1" : "compressed") : "rgba8";
+	return key;
+}
+
+/// <summary>
+/// A decoded RGBA8 image.
+/// </summary>
+struct DecodedImage {
+	std::vector<unsigned char> data;
+	unsigned width = 0;
+	unsigned height = 0;
+};
 
-		string image_path = sideCubes[i]; // where sideCubes is defined above
+/// <summary>
+/// Decodes an image, safe to call from the loader threads.
+/// </summary>
+/// <param name="filename"> the file to decode </param>
+/// <returns> the image, empty on failure </returns>
+DecodedImage decodeImage(const std::string& filename) {
+	TRACE_SCOPE("decodeImage");
+	DecodedImage image;
+	decodeOneStep(filename.c_str(), image.data, image.width, image.height);
+	return image;
+}
 
-		// set file name below
-		decodeOneStep(image_path.c_str(), sideImage, sideWidth, sideHeight);
+/// <summary>
+/// This method decodes the sides of the skybox and prefilters them, on a loader thread.
+/// </summary>
+/// <returns> the prefiltered levels, empty on failure </returns>
+std::vector<CubeLevel> prefilterSkybox() {
+	TRACE_SCOPE("prefilterSkybox");
+	CubeLevel faces;
+	for (int i = 0; i < 6; i++) {
+		DecodedImage sideImage = decodeImage(sideCubes[i]);
 
 		// Check if the image was successfully loaded
-		if (sideImage.empty()) {
-			cerr << "Error: Failed to load cube map texture: " << image_path << endl;
-			return;
+		if (sideImage.data.empty()) {
+			cerr << "Error: Failed to load cube map texture: " << sideCubes[i] << endl;
+			return std::vector<CubeLevel>();
+		}
+		if (sideImage.width != sideImage.height || (i > 0 && int(sideImage.width) != faces[0].width)) {
+			cerr << "Error: Cube map sides must be squares of the same size: " << sideCubes[i] << endl;
+			return std::vector<CubeLevel>();
 		}
+		faces[i] = cropLight(sideImage.data.data(), int(sideImage.width), 0, 0, int(sideImage.width), int(sideImage.height));
+	}
+
+	auto start = chrono::steady_clock::now();
+	std::vector<CubeLevel> levels = prefilterEnvironment(faces, envRoughnessLevels, envPrefilterSamples);
+	cout << "skybox GGX prefilter: " << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms ("
+		<< levels.size() << " levels, " << envPrefilterSamples << " samples)" << endl;
+	return levels;
+}
+
+/// <summary>
+/// This method initializes cube mapping.
+/// On a cache hit the stored levels are uploaded as they are. Otherwise the
+/// levels prefiltered by the loader task are uploaded in the skybox format
+/// and the result is stored in the cache for the next run.
+/// </summary>
+/// <param name="prefiltered"> the skybox being prefiltered, unused on a cache hit </param>
+/// <param name="cached"> the cached skybox, nullptr on a cache miss </param>
+/// <param name="cacheKey"> the cache key of the skybox </param>
+/// <returns> true on success </returns>
+bool cubeMapping(std::future<std::vector<CubeLevel>>& prefiltered, const CachedTexture* cached, const std::string& cacheKey) {
+	TRACE_SCOPE("cubeMapping");
+	auto start = chrono::steady_clock::now();
+
+	envMap.Initialize();
+	glBindTexture(GL_TEXTURE_CUBE_MAP, envMap.GetID());
 
-		// set image data
-		envMap.SetImageRGBA((cy::GLTextureCubeMap::Side)i, sideImage.data(), sideWidth, sideHeight);
+	TextureCacheDesc desc;
+	if (cached) {
+		desc = cached->desc;
+		uploadTextureImages(GL_TEXTURE_CUBE_MAP, desc, cached->images, cached->imageSizes);
 	}
+	else {
+		std::vector<CubeLevel> cubeLevels = prefiltered.get();
+		if (cubeLevels.empty()) {
+			return false;
+		}
+		desc.width = cubeLevels[0][0].width;
+		desc.height = cubeLevels[0][0].height;
+
+		// level by level with the 6 sides next to each other
+		std::vector<std::vector<unsigned char>> levels;
+		for (const CubeLevel& cubeLevel : cubeLevels) {
+			size_t sideSize = cubeLevel[0].rgba.size();
+			levels.emplace_back(sideSize * 6);
+			for (int i = 0; i < 6; i++) {
+				levelToRGBA8(cubeLevel[i], &levels.back()[i * sideSize]);
+			}
+		}
 
-	envMap.BuildMipmaps();
+		desc.internalFormat = compressSkybox && GLEW_EXT_texture_compression_s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGBA8;
+		desc.format = GL_RGBA;
+		desc.type = GL_UNSIGNED_BYTE;
+		desc.faces = 6;
+		desc.levels = uint32_t(levels.size());
+		std::vector<const unsigned char*> images;
+		std::vector<size_t> imageSizes;
+		for (const std::vector<unsigned char>& level : levels) {
+			imageSizes.push_back(level.size() / 6);
+			for (int i = 0; i < 6; i++) {
+				images.push_back(level.data() + i * imageSizes.back());
+			}
+		}
+		uploadTextureImages(GL_TEXTURE_CUBE_MAP, desc, images, imageSizes);
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	envMap.SetSeamless();
+	envMapLevels = int(desc.levels);
+
+	size_t gpuBytes = cached ? cachedTextureSize(*cached) : 0;
+	if (!cached) {
+		std::vector<std::vector<unsigned char>> stored;
+		gpuBytes = readTextureImages(GL_TEXTURE_CUBE_MAP, desc, stored);
+		if (useTextureCache) {
+			saveCachedTexture(textureCacheDir, cacheKey, desc, stored);
+		}
+	}
+	size_t rgba8Bytes = 0;
+	for (uint32_t level = 0; level < desc.levels; level++) {
+		rgba8Bytes += size_t(std::max(1u, desc.width >> level)) * std::max(1u, desc.height >> level) * 4 * 6;
+	}
+	reportTextureLoad("skybox", cached != nullptr, start, gpuBytes, rgba8Bytes);
+	return true;
+}
+
+/// <summary>
+/// This method projects the skybox on spherical harmonics for the ambient term.
+/// The top level is read back, so it works the same for a cached skybox.
+/// </summary>
+void computeSkySH() {
+	TRACE_SCOPE("computeSkySH");
+	auto start = chrono::steady_clock::now();
+	GLint size;
+	glBindTexture(GL_TEXTURE_CUBE_MAP, envMap.GetID());
+	glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &size);
+	std::vector<unsigned char> faces(size_t(size) * size * 4 * 6);
+	const unsigned char* facePointers[6];
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (int i = 0; i < 6; i++) {
+		facePointers[i] = &faces[size_t(size) * size * 4 * i];
+		glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, GL_UNSIGNED_BYTE, &faces[size_t(size) * size * 4 * i]);
+	}
+
+	float toLinear[256];
+	for (int i = 0; i < 256; i++) {
+		toLinear[i] = std::pow(i / 255.0f, 2.2f);
+	}
+	projectCubeSH9(facePointers, size, toLinear, skySH);
+	irradianceSH9(skySH);
+	cout << "skybox irradiance: " << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+}
+
+/// <summary>
+/// This method computes and uploads the split-sum BRDF table.
+/// </summary>
+void loadEnvBrdfLut() {
+	TRACE_SCOPE("loadEnvBrdfLut");
+	std::vector<float> table = buildEnvBrdfTable(envBrdfLutSize, 128);
+	glGenTextures(1, &envBrdfLut);
+	glBindTexture(GL_TEXTURE_2D, envBrdfLut);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, envBrdfLutSize, envBrdfLutSize, 0, GL_RG, GL_FLOAT, table.data());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 
 /// <summary>
 /// This method prepares the vertices of the skybox.
 /// </summary>
 void cubeSetup() {
+	TRACE_SCOPE("cubeSetup");
 	cy::TriMesh cubeMesh;
 	bool cubeSuccess = cubeMesh.LoadFromFileObj("cube.obj", true);
 
@@ -906,6 +2845,7 @@ void cubeSetup() {
 /// Create arrays containing all the necessity datas.
 /// </summary>
 void loadObjFileSetup(cyTriMesh &mesh, cyVec3f* &vertices, cyVec2f* &textures, int &numVert) {
+    TRACE_SCOPE("loadObjFileSetup");
     int numFaces = mesh.NF();    // get the number of faces
     numVert = numFaces * 3;
 
@@ -1010,113 +2950,299 @@ void areaLightVAOVBOfromOBJ() {
 	glEnableVertexAttribArray(0);
 
 	glBindBuffer(GL_ARRAY_BUFFER, areaLightTexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, areaLightNumVert * sizeof(cy::Vec2f), areaLightTextures, GL_STATIC_DRAW);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
+	glBufferData(GL_ARRAY_BUFFER, areaLightNumVert * sizeof(cy::Vec3f), areaLightLayerCoords, GL_STATIC_DRAW);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (void*)0);
 	glEnableVertexAttribArray(1);
 }
 
 /// <summary>
-/// This method sets up the area light vertices for sending it to tessShader.
+/// This method sets up the area light block for the shaders and the per vertex
+/// coordinates into the light texture array.
+/// Every light gets its own layer, cropped from the bounding rectangle of its
+/// texture coordinates, so each panel is prefiltered and integrated separately.
 /// </summary>
-void areaLightUniqueVerts() {
-	areaLightUniqueVert = new cy::Vec3f[24]; // 6 area lights, 4 vertices each
-	areaLightTexCorners = new cy::Vec2f[4]; // 4 corners of the area light texture
-	areaLight4Corners = new cy::Vec3f[4]; // 4 corners of the area light texture
-	
-	int vertOffSet = 0;
-	for (int i = 0; i < 24; i += 4) {
-		areaLightUniqueVert[i] = areaLightVertices[vertOffSet];			// bottom left
-		areaLightUniqueVert[i + 1] = areaLightVertices[vertOffSet + 1];	// bottom right
-		areaLightUniqueVert[i + 2] = areaLightVertices[vertOffSet + 2]; // top right
-		areaLightUniqueVert[i + 3] = areaLightVertices[vertOffSet + 5]; // top left
-
-		// for the texture coordinates, want to find the offset (using min) and scale.
-		cyVec2f uv0 = areaLightTextures[vertOffSet];
-		cyVec2f uv2 = areaLightTextures[vertOffSet + 2];
-
-		if (vertOffSet == 0) {
-			areaLightTexCorners[0] = uv0; // bottom left corner
-			areaLightTexCorners[1] = areaLightTextures[vertOffSet+1]; // bottom right corner
-			areaLightTexCorners[2] = uv2; // top right corner
-			areaLightTexCorners[3] = areaLightTextures[vertOffSet+5]; // top left corner
-
-			areaLight4Corners[0] = areaLightUniqueVert[i]; // bottom left corner
-			areaLight4Corners[1] = areaLightUniqueVert[i + 1]; // bottom right corner
-			areaLight4Corners[2] = areaLightUniqueVert[i + 2]; // top right corner
-			areaLight4Corners[3] = areaLightUniqueVert[i + 3]; // top left corner
+void areaLightBlockSetup() {
+	numAreaLights = areaLightNumVert / 6; // each area light was made from 6 vertices
+	if (numAreaLights > maxAreaLights) {
+		cerr << "Error: Only the first " << maxAreaLights << " area lights are used." << endl;
+		numAreaLights = maxAreaLights;
+	}
+	activeAreaLights = numAreaLights;
+	areaLightLayerCoords = new cy::Vec3f[areaLightNumVert];
+	memset(&areaLightBlock, 0, sizeof(areaLightBlock));
+
+	const int corners[4] = { 0, 1, 2, 5 }; // bottom left, bottom right, top right, top left
+	for (int light = 0; light < numAreaLights; light++) {
+		int vertOffSet = light * 6;
+		for (int i = 0; i < 4; i++) {
+			cyVec3f vert = areaLightVertices[vertOffSet + corners[i]];
+			float* dst = areaLightBlock.verts[light * 4 + i];
+			dst[0] = vert.x;
+			dst[1] = vert.y;
+			dst[2] = vert.z;
 		}
 
-		else {
-			cyVec2f newBotLeft = areaLightTextures[vertOffSet];
-			cyVec2f currBotLeft = areaLightTexCorners[0];
-			if (newBotLeft.x <= currBotLeft.x && newBotLeft.y <= currBotLeft.y) {
-				areaLightTexCorners[0] = newBotLeft;
-				areaLight4Corners[0] = areaLightUniqueVert[i]; // bottom left corner
-			}
+		// the texture rectangle of the light
+		cyVec2f uvMin = areaLightTextures[vertOffSet];
+		cyVec2f uvMax = areaLightTextures[vertOffSet];
+		for (int i = 1; i < 6; i++) {
+			cyVec2f uv = areaLightTextures[vertOffSet + i];
+			uvMin = cyVec2f(std::min(uvMin.x, uv.x), std::min(uvMin.y, uv.y));
+			uvMax = cyVec2f(std::max(uvMax.x, uv.x), std::max(uvMax.y, uv.y));
+		}
+		areaLightUVRect[light][0] = uvMin.x;
+		areaLightUVRect[light][1] = uvMin.y;
+		areaLightUVRect[light][2] = uvMax.x;
+		areaLightUVRect[light][3] = uvMax.y;
+
+		// texture coordinates relative to the rectangle, which is the layer
+		cyVec2f uvSize(std::max(uvMax.x - uvMin.x, 1e-6f), std::max(uvMax.y - uvMin.y, 1e-6f));
+		for (int i = 0; i < 6; i++) {
+			cyVec2f uv = areaLightTextures[vertOffSet + i];
+			areaLightLayerCoords[vertOffSet + i] = cyVec3f((uv.x - uvMin.x) / uvSize.x, (uv.y - uvMin.y) / uvSize.y, float(light));
+		}
 
-			cyVec2f newBotRight = areaLightTextures[vertOffSet + 1];
-			cyVec2f currBotRight = areaLightTexCorners[1];
-			if (newBotRight.x >= currBotRight.x && newBotRight.y <= currBotRight.y) {
-				areaLightTexCorners[1] = newBotRight;
-				areaLight4Corners[1] = areaLightUniqueVert[i+1];
-			}
+		// the map from the light's (u, v) to the layer: corner 0 + u * (corner 1 - corner 0) + v * (corner 3 - corner 0)
+		cyVec3f origin = areaLightLayerCoords[vertOffSet];
+		cyVec3f uAxis = areaLightLayerCoords[vertOffSet + 1] - origin;
+		cyVec3f vAxis = areaLightLayerCoords[vertOffSet + 5] - origin;
+		float* uvU = areaLightBlock.uvTransform[light * 2];
+		float* uvV = areaLightBlock.uvTransform[light * 2 + 1];
+		uvU[0] = origin.x;
+		uvU[1] = origin.y;
+		uvU[2] = uAxis.x;
+		uvU[3] = uAxis.y;
+		uvV[0] = vAxis.x;
+		uvV[1] = vAxis.y;
+		uvV[2] = float(light);
+	}
 
-			cyVec2f newTopRight = areaLightTextures[vertOffSet + 2];
-			cyVec2f currTopRight = areaLightTexCorners[2];
-			if (newTopRight.x >= currTopRight.x && newTopRight.y >= currTopRight.y) {
-				areaLightTexCorners[2] = newTopRight;
-				areaLight4Corners[2] = areaLightUniqueVert[i+2];
-			}
+	glGenBuffers(1, &areaLightUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, areaLightUBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(areaLightBlock), &areaLightBlock, GL_STATIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, areaLightBlockBinding, areaLightUBO);
+}
+
+/// <summary>
+/// Set up the texture for the Minv using precomputed values.
+/// Both tables are packed into one half float array texture so the shaders
+/// only need a single sampler.
+/// 
+/// layer 0, ltc1: inverted transformation matrices.
+/// layer 1, ltc2: fresnel90, smith coefficient for geometric attenuation, 0, horizon clipping factor.
+/// </summary>
+/// <param name="table"> the loaded LTC tables </param>
+/// <returns> the array texture </returns>
+GLuint loadMinvTexture(const LTCTable& table) {
+	TRACE_SCOPE("loadMinvTexture");
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16F, table.size, table.size, 2, 0, GL_RGBA, GL_FLOAT, nullptr);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, table.size, table.size, 1, GL_RGBA, GL_FLOAT, table.ltc1.data());
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 1, table.size, table.size, 1, GL_RGBA, GL_FLOAT, table.ltc2.data());
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	return texture;
+}
+
+/// <summary>
+/// This method prefilters the area lights of one frame of the light texture.
+/// Each light is cropped from its texture rectangle (areaLightUVRect) into its
+/// own array layer, so the blur of one light never bleeds into its neighbours.
+/// Every mip level is a Gaussian blur of the padded light (lightPrefilter.h)
+/// instead of the box filtered chain glGenerateMipmap would build, so the shader
+/// can pick the level from the distance to the light.
+/// The layer size is fixed by the first frame. After that only the lights
+/// whose pixels changed are filtered again, which keeps video frames of mostly
+/// static panels cheap.
+/// </summary>
+/// <param name="image"> RGBA8 pixels of the lights </param>
+/// <param name="width"> image width </param>
+/// <param name="height"> image height </param>
+/// <param name="layers"> the chains of the previous frame, updated in place </param>
+/// <returns> the number of lights filtered again </returns>
+int prefilterAreaLights(const unsigned char* image, int width, int height, AreaLightLayers& layers) {
+	TRACE_SCOPE("prefilterAreaLights");
+	// texel rectangles of the lights, all layers share the size of the largest one
+	std::vector<int> rects(numAreaLights * 4);
+	int innerWidth = 1, innerHeight = 1;
+	for (int light = 0; light < numAreaLights; light++) {
+		int* rect = &rects[light * 4];
+		rect[0] = std::min(std::max(int(std::floor(areaLightUVRect[light][0] * width)), 0), width - 1);
+		rect[1] = std::min(std::max(int(std::floor(areaLightUVRect[light][1] * height)), 0), height - 1);
+		rect[2] = std::min(std::max(int(std::ceil(areaLightUVRect[light][2] * width)), rect[0] + 1), width);
+		rect[3] = std::min(std::max(int(std::ceil(areaLightUVRect[light][3] * height)), rect[1] + 1), height);
+		innerWidth = std::max(innerWidth, rect[2] - rect[0]);
+		innerHeight = std::max(innerHeight, rect[3] - rect[1]);
+	}
+	if (layers.chains.empty()) {
+		layers.innerWidth = std::min(innerWidth, areaLightTexMaxSize);
+		layers.innerHeight = std::min(innerHeight, areaLightTexMaxSize);
+		layers.chains.resize(numAreaLights);
+		layers.hashes.resize(numAreaLights);
+	}
 
-			cyVec2f newTopLeft = areaLightTextures[vertOffSet + 5];
-			cyVec2f currTopLeft = areaLightTexCorners[3];
-			if (newTopLeft.x <= currTopLeft.x && newTopLeft.y >= currTopLeft.y) {
-				areaLightTexCorners[3] = newTopLeft;
-				areaLight4Corners[3] = areaLightUniqueVert[i+3];
+	int rebuilt = 0;
+	for (int light = 0; light < numAreaLights; light++) {
+		const int* rect = &rects[light * 4];
+
+		// FNV-1a of the light's pixels
+		uint64_t hash = 14695981039346656037ull;
+		for (int y = rect[1]; y < rect[3]; y++) {
+			const unsigned char* row = image + (size_t(y) * width + rect[0]) * 4;
+			for (int i = 0; i < (rect[2] - rect[0]) * 4; i++) {
+				hash = (hash ^ row[i]) * 1099511628211ull;
 			}
 		}
+		if (!layers.chains[light].empty() && hash == layers.hashes[light]) {
+			continue;
+		}
 
-		vertOffSet += 6; // each area light was made from 6 vertices
+		FilteredLevel source = cropLight(image, width, rect[0], rect[1], rect[2], rect[3]);
+		layers.chains[light] = buildPrefilteredChain(padLight(source, layers.innerWidth, layers.innerHeight));
+		layers.hashes[light] = hash;
+		rebuilt++;
 	}
+	return rebuilt;
 }
 
 /// <summary>
-/// Set up the texture for the Minv using precomputed values.
-/// 
-/// ltc1: inverted transformation matrices.
-/// ltc2: fresnel90, horizon clipping factor, smith coefficient for geometric attenuation.
-/// </summary>
-cy::GLTexture2D loadMinvTexture(const float* matrixTable) {
-	cy::GLTexture2D texture;
-	texture.Initialize();
-	texture.SetImage(matrixTable, 4, 64, 64); // 4 channels, 64x64 size
-	texture.SetWrappingMode(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
-	texture.SetFilteringMode(GL_LINEAR, GL_NEAREST);
+/// This method packs the prefiltered lights as RGBA8, level by level with all
+/// the layers of a level next to each other, ready for glTex(Sub)Image3D.
+/// </summary>
+/// <param name="layers"> the prefiltered lights </param>
+/// <param name="packed"> the destination </param>
+/// <param name="levelOffsets"> optional, receives the byte offset of every level </param>
+void packAreaLightLevels(const AreaLightLayers& layers, std::vector<unsigned char>& packed, std::vector<size_t>* levelOffsets = nullptr) {
+	const std::vector<FilteredLevel>& levels = layers.chains[0];
+	size_t total = 0;
+	for (const FilteredLevel& level : levels) {
+		total += level.rgba.size() * numAreaLights;
+	}
+	packed.resize(total);
+	if (levelOffsets) {
+		levelOffsets->clear();
+	}
+
+	size_t offset = 0;
+	for (size_t level = 0; level < levels.size(); level++) {
+		if (levelOffsets) {
+			levelOffsets->push_back(offset);
+		}
+		size_t layerSize = levels[level].rgba.size();
+		for (int light = 0; light < numAreaLights; light++) {
+			levelToRGBA8(layers.chains[light][level], &packed[offset + light * layerSize]);
+		}
+		offset += layerSize * numAreaLights;
+	}
+}
+
+/// <summary>
+/// This method creates the area light array texture from its levels.
+/// </summary>
+/// <param name="desc"> the texture format </param>
+/// <param name="images"> the data of every level, all layers </param>
+/// <param name="imageSizes"> the bytes of every level </param>
+/// <returns> the array texture </returns>
+GLuint createAreaLightTexture(const TextureCacheDesc& desc, const std::vector<const unsigned char*>& images, const std::vector<size_t>& imageSizes) {
+	TRACE_SCOPE("createAreaLightTexture");
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	uploadTextureImages(GL_TEXTURE_2D_ARRAY, desc, images, imageSizes);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	return texture;
 }
 
+/// <summary>
+/// This method uploads the prefiltered area lights into an array texture, one layer per light.
+/// </summary>
+/// <param name="layers"> the prefiltered lights </param>
+/// <param name="compress"> let the driver compress the texture </param>
+/// <returns> the array texture </returns>
+GLuint loadAreaLightTexture(const AreaLightLayers& layers, bool compress) {
+	TRACE_SCOPE("loadAreaLightTexture");
+	const std::vector<FilteredLevel>& levels = layers.chains[0];
+	std::vector<unsigned char> pixels;
+	std::vector<size_t> levelOffsets;
+	packAreaLightLevels(layers, pixels, &levelOffsets);
+
+	TextureCacheDesc desc;
+	desc.internalFormat = GL_RGBA8;
+	if (compress) {
+		desc.internalFormat = GLEW_EXT_texture_compression_s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA;
+	}
+	desc.format = GL_RGBA;
+	desc.type = GL_UNSIGNED_BYTE;
+	desc.width = levels[0].width;
+	desc.height = levels[0].height;
+	desc.layers = numAreaLights;
+	desc.levels = uint32_t(levels.size());
+
+	// all the layers of a level in one upload, so the driver can compress them
+	std::vector<const unsigned char*> images;
+	std::vector<size_t> imageSizes;
+	for (size_t level = 0; level < levels.size(); level++) {
+		images.push_back(&pixels[levelOffsets[level]]);
+		imageSizes.push_back(levels[level].rgba.size() * numAreaLights);
+	}
+	return createAreaLightTexture(desc, images, imageSizes);
+}
+
+/// <summary>
+/// This method starts streaming an image sequence into the area light texture.
+/// The decode thread prefilters and packs every frame into exactly the layout of
+/// AL_Tex, so the render thread only copies it into a pixel buffer object.
+/// </summary>
+/// <param name="pattern"> printf pattern of the frame file names </param>
+/// <returns> true on success </returns>
+bool lightVideoSetup(const char* pattern) {
+	std::vector<unsigned char> firstFrame;
+	packAreaLightLevels(areaLightLayers, firstFrame, &lightVideoLevelOffsets);
+	lightVideoFrameSize = firstFrame.size();
+	for (const FilteredLevel& level : areaLightLayers.chains[0]) {
+		lightVideoLevelWidths.push_back(level.width);
+		lightVideoLevelHeights.push_back(level.height);
+	}
+
+	glGenBuffers(lightVideoPBOCount, lightVideoPBO);
+	for (int i = 0; i < lightVideoPBOCount; i++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, lightVideoPBO[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, lightVideoFrameSize, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	// areaLightLayers belongs to the decode thread from here on
+	return lightVideo.Start(pattern, [](const vector<unsigned char>& image, unsigned width, unsigned height, vector<unsigned char>& frame) {
+		prefilterAreaLights(image.data(), int(width), int(height), areaLightLayers);
+		packAreaLightLevels(areaLightLayers, frame);
+		return true;
+	});
+}
+
 /// <summary>
 /// This method sets up the wave parameters.
 /// </summary>
 void waveSetup() {
+	TRACE_SCOPE("waveSetup");
 	// wave parameters
 	createScaledArray(numOfWaves, 0.5f, waveAmplitude);
 	createScaledArray(numOfWaves, 1.3f, waveFrequency);
 	createRandomDirections(numOfWaves, waveDirection);
 	createRandomSpeeds(numOfWaves, waveSpeed);
+	createSlopeVarianceTail(numOfWaves, waveAmplitude, waveFrequency, waveSlopeTail);
+	waveField.Set(numOfWaves, waveAmplitude, waveFrequency, waveSpeed, waveDirection);
 
-	if (isTexturedLight) {
-		waveUniformUpdate(prog);
-	}
-	else {
-		waveUniformUpdate(altProg);
-	}
-
-	triangleLineProg["numOfWaves"] = numOfWaves;
-	triangleLineProg.SetUniform("waveDirection", waveDirection, numOfWaves);
-	triangleLineProg.SetUniform1("waveAmplitude", waveAmplitude, numOfWaves);
-	triangleLineProg.SetUniform1("waveFrequency", waveFrequency, numOfWaves);
-	triangleLineProg.SetUniform1("waveSpeed", waveSpeed, numOfWaves);
+	waveUniformUpdate(*waterProg);
+	waveUniformUpdate(depthPrepassProg);
+	waveUniformUpdate(waveCaptureProg);
 }
 
 /// <summary>
@@ -1127,13 +3253,72 @@ void waveSetup() {
 /// <param name="argv"> an array of command line arguments </param>
 /// <returns> returns 0 on success </returns>
 int main(int argc, char* argv[]) {
+	startupTime = chrono::steady_clock::now();
+	Tracer::SetThreadName("main");
+	if (argc < 4) {
+		cerr << "Error: Missing arguments" << endl;
+		cerr << "usage: waterViewer <water obj> <area light obj> <area light png or sequence> [--sweep <csv>]"
+			<< " [--path <camera path> [--bench <results>]] [--record <camera path>]"
+			<< " [--golden <cases> [--golden-update]] [--no-shader-cache] [--uber-shader]" << endl;
+		return 1;
+	}
+	for (int arg = 4; arg < argc; arg++) {
+		string option = argv[arg];
+		if (option == "--sweep" && arg + 1 < argc) {
+			sweepPath = argv[++arg];
+		}
+		else if (option == "--path" && arg + 1 < argc) {
+			cameraPathFile = argv[++arg];
+		}
+		else if (option == "--record" && arg + 1 < argc) {
+			cameraRecordFile = argv[++arg];
+		}
+		else if (option == "--bench" && arg + 1 < argc) {
+			benchResultsPath = argv[++arg];
+		}
+		else if (option == "--golden" && arg + 1 < argc) {
+			goldenCasesPath = argv[++arg];
+		}
+		else if (option == "--golden-update") {
+			updateGoldens = true;
+		}
+		else if (option == "--no-shader-cache") {
+			useShaderCache = false;
+		}
+		else if (option == "--uber-shader") {
+			useUberShader = true;
+		}
+		else {
+			cerr << "Error: Unknown option " << argv[arg] << endl;
+			return 1;
+		}
+	}
+	if (benchResultsPath && (!cameraPathFile || sweepPath)) {
+		cerr << "Error: --bench needs a --path and cannot run with --sweep" << endl;
+		return 1;
+	}
+	if (goldenCasesPath && (sweepPath || benchResultsPath || cameraPathFile)) {
+		cerr << "Error: --golden runs on its own, without --sweep, --bench or --path" << endl;
+		return 1;
+	}
+	if (updateGoldens && !goldenCasesPath) {
+		cerr << "Error: --golden-update needs --golden" << endl;
+		return 1;
+	}
+	if (cameraPathFile && !cameraPath.Load(cameraPathFile)) {
+		return 1;
+	}
+	if (TraceEnabled) {
+		atexit(writeTrace);
+	}
 
 	//// initializes GLUT and OpenGL
 	glutInit(&argc, argv);
 	glutInitContextFlags(GLUT_DEBUG);
 	glutInitWindowSize(windowWidth, windowHeight);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
-	glutCreateWindow("CS5610 - Final Project");
+	glutCreateWindow(windowTitle);
+	glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS); // so main can return an exit code
 	glViewport(0, 0, windowWidth, windowHeight);
 
 	//OpenGL initialization
@@ -1148,59 +3333,186 @@ int main(int argc, char* argv[]) {
 	glDepthFunc(GL_LEQUAL);				// Set depth function to "less than or equal"
 	////
 
-	//// obj file loading
+	//// asset loading
+	// The worker threads decode the images and parse the obj files while the
+	// shaders compile, in the driver's threads when it supports
+	// GL_KHR_parallel_shader_compile. The main thread owns the GL context and
+	// uploads every asset as soon as it is ready.
 	const char* objFilePath = argv[1];
-	bool success = mesh.LoadFromFileObj(objFilePath, true);
-	loadObjFileSetup(mesh, vertices, textures, totalNumVert);
-	waterQuadVAOVBOfromOBJ();
-
-	// area lights obj file load
 	const char* areaLightObjFilePath = argv[2];
-	bool areaLightSuccess = areaLightMesh.LoadFromFileObj(areaLightObjFilePath, true);
-	loadObjFileSetup(areaLightMesh, areaLightVertices, areaLightTextures, areaLightNumVert);
-	areaLightUniqueVerts(); // get the unique vertices for the area lights (for each 6 vertices, take the first three and last vertices)
+	isLightVideo = LightVideoDecoder::IsSequence(argv[3]);
+	std::string areaLightTexFileName = isLightVideo ? LightVideoDecoder::FrameName(argv[3], 0) : argv[3];
+	TaskPool loader;
+
+	auto areaLightObjLoaded = loader.Submit([&] {
+		TRACE_SCOPE("load area light obj");
+		bool areaLightSuccess = areaLightMesh.LoadFromFileObj(areaLightObjFilePath, true);
+		loadObjFileSetup(areaLightMesh, areaLightVertices, areaLightTextures, areaLightNumVert);
+		return areaLightSuccess;
+	});
+	auto objLoaded = loader.Submit([&] {
+		TRACE_SCOPE("load water obj");
+		bool success = mesh.LoadFromFileObj(objFilePath, true);
+		loadObjFileSetup(mesh, vertices, textures, totalNumVert);
+		return success;
+	});
+	// the cached textures are mapped, the images are only decoded on a cache miss
+	std::string skyboxKey = skyboxCacheKey();
+	CachedTexture cachedSkybox;
+	bool skyboxCached = useTextureCache && loadCachedTexture(textureCacheDir, skyboxKey, cachedSkybox);
+	std::future<std::vector<CubeLevel>> skyboxPrefiltered;
+	if (!skyboxCached) {
+		skyboxPrefiltered = loader.Submit(prefilterSkybox);
+	}
+	auto cubeLoaded = loader.Submit(cubeSetup);
+	auto ltcLoaded = loader.Submit([] { return loadLTCTable(ltcTablePath, ltcTable); });
+
+	// the shaders compile while the loader threads work, unless they are cached
+	bool parallelShaders = enableParallelShaderCompile();
+	std::vector<ProgramBuild> programBuilds = {
+		describeProgram(cubeProg, "envcube.vert", "envcube.frag"),
+		describeProgram(areaLightProg, "areaLight.vert", "areaLight.frag"),
+		describeProgram(depthPrepassProg, "tessShader.vert", "depthPrepass.frag", nullptr, "tessShader.tesc", "tessShader.tese"),
+		describeProgram(hiZProg, "screenQuad.vert", "hiZ.frag"),
+		describeProgram(ssrProg, "screenQuad.vert", "ssr.frag"),
+		describeProgram(waveCaptureProg, "tessShader.vert", nullptr, nullptr, "tessShader.tesc", "tessShader.tese", { "tesePos", "teseNormal" }),
+	};
+	auto shaderStart = chrono::steady_clock::now();
+	for (ProgramBuild& build : programBuilds) {
+		TRACE_SCOPE("startProgramBuild");
+		startProgramBuild(build, useShaderCache ? shaderCacheDir : nullptr);
+	}
+	double shaderMs = chrono::duration<double, milli>(chrono::steady_clock::now() - shaderStart).count();
+
+	// area lights obj file, then the light texture which needs the rectangle of every light
+	areaLightObjLoaded.get();
+	areaLightBlockSetup(); // the corners (for each 6 vertices, the first three and last vertices) and texture layer of each area light
+	if (numAreaLights == 0) {
+		cerr << "Error: No area lights in " << areaLightObjFilePath << endl;
+		return 1;
+	}
 	areaLightVAOVBOfromOBJ();
 
-	// area light textures
-	auto areaLightTexFileName = argv[3];
-	std::vector<unsigned char> areaLightTexData;
-	unsigned areaLightTexWidth, areaLightTexHeight;
-	decodeOneStep(areaLightTexFileName, areaLightTexData, areaLightTexWidth, areaLightTexHeight);
+	// the water variant loops over the lights in use, so it waits for the area lights
+	shaderStart = chrono::steady_clock::now();
+	waterVariants.SetFiles("tessShader.vert", "tessShader.frag", "tessShader.geom", "tessShader.tesc", "tessShader.tese");
+	programBuilds.push_back(waterVariants.Describe(waterDefines()));
+	startProgramBuild(programBuilds.back(), useShaderCache ? shaderCacheDir : nullptr);
+	waterProg = waterVariants.Find(waterDefines());
+	shaderMs += chrono::duration<double, milli>(chrono::steady_clock::now() - shaderStart).count();
+
+	auto areaLightStart = chrono::steady_clock::now();
+	std::string areaLightKey = areaLightCacheKey(areaLightObjFilePath, areaLightTexFileName);
+	CachedTexture cachedAreaLight;
+	bool areaLightCached = useTextureCache && !isLightVideo && loadCachedTexture(textureCacheDir, areaLightKey, cachedAreaLight)
+		&& cachedAreaLight.desc.layers == uint32_t(numAreaLights);
+	std::future<bool> areaLightPrefiltered;
+	if (!areaLightCached) {
+		areaLightPrefiltered = loader.Submit([&] {
+			DecodedImage image = decodeImage(areaLightTexFileName);
+			if (!image.data.empty()) {
+				prefilterAreaLights(image.data.data(), int(image.width), int(image.height), areaLightLayers);
+			}
+			return !image.data.empty();
+		});
+	}
 
-	AL_Tex.Initialize();
-	AL_Tex.SetImage(areaLightTexData.data(), 4, areaLightTexWidth, areaLightTexHeight);
-	AL_Tex.BuildMipmaps();
-	AL_Tex.SetWrappingMode(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+	// obj file loading
+	objLoaded.get();
+	waterQuadVAOVBOfromOBJ();
 
-	////
 	// cube (texture) mapping setup
-	cubeMapping();
-	// cube vertices setup
-	cubeSetup();
-	// cube vba and vbo setup
+	if (!cubeMapping(skyboxPrefiltered, skyboxCached ? &cachedSkybox : nullptr, skyboxKey)) {
+		return 1;
+	}
+	loadEnvBrdfLut();
+	computeSkySH();
+	// cube vertices, then vba and vbo setup
+	cubeLoaded.get();
 	cubeVaoVbo();
 
+	if (!ltcLoaded.get()) {
+		return 1;
+	}
+	ltcLut = loadMinvTexture(ltcTable);
+
+	// area light textures, a png or an image sequence
+	if (areaLightCached) {
+		AL_Tex = createAreaLightTexture(cachedAreaLight.desc, cachedAreaLight.images, cachedAreaLight.imageSizes);
+	}
+	else {
+		if (!areaLightPrefiltered.get()) {
+			cerr << "Error: Failed to load area light texture: " << areaLightTexFileName << endl;
+			return 1;
+		}
+		AL_Tex = loadAreaLightTexture(areaLightLayers, compressAreaLightTex && !isLightVideo);
+	}
+	if (isLightVideo) {
+		if (!lightVideoSetup(argv[3])) {
+			return 1;
+		}
+	}
+	else {
+		// the video texture changes every frame, only a static one is worth caching
+		TextureCacheDesc areaLightDesc = areaLightCached ? cachedAreaLight.desc : TextureCacheDesc();
+		if (!areaLightCached) {
+			GLint width, height, levels;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_INTERNAL_FORMAT, (GLint*)&areaLightDesc.internalFormat);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_WIDTH, &width);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_HEIGHT, &height);
+			glGetTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, &levels);
+			areaLightDesc.format = GL_RGBA;
+			areaLightDesc.type = GL_UNSIGNED_BYTE;
+			areaLightDesc.width = uint32_t(width);
+			areaLightDesc.height = uint32_t(height);
+			areaLightDesc.layers = uint32_t(numAreaLights);
+			areaLightDesc.levels = uint32_t(levels + 1);
+		}
+		size_t gpuBytes = areaLightCached ? cachedTextureSize(cachedAreaLight) : 0;
+		if (!areaLightCached) {
+			std::vector<std::vector<unsigned char>> stored;
+			gpuBytes = readTextureImages(GL_TEXTURE_2D_ARRAY, areaLightDesc, stored);
+			if (useTextureCache) {
+				saveCachedTexture(textureCacheDir, areaLightKey, areaLightDesc, stored);
+			}
+		}
+		reportTextureLoad("area light texture", areaLightCached, areaLightStart,
+			gpuBytes, size_t(areaLightDesc.width) * areaLightDesc.height * numAreaLights * 4 * 4 / 3);
+	}
+
 	// shader program setup
-	prog.BuildFiles("tessShader.vert", "tessShader.frag", nullptr, "tessShader.tesc", "tessShader.tese");
-	altProg.BuildFiles("tessShader.vert", "altTessShader.frag", nullptr, "tessShader.tesc", "tessShader.tese");
-	triangleLineProg.BuildFiles("tessShader.vert", "triangleLine.frag", "triangleLine.geom", "tessShader.tesc", "tessShader.tese");
-	cubeProg.BuildFiles("envcube.vert", "envcube.frag");
-	areaLightProg.BuildFiles("areaLight.vert", "areaLight.frag");
+	shaderStart = chrono::steady_clock::now();
+	int cachedPrograms = 0;
+	for (ProgramBuild& build : programBuilds) {
+		TRACE_SCOPE("finishProgramBuild");
+		if (!finishProgramBuild(build)) {
+			return 1;
+		}
+		shaderReloader.Watch(build);
+		cachedPrograms += build.cached ? 1 : 0;
+	}
+	shaderMs += chrono::duration<double, milli>(chrono::steady_clock::now() - shaderStart).count();
+	cout << "shaders: " << shaderMs << " ms on the main thread, " << cachedPrograms << " of " << programBuilds.size()
+		<< " programs from the cache" << (useShaderCache && !programBinariesSupported() ? " (no program binary support)" : "") << endl;
+	assetsLoadedTime = chrono::steady_clock::now();
+	cout << "assets loaded in " << chrono::duration<double, milli>(assetsLoadedTime - startupTime).count() << " ms ("
+		<< loader.Size() << " loader threads, " << (parallelShaders ? "parallel" : "serial") << " shader compile)" << endl;
 	
+	loadRenderOrder(renderOrderPath);
 	cameraVectors();
-	quadMVP(); // the line, cubemap, and arealight MVP is all here.
-	updateTessAndRadiusUniforms();
 	waveSetup();
-	ltc1 = loadMinvTexture(LTC1);
-	ltc2 = loadMinvTexture(LTC2);
-	prog["isDirectionalLight"] = 1;
-	altProg["isDirectionalLight"] = 1;
-	cubeProg["isDirectionalLight"] = 1;
-	if (isTexturedLight) {
-		handleAreaLightProgUniforms(prog);
+	setupWaterProgram(*waterProg); // the water, cubemap, and arealight MVP is all here.
+	cubeProg["isDirectionalLight"] = isDirectionalLight ? 1 : 0;
+	cubeProg["env"] = 0;
+
+	if (sweepPath && !startSweep()) {
+		return 1;
 	}
-	else {
-		handleAreaLightProgUniforms(altProg);
+	if (benchResultsPath && !startBench()) {
+		return 1;
+	}
+	if (goldenCasesPath && !startGoldenTest()) {
+		return 1;
 	}
 
 	// Register callbacks
@@ -1208,5 +3520,8 @@ int main(int argc, char* argv[]) {
 
 	// Enter the GLUT main loop
 	glutMainLoop();
-	return 0;
+	if (goldenFailures > 0) {
+		return 1;
+	}
+	return goldenSkipped > 0 ? goldenSkippedExitCode : 0;
 }
\ No newline at end of file
@@ -0,0 +1,207 @@
+// --------------------------------------------------------------------------------
+// Draw packets sorted by state and submitted in one batch.
+//
+// The passes of a frame record what they draw as packets: program, vertex
+// array, textures per unit, raster state and the draw call. The queue sorts
+// the packets by a key with the pass in the top bits, so the passes keep their
+// order, and the program, vertex array and textures below it, so the draws of
+// a pass that share state end up next to each other. Submitting walks the
+// sorted packets and only touches the GL state that differs from the previous
+// packet, counting the draw calls and the state changes it made.
+//
+// The state cache starts unknown at every Flush(): the code drawing outside of
+// the queue (the screen space reflections, the texture uploads) is free to
+// change any binding between frames.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/// <summary>
+/// One draw call with the state it needs.
+/// </summary>
+struct DrawPacket {
+	static const int MaxTextureUnits = 4;
+
+	int pass = 0;							// the position of the pass in the frame
+	GLuint program = 0;
+	GLuint vao = 0;
+	GLenum textureTargets[MaxTextureUnits] = {};	// 0 leaves the unit as it is
+	GLuint textures[MaxTextureUnits] = {};
+	bool depthWrite = true;
+	bool colorWrite = true;
+	int drawBuffers = 0;					// color attachments written when drawing into a frame buffer, 0 leaves them as they are
+	GLenum mode = GL_TRIANGLES;
+	GLint patchVertices = 0;				// for GL_PATCHES
+	GLint first = 0;
+	GLsizei count = 0;
+
+	/// <summary>
+	/// Binds a texture to a unit for this draw.
+	/// </summary>
+	DrawPacket& Texture(int unit, GLenum target, GLuint texture) {
+		textureTargets[unit] = target;
+		textures[unit] = texture;
+		return *this;
+	}
+};
+
+/// <summary>
+/// The draw calls and state changes of the last Flush().
+/// </summary>
+struct RenderQueueStats {
+	int drawCalls = 0;
+	int programBinds = 0;
+	int vaoBinds = 0;
+	int textureBinds = 0;
+	int rasterStateChanges = 0;		// depth mask, color mask, draw buffers and patch size
+	int patches = 0;				// tessellation patches drawn
+
+	int StateChanges() const { return programBinds + vaoBinds + textureBinds + rasterStateChanges; }
+};
+
+/// <summary>
+/// Collects the draw packets of a frame and submits them sorted by state.
+/// </summary>
+class RenderQueue {
+public:
+	/// <summary>
+	/// Records a packet, drawn at the next Flush().
+	/// </summary>
+	void Add(const DrawPacket& packet) {
+		uint32_t textureHash = 0;
+		for (int unit = 0; unit < DrawPacket::MaxTextureUnits; unit++) {
+			textureHash = textureHash * 31u + packet.textures[unit];
+		}
+		Entry entry;
+		entry.key = (uint64_t(packet.pass & 0xff) << 56) | (uint64_t(packet.program & 0xffff) << 40)
+			| (uint64_t(packet.vao & 0xffff) << 24) | (textureHash & 0xffffff);
+		entry.packet = packet;
+		entries.push_back(entry);
+	}
+
+	/// <summary>
+	/// Sorts and draws the recorded packets, then clears the queue. beginPass is
+	/// called with the pass of the next packets whenever it changes, and with -1
+	/// after the last one, for the timers.
+	/// </summary>
+	void Flush(const std::function<void(int)>& beginPass = nullptr) {
+		std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.key < b.key; });
+		stats = RenderQueueStats();
+		State state;
+		int pass = -1;
+		for (const Entry& entry : entries) {
+			const DrawPacket& packet = entry.packet;
+			if (packet.pass != pass && beginPass) {
+				beginPass(packet.pass);
+			}
+			pass = packet.pass;
+			Apply(packet, state);
+			glDrawArrays(packet.mode, packet.first, packet.count);
+			stats.drawCalls++;
+			if (packet.mode == GL_PATCHES && packet.patchVertices > 0) {
+				stats.patches += packet.count / packet.patchVertices;
+			}
+		}
+		if (pass != -1 && beginPass) {
+			beginPass(-1);
+		}
+		// leave the GL state as the code outside of the queue expects it
+		if (!state.depthWrite) glDepthMask(GL_TRUE);
+		if (!state.colorWrite) glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glActiveTexture(GL_TEXTURE0);
+		entries.clear();
+	}
+
+	/// <summary>
+	/// The draw calls and state changes of the last Flush().
+	/// </summary>
+	const RenderQueueStats& Stats() const { return stats; }
+
+private:
+	struct Entry {
+		uint64_t key;
+		DrawPacket packet;
+	};
+
+	/// <summary>
+	/// The GL state as the queue left it, unknown at first.
+	/// </summary>
+	struct State {
+		GLuint program = GLuint(-1);
+		GLuint vao = GLuint(-1);
+		GLenum textureTargets[DrawPacket::MaxTextureUnits] = {};
+		GLuint textures[DrawPacket::MaxTextureUnits] = {};
+		bool textureKnown[DrawPacket::MaxTextureUnits] = {};
+		int activeUnit = -1;
+		bool depthWrite = true;
+		bool colorWrite = true;
+		bool rasterKnown = false;
+		int drawBuffers = 0;
+		GLint patchVertices = 0;
+	};
+
+	void Apply(const DrawPacket& packet, State& state) {
+		if (packet.program != state.program) {
+			glUseProgram(packet.program);
+			state.program = packet.program;
+			stats.programBinds++;
+		}
+		if (packet.vao != state.vao) {
+			glBindVertexArray(packet.vao);
+			state.vao = packet.vao;
+			stats.vaoBinds++;
+		}
+		for (int unit = 0; unit < DrawPacket::MaxTextureUnits; unit++) {
+			GLenum target = packet.textureTargets[unit];
+			if (target == 0) {
+				continue;
+			}
+			// a unit holds one texture per target, only the last one bound is tracked
+			if (state.textureKnown[unit] && state.textureTargets[unit] == target && state.textures[unit] == packet.textures[unit]) {
+				continue;
+			}
+			if (state.activeUnit != unit) {
+				glActiveTexture(GL_TEXTURE0 + unit);
+				state.activeUnit = unit;
+			}
+			glBindTexture(target, packet.textures[unit]);
+			state.textureTargets[unit] = target;
+			state.textures[unit] = packet.textures[unit];
+			state.textureKnown[unit] = true;
+			stats.textureBinds++;
+		}
+		if (!state.rasterKnown || packet.depthWrite != state.depthWrite) {
+			glDepthMask(packet.depthWrite ? GL_TRUE : GL_FALSE);
+			state.depthWrite = packet.depthWrite;
+			stats.rasterStateChanges++;
+		}
+		if (!state.rasterKnown || packet.colorWrite != state.colorWrite) {
+			GLboolean write = packet.colorWrite ? GL_TRUE : GL_FALSE;
+			glColorMask(write, write, write, write);
+			state.colorWrite = packet.colorWrite;
+			stats.rasterStateChanges++;
+		}
+		state.rasterKnown = true;
+		if (packet.drawBuffers != 0 && packet.drawBuffers != state.drawBuffers) {
+			const GLenum buffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+			glDrawBuffers(std::min(packet.drawBuffers, 3), buffers);
+			state.drawBuffers = packet.drawBuffers;
+			stats.rasterStateChanges++;
+		}
+		if (packet.mode == GL_PATCHES && packet.patchVertices != state.patchVertices) {
+			glPatchParameteri(GL_PATCH_VERTICES, packet.patchVertices);
+			state.patchVertices = packet.patchVertices;
+			stats.rasterStateChanges++;
+		}
+	}
+
+	std::vector<Entry> entries;
+	RenderQueueStats stats;
+};
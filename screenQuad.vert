@@ -0,0 +1,12 @@
+#version 330 core
+
+// A triangle covering the screen, drawn with 3 vertices and no vertex buffer.
+
+out vec2 screenUV;
+
+void main()
+{
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	screenUV = corner;
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
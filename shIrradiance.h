@@ -0,0 +1,162 @@
+// --------------------------------------------------------------------------------
+// Diffuse irradiance of the skybox as 9 spherical harmonics coefficients.
+//
+// Following "An Efficient Representation for Irradiance Environment Maps"
+// (Ramamoorthi and Hanrahan 2001), the radiance of the cube map is projected
+// on the first 3 bands of the real spherical harmonics and convolved with the
+// clamped cosine, which only scales each band. The result divided by pi is the
+// reflected radiance of a white Lambertian surface, so the shader only needs a
+// few multiply-adds per fragment instead of a second cube map fetch.
+//
+// The projection loops over every texel of the 6 faces. With SSE, 4 texels of
+// a row are handled at once.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SH_IRRADIANCE_SSE 1
+#include <emmintrin.h>
+#endif
+
+/// <summary>
+/// The direction through a point of a face is origin + sc * uAxis + tc * vAxis,
+/// sc and tc in [-1, 1], in GL_TEXTURE_CUBE_MAP_POSITIVE_X + face order.
+/// </summary>
+const float SH_FACE_AXES[6][3][3] = {
+	{ { 1, 0, 0 }, { 0, 0, -1 }, { 0, -1, 0 } },
+	{ { -1, 0, 0 }, { 0, 0, 1 }, { 0, -1, 0 } },
+	{ { 0, 1, 0 }, { 1, 0, 0 }, { 0, 0, 1 } },
+	{ { 0, -1, 0 }, { 1, 0, 0 }, { 0, 0, -1 } },
+	{ { 0, 0, 1 }, { 1, 0, 0 }, { 0, -1, 0 } },
+	{ { 0, 0, -1 }, { -1, 0, 0 }, { 0, -1, 0 } },
+};
+
+/// <summary>
+/// Adds the contribution of one texel to the projection.
+/// </summary>
+inline void addSH9Sample(float x, float y, float z, float weight, const float* color, double sh[9][3]) {
+	const float basis[9] = {
+		0.282095f,
+		0.488603f * y, 0.488603f * z, 0.488603f * x,
+		1.092548f * x * y, 1.092548f * y * z, 0.315392f * (3.0f * z * z - 1.0f),
+		1.092548f * x * z, 0.546274f * (x * x - y * y),
+	};
+	for (int i = 0; i < 9; i++) {
+		for (int c = 0; c < 3; c++) {
+			sh[i][c] += double(basis[i] * weight * color[c]);
+		}
+	}
+}
+
+/// <summary>
+/// Projects the radiance of a cube map on the 9 spherical harmonics.
+/// </summary>
+/// <param name="faces"> the RGBA8 faces, size x size texels each </param>
+/// <param name="size"> the width and height of a face </param>
+/// <param name="toLinear"> the linear radiance of each 8-bit value </param>
+/// <param name="sh"> receives the RGB coefficients </param>
+inline void projectCubeSH9(const unsigned char* const faces[6], int size, const float toLinear[256], float sh[9][3]) {
+	double sum[9][3] = {};
+	double totalWeight = 0.0;
+	float texel = 2.0f / size;
+	for (int f = 0; f < 6; f++) {
+		const float* origin = SH_FACE_AXES[f][0];
+		const float* uAxis = SH_FACE_AXES[f][1];
+		const float* vAxis = SH_FACE_AXES[f][2];
+		for (int y = 0; y < size; y++) {
+			float tc = (y + 0.5f) * texel - 1.0f;
+			const unsigned char* row = faces[f] + size_t(y) * size * 4;
+			int x = 0;
+#ifdef SH_IRRADIANCE_SSE
+			// 4 texels at a time, the row sums are added to sum after the loop
+			__m128 acc[9][3];
+			for (int i = 0; i < 9; i++) {
+				for (int c = 0; c < 3; c++) acc[i][c] = _mm_setzero_ps();
+			}
+			__m128 accWeight = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f), three = _mm_set1_ps(3.0f);
+			const __m128 k0 = _mm_set1_ps(0.282095f), k1 = _mm_set1_ps(0.488603f);
+			const __m128 k2 = _mm_set1_ps(1.092548f), k20 = _mm_set1_ps(0.315392f), k22 = _mm_set1_ps(0.546274f);
+			const __m128 solidAngle = _mm_set1_ps(texel * texel);
+			for (; x + 4 <= size; x += 4) {
+				__m128 sc = _mm_sub_ps(_mm_mul_ps(_mm_set_ps(x + 3.5f, x + 2.5f, x + 1.5f, x + 0.5f), _mm_set1_ps(texel)), one);
+				__m128 dx = _mm_add_ps(_mm_set1_ps(origin[0] + tc * vAxis[0]), _mm_mul_ps(sc, _mm_set1_ps(uAxis[0])));
+				__m128 dy = _mm_add_ps(_mm_set1_ps(origin[1] + tc * vAxis[1]), _mm_mul_ps(sc, _mm_set1_ps(uAxis[1])));
+				__m128 dz = _mm_add_ps(_mm_set1_ps(origin[2] + tc * vAxis[2]), _mm_mul_ps(sc, _mm_set1_ps(uAxis[2])));
+				__m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+				__m128 length = _mm_sqrt_ps(length2);
+				__m128 inverseLength = _mm_div_ps(one, length);
+				dx = _mm_mul_ps(dx, inverseLength);
+				dy = _mm_mul_ps(dy, inverseLength);
+				dz = _mm_mul_ps(dz, inverseLength);
+				// solid angle of the texel on the unit cube
+				__m128 weight = _mm_div_ps(solidAngle, _mm_mul_ps(length2, length));
+				accWeight = _mm_add_ps(accWeight, weight);
+
+				const unsigned char* p = row + x * 4;
+				__m128 color[3];
+				for (int c = 0; c < 3; c++) {
+					color[c] = _mm_mul_ps(weight, _mm_set_ps(toLinear[p[12 + c]], toLinear[p[8 + c]], toLinear[p[4 + c]], toLinear[p[c]]));
+				}
+				__m128 basis[9] = {
+					k0,
+					_mm_mul_ps(k1, dy), _mm_mul_ps(k1, dz), _mm_mul_ps(k1, dx),
+					_mm_mul_ps(k2, _mm_mul_ps(dx, dy)), _mm_mul_ps(k2, _mm_mul_ps(dy, dz)),
+					_mm_mul_ps(k20, _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(dz, dz)), one)),
+					_mm_mul_ps(k2, _mm_mul_ps(dx, dz)), _mm_mul_ps(k22, _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))),
+				};
+				for (int i = 0; i < 9; i++) {
+					for (int c = 0; c < 3; c++) acc[i][c] = _mm_add_ps(acc[i][c], _mm_mul_ps(basis[i], color[c]));
+				}
+			}
+			for (int i = 0; i < 9; i++) {
+				for (int c = 0; c < 3; c++) {
+					float lanes[4];
+					_mm_storeu_ps(lanes, acc[i][c]);
+					sum[i][c] += double(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+				}
+			}
+			float lanes[4];
+			_mm_storeu_ps(lanes, accWeight);
+			totalWeight += double(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+#endif
+			// the rest of the row, or all of it without SSE
+			for (; x < size; x++) {
+				float sc = (x + 0.5f) * texel - 1.0f;
+				float d[3];
+				for (int k = 0; k < 3; k++) d[k] = origin[k] + sc * uAxis[k] + tc * vAxis[k];
+				float length2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+				float length = std::sqrt(length2);
+				float weight = texel * texel / (length2 * length);
+				const unsigned char* p = row + x * 4;
+				float color[3] = { toLinear[p[0]], toLinear[p[1]], toLinear[p[2]] };
+				addSH9Sample(d[0] / length, d[1] / length, d[2] / length, weight, color, sum);
+				totalWeight += weight;
+			}
+		}
+	}
+
+	// the texel solid angles add up to 4 pi up to the discretization
+	double normalization = 4.0 * 3.14159265358979 / totalWeight;
+	for (int i = 0; i < 9; i++) {
+		for (int c = 0; c < 3; c++) sh[i][c] = float(sum[i][c] * normalization);
+	}
+}
+
+/// <summary>
+/// Turns the radiance coefficients into the coefficients of the reflected
+/// radiance of a white Lambertian surface (irradiance / pi), with the basis
+/// constants folded in, so that it is evaluated for a unit normal n as
+/// c0 + c1 n.y + c2 n.z + c3 n.x + c4 n.x n.y + c5 n.y n.z + c6 (3 n.z^2 - 1) + c7 n.x n.z + c8 (n.x^2 - n.y^2)
+/// </summary>
+inline void irradianceSH9(float sh[9][3]) {
+	// clamped cosine convolution per band (pi, 2 pi / 3, pi / 4), divided by pi
+	const float band[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+	const float basis[9] = { 0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f };
+	for (int i = 0; i < 9; i++) {
+		for (int c = 0; c < 3; c++) sh[i][c] *= band[i] * basis[i];
+	}
+}
@@ -0,0 +1,440 @@
+// --------------------------------------------------------------------------------
+// Shader program building in two steps, with a cache of program binaries.
+//
+// cy::GLSLProgram::BuildFiles() compiles, checks and links each program before
+// returning, so the programs are built one after the other and nothing else can
+// happen meanwhile. startProgramBuild() only reads the sources and issues
+// glCompileShader for every stage. With GL_KHR_parallel_shader_compile the
+// driver compiles all the programs on its own threads while the application
+// loads assets. finishProgramBuild() then checks the compile logs and links
+// through the cy::GLSLProgram, so the program is used exactly as before.
+//
+// With a cache directory, the linked program is stored with glGetProgramBinary
+// and later builds load it with glProgramBinary instead of compiling. The file
+// is named after a key made of the driver (vendor, renderer and version) and a
+// hash of the sources and the captured varyings, and the key is stored in the
+// file and compared on load, so an edited shader or an updated driver is a
+// miss. A binary the driver rejects is a miss too, the program is compiled.
+//
+// The sources go through preprocessShaderSource(): #include "file" lines are
+// replaced by the files, so the stages and the variants of a program can share
+// code, and the #define lines of the build are put after the #version line, so
+// one source compiles into variants with different features (shaderVariants.h).
+// The key hashes the preprocessed sources, an edited include is a miss too.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <GL/glew.h>
+#include <cyGL.h>
+#include <textureCache.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+const char PROGRAM_CACHE_IDENTIFIER[8] = { 'G', 'L', 'P', 'R', 'O', 'G', '0', '1' };
+
+/// <summary>
+/// A program whose shaders are being compiled, or were loaded from the cache.
+/// </summary>
+struct ProgramBuild {
+	cy::GLSLProgram* program = nullptr;
+	std::vector<GLenum> types;			// the stage of each file
+	std::vector<std::string> files;		// the source file of each stage
+	std::vector<const char*> feedbackVaryings;	// captured interleaved by transform feedback
+	std::string defines;				// #define lines put after the #version line of every stage
+	std::vector<std::vector<std::string>> includes;	// the files each stage includes, see preprocessShaderSource()
+	std::vector<GLuint> shaders;		// the shaders being compiled, in the order of files
+	std::string cacheDirectory;			// empty without the program cache
+	std::string cacheKey;
+	bool cached = false;				// the program was loaded from the cache, nothing compiles
+	bool failed = false;				// a source could not be read
+};
+
+/// <summary>
+/// Lets the driver compile shaders on background threads, if it supports it.
+/// </summary>
+/// <returns> true if shaders are compiled in parallel </returns>
+inline bool enableParallelShaderCompile() {
+	if (GLEW_KHR_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); // as many as the driver wants
+		return true;
+	}
+	return false;
+}
+
+/// <summary>
+/// Reads a shader source.
+/// </summary>
+/// <returns> false, with an error printed, if the file could not be read </returns>
+inline bool readShaderSource(const std::string& filename, std::string& text) {
+	std::ifstream file(filename);
+	if (!file) {
+		std::cerr << "Error: Failed to open shader file: " << filename << std::endl;
+		return false;
+	}
+	std::stringstream source;
+	source << file.rdbuf();
+	text = source.str();
+	return true;
+}
+
+namespace shaderBuildDetail {
+
+/// <summary>
+/// Appends a file to a preprocessed source, see preprocessShaderSource().
+/// </summary>
+inline bool appendShaderSource(const std::string& filename, int sourceNumber, const std::string& defines,
+	std::string& text, std::vector<std::string>& includes) {
+	std::string source;
+	if (!readShaderSource(filename, source)) {
+		return false;
+	}
+	size_t slash = filename.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? std::string() : filename.substr(0, slash + 1);
+	std::istringstream lines(source);
+	std::string line;
+	int number = 0;
+	while (std::getline(lines, line)) {
+		number++;
+		size_t start = line.find_first_not_of(" \t");
+		bool directive = start != std::string::npos && line[start] == '#';
+		if (directive && line.compare(start, 8, "#include") == 0) {
+			size_t open = line.find('"', start + 8);
+			size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+			if (close == std::string::npos) {
+				std::cerr << "Error: " << filename << ":" << number << ": #include needs a \"file\"" << std::endl;
+				return false;
+			}
+			std::string included = directory + line.substr(open + 1, close - open - 1);
+			if (std::find(includes.begin(), includes.end(), included) == includes.end()) {
+				includes.push_back(included);
+				int includedNumber = int(includes.size());
+				text += "#line 1 " + std::to_string(includedNumber) + "\n";
+				if (!appendShaderSource(included, includedNumber, std::string(), text, includes)) {
+					return false;
+				}
+			}
+			text += "#line " + std::to_string(number + 1) + " " + std::to_string(sourceNumber) + "\n";
+			continue;
+		}
+		text += line;
+		text += '\n';
+		if (directive && !defines.empty() && line.compare(start, 8, "#version") == 0) {
+			text += defines;
+			text += "#line " + std::to_string(number + 1) + " " + std::to_string(sourceNumber) + "\n";
+		}
+	}
+	return true;
+}
+
+}
+
+/// <summary>
+/// Reads a shader source, puts the defines after its #version line and
+/// replaces its #include "file" lines with the files, named relative to the
+/// file that includes them. A file is included once, later includes of it are
+/// dropped. #line directives keep the line numbers of the compile errors, with
+/// the source string number 0 for the shader file and i + 1 for includes[i].
+/// </summary>
+/// <param name="filename"> the shader file </param>
+/// <param name="defines"> #define lines, may be empty </param>
+/// <param name="text"> receives the source </param>
+/// <param name="includes"> receives the included files </param>
+/// <returns> false, with an error printed, if a file could not be read </returns>
+inline bool preprocessShaderSource(const std::string& filename, const std::string& defines, std::string& text,
+	std::vector<std::string>& includes) {
+	text.clear();
+	includes.clear();
+	return shaderBuildDetail::appendShaderSource(filename, 0, defines, text, includes);
+}
+
+/// <summary>
+/// Names a shader file and the files it includes by their source string
+/// numbers, for the compile errors.
+/// </summary>
+inline std::string shaderSourceNames(const std::string& filename, const std::vector<std::string>& includes) {
+	std::string names = filename;
+	for (size_t i = 0; i < includes.size(); i++) {
+		names += (i == 0 ? " (" : ", ") + std::to_string(i + 1) + ": " + includes[i] + (i + 1 == includes.size() ? ")" : "");
+	}
+	return names;
+}
+
+/// <summary>
+/// Lists #define lines as NAME=value words, to tell the variants of a program apart in messages.
+/// </summary>
+inline std::string shaderDefineList(const std::string& defines) {
+	std::istringstream lines(defines);
+	std::string directive, name, value, list;
+	while (lines >> directive >> name) {
+		std::getline(lines, value);
+		size_t start = value.find_first_not_of(" \t");
+		value = start == std::string::npos ? std::string() : value.substr(start);
+		list += (list.empty() ? "" : " ") + name + (value.empty() ? "" : "=" + value);
+	}
+	return list;
+}
+
+/// <summary>
+/// Starts compiling a shader source.
+/// </summary>
+inline GLuint startSourceCompile(GLenum type, const std::string& text) {
+	const char* sourcePtr = text.c_str();
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &sourcePtr, nullptr);
+	glCompileShader(shader);
+	return shader;
+}
+
+/// <summary>
+/// Reads a shader source and starts compiling it.
+/// </summary>
+/// <param name="type"> the shader type </param>
+/// <param name="filename"> the source file </param>
+/// <returns> the shader, 0 if the file could not be read </returns>
+inline GLuint startShaderCompile(GLenum type, const char* filename) {
+	std::string text;
+	if (!readShaderSource(filename, text)) {
+		return 0;
+	}
+	return startSourceCompile(type, text);
+}
+
+/// <summary>
+/// Whether the driver can store programs as binaries.
+/// </summary>
+inline bool programBinariesSupported() {
+	if (!GLEW_ARB_get_program_binary) {
+		return false;
+	}
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+/// <summary>
+/// Returns the cache key of a program: the driver and a hash of the sources.
+/// </summary>
+inline std::string programCacheKey(const std::vector<GLenum>& types, const std::vector<std::string>& sources,
+	const std::vector<const char*>& feedbackVaryings) {
+	uint64_t hash = 14695981039346656037ull; // FNV-1a
+	auto add = [&hash](const std::string& text) {
+		for (char c : text) {
+			hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+		}
+		hash = (hash ^ 0xff) * 1099511628211ull;	// separates the strings
+	};
+	for (size_t i = 0; i < sources.size(); i++) {
+		add(std::to_string(types[i]));
+		add(sources[i]);
+	}
+	for (const char* varying : feedbackVaryings) {
+		add(varying);
+	}
+	char hex[32];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+	auto driverString = [](GLenum name) {
+		const GLubyte* text = glGetString(name);
+		return text ? std::string(reinterpret_cast<const char*>(text)) : std::string();
+	};
+	return driverString(GL_VENDOR) + ";" + driverString(GL_RENDERER) + ";" + driverString(GL_VERSION) + ";" + hex;
+}
+
+/// <summary>
+/// Returns the cache file of a key.
+/// </summary>
+inline std::string programCachePath(const std::string& directory, const std::string& key) {
+	uint64_t hash = 14695981039346656037ull; // FNV-1a
+	for (char c : key) {
+		hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hash);
+	return directory + "/" + name;
+}
+
+/// <summary>
+/// Loads a program from the cache into a program object.
+/// </summary>
+/// <returns> true if the file matched the key and the driver accepted the binary </returns>
+inline bool loadCachedProgram(const std::string& directory, const std::string& key, GLuint program) {
+	MappedFile file;
+	if (!file.Open(programCachePath(directory, key))) {
+		return false;
+	}
+	const unsigned char* data = file.Data();
+	size_t size = file.Size();
+	uint32_t keySize, format, binarySize;
+	size_t offset = sizeof(PROGRAM_CACHE_IDENTIFIER);
+	if (size < offset + 4 || memcmp(data, PROGRAM_CACHE_IDENTIFIER, offset) != 0) {
+		return false;
+	}
+	memcpy(&keySize, data + offset, 4);
+	offset += 4;
+	if (size < offset + keySize + 8 || key.compare(0, std::string::npos, reinterpret_cast<const char*>(data + offset), keySize) != 0) {
+		return false;
+	}
+	offset += keySize;
+	memcpy(&format, data + offset, 4);
+	memcpy(&binarySize, data + offset + 4, 4);
+	offset += 8;
+	if (size < offset + binarySize) {
+		return false;
+	}
+	glProgramBinary(program, format, data + offset, GLsizei(binarySize));
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	return linked == GL_TRUE;
+}
+
+/// <summary>
+/// Stores a linked program in the cache. The program must have been linked
+/// with GL_PROGRAM_BINARY_RETRIEVABLE_HINT.
+/// </summary>
+/// <returns> true on success </returns>
+inline bool saveCachedProgram(const std::string& directory, const std::string& key, GLuint program) {
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return false;
+	}
+	std::vector<unsigned char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+	std::string filename = programCachePath(directory, key);
+	std::string temporary = filename + ".tmp";
+	std::ofstream file(temporary, std::ios::binary);
+	if (!file) {
+		std::cerr << "Error: Failed to create program cache file: " << filename << std::endl;
+		return false;
+	}
+	uint32_t keySize = uint32_t(key.size()), binaryFormat = format, binarySize = uint32_t(length);
+	file.write(PROGRAM_CACHE_IDENTIFIER, sizeof(PROGRAM_CACHE_IDENTIFIER));
+	file.write(reinterpret_cast<const char*>(&keySize), 4);
+	file.write(key.data(), keySize);
+	file.write(reinterpret_cast<const char*>(&binaryFormat), 4);
+	file.write(reinterpret_cast<const char*>(&binarySize), 4);
+	file.write(reinterpret_cast<const char*>(binary.data()), binarySize);
+	file.close();
+	if (!file) {
+		std::remove(temporary.c_str());
+		return false;
+	}
+	// the rename replaces the file at once, a concurrent run reads the old or the new one
+	std::remove(filename.c_str());
+	return std::rename(temporary.c_str(), filename.c_str()) == 0;
+}
+
+/// <summary>
+/// Describes a program, same arguments as cy::GLSLProgram::BuildFiles(), and
+/// the varyings captured interleaved by transform feedback.
+/// </summary>
+inline ProgramBuild describeProgram(cy::GLSLProgram& program, const char* vert, const char* frag,
+	const char* geom = nullptr, const char* tesc = nullptr, const char* tese = nullptr,
+	std::vector<const char*> feedbackVaryings = {}) {
+	ProgramBuild build;
+	build.program = &program;
+	build.feedbackVaryings = std::move(feedbackVaryings);
+	const char* files[5] = { vert, frag, geom, tesc, tese };
+	const GLenum types[5] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER, GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER };
+	for (int i = 0; i < 5; i++) {
+		if (files[i] != nullptr) {
+			build.types.push_back(types[i]);
+			build.files.push_back(files[i]);
+		}
+	}
+	return build;
+}
+
+/// <summary>
+/// Loads a described program from the cache, or else starts compiling its shaders.
+/// </summary>
+/// <param name="build"> the described program </param>
+/// <param name="cacheDirectory"> the program cache, nullptr without it </param>
+inline void startProgramBuild(ProgramBuild& build, const char* cacheDirectory = nullptr) {
+	std::vector<std::string> sources(build.files.size());
+	build.includes.assign(build.files.size(), std::vector<std::string>());
+	for (size_t i = 0; i < build.files.size(); i++) {
+		if (!preprocessShaderSource(build.files[i], build.defines, sources[i], build.includes[i])) {
+			build.failed = true;
+		}
+	}
+	if (build.failed) {
+		return;
+	}
+	if (cacheDirectory && programBinariesSupported()) {
+		build.cacheDirectory = cacheDirectory;
+		build.cacheKey = programCacheKey(build.types, sources, build.feedbackVaryings);
+		build.program->CreateProgram();
+		if (loadCachedProgram(build.cacheDirectory, build.cacheKey, build.program->GetID())) {
+			build.cached = true;
+			return;
+		}
+	}
+	for (size_t i = 0; i < sources.size(); i++) {
+		build.shaders.push_back(startSourceCompile(build.types[i], sources[i]));
+	}
+}
+
+/// <summary>
+/// Checks the compiled shaders and links the program, unless it was loaded
+/// from the cache, and stores it in the cache.
+/// </summary>
+/// <param name="build"> the started build </param>
+/// <returns> true on success </returns>
+inline bool finishProgramBuild(ProgramBuild& build) {
+	if (build.cached) {
+		return true;
+	}
+	bool success = !build.failed;
+	for (size_t i = 0; i < build.shaders.size(); i++) {
+		GLint compiled = GL_FALSE;
+		glGetShaderiv(build.shaders[i], GL_COMPILE_STATUS, &compiled);
+		if (!compiled) {
+			GLint length = 0;
+			glGetShaderiv(build.shaders[i], GL_INFO_LOG_LENGTH, &length);
+			std::vector<char> log(std::max(length, 1));
+			glGetShaderInfoLog(build.shaders[i], GLsizei(log.size()), nullptr, log.data());
+			std::cerr << "Error: Failed to compile " << shaderSourceNames(build.files[i], build.includes[i])
+				<< (build.defines.empty() ? "" : " with " + shaderDefineList(build.defines)) << ":" << std::endl << log.data() << std::endl;
+			success = false;
+		}
+	}
+
+	if (success) {
+		build.program->CreateProgram();
+		for (GLuint shader : build.shaders) {
+			build.program->AttachShader(shader);
+		}
+		if (!build.feedbackVaryings.empty()) {
+			glTransformFeedbackVaryings(build.program->GetID(), GLsizei(build.feedbackVaryings.size()), build.feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+		}
+		if (!build.cacheKey.empty()) {
+			glProgramParameteri(build.program->GetID(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		success = build.program->Link(&std::cerr);
+		if (success && !build.cacheKey.empty()) {
+			saveCachedProgram(build.cacheDirectory, build.cacheKey, build.program->GetID());
+		}
+	}
+
+	// the program keeps the attached shaders alive until it is deleted
+	for (GLuint shader : build.shaders) {
+		glDeleteShader(shader);
+	}
+	build.shaders.clear();
+	return success;
+}
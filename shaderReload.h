@@ -0,0 +1,390 @@
+// --------------------------------------------------------------------------------
+// Hot reload of the shader programs.
+//
+// ShaderReloader watches the source files of the programs built with
+// shaderBuild.h, and the files they include. When one of them changes, every
+// program using it, each variant with its own defines, is built
+// again into a shadow program beside the live one, on the driver's threads
+// when it supports GL_KHR_parallel_shader_compile, and Poll() advances the
+// builds once per frame without waiting for them. A build that fails prints
+// its log and leaves the live program as it was. A build that succeeds gets
+// the uniform values and block bindings of the live program, and then takes
+// its place between two frames: the cy::GLSLProgram gets a new program object
+// loaded from the shadow's binary (relinked from its shaders without binary
+// support), so the code that holds the cy::GLSLProgram sees the new program at
+// its next draw. The new binary also goes to the program cache.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <shaderBuild.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Copies the values of the default block uniforms and the uniform block
+/// bindings of one program to another, by name. Uniforms the other program
+/// does not have, or has with another type, are skipped.
+/// </summary>
+inline void copyProgramUniforms(GLuint from, GLuint to) {
+	// the type of every uniform of the destination
+	std::map<std::string, GLenum> destinationTypes;
+	GLint count = 0;
+	char name[256];
+	glGetProgramiv(to, GL_ACTIVE_UNIFORMS, &count);
+	for (GLint i = 0; i < count; i++) {
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(to, GLuint(i), sizeof(name), nullptr, &size, &type, name);
+		destinationTypes[name] = type;
+	}
+
+	glGetProgramiv(from, GL_ACTIVE_UNIFORMS, &count);
+	for (GLint i = 0; i < count; i++) {
+		GLint size, block;
+		GLenum type;
+		GLuint index = GLuint(i);
+		glGetActiveUniform(from, index, sizeof(name), nullptr, &size, &type, name);
+		glGetActiveUniformsiv(from, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block);
+		auto destination = destinationTypes.find(name);
+		if (block != -1 || destination == destinationTypes.end() || destination->second != type) {
+			continue;
+		}
+		// arrays are named after their first element, the others are set one by one
+		std::string base = name;
+		if (base.size() > 3 && base.compare(base.size() - 3, 3, "[0]") == 0) {
+			base.resize(base.size() - 3);
+		}
+		for (GLint element = 0; element < size; element++) {
+			std::string elementName = size > 1 ? base + "[" + std::to_string(element) + "]" : std::string(name);
+			GLint source = glGetUniformLocation(from, elementName.c_str());
+			GLint target = glGetUniformLocation(to, elementName.c_str());
+			if (source < 0 || target < 0) {
+				continue;
+			}
+			GLfloat f[16];
+			GLint n[4];
+			GLuint u[4];
+			switch (type) {
+			case GL_FLOAT: glGetUniformfv(from, source, f); glProgramUniform1fv(to, target, 1, f); break;
+			case GL_FLOAT_VEC2: glGetUniformfv(from, source, f); glProgramUniform2fv(to, target, 1, f); break;
+			case GL_FLOAT_VEC3: glGetUniformfv(from, source, f); glProgramUniform3fv(to, target, 1, f); break;
+			case GL_FLOAT_VEC4: glGetUniformfv(from, source, f); glProgramUniform4fv(to, target, 1, f); break;
+			case GL_FLOAT_MAT2: glGetUniformfv(from, source, f); glProgramUniformMatrix2fv(to, target, 1, GL_FALSE, f); break;
+			case GL_FLOAT_MAT3: glGetUniformfv(from, source, f); glProgramUniformMatrix3fv(to, target, 1, GL_FALSE, f); break;
+			case GL_FLOAT_MAT4: glGetUniformfv(from, source, f); glProgramUniformMatrix4fv(to, target, 1, GL_FALSE, f); break;
+			case GL_INT_VEC2: case GL_BOOL_VEC2: glGetUniformiv(from, source, n); glProgramUniform2iv(to, target, 1, n); break;
+			case GL_INT_VEC3: case GL_BOOL_VEC3: glGetUniformiv(from, source, n); glProgramUniform3iv(to, target, 1, n); break;
+			case GL_INT_VEC4: case GL_BOOL_VEC4: glGetUniformiv(from, source, n); glProgramUniform4iv(to, target, 1, n); break;
+			case GL_UNSIGNED_INT: glGetUniformuiv(from, source, u); glProgramUniform1uiv(to, target, 1, u); break;
+			case GL_UNSIGNED_INT_VEC2: glGetUniformuiv(from, source, u); glProgramUniform2uiv(to, target, 1, u); break;
+			case GL_UNSIGNED_INT_VEC3: glGetUniformuiv(from, source, u); glProgramUniform3uiv(to, target, 1, u); break;
+			case GL_UNSIGNED_INT_VEC4: glGetUniformuiv(from, source, u); glProgramUniform4uiv(to, target, 1, u); break;
+			default:
+				// int and bool, and the samplers and images, whose value is a unit
+				glGetUniformiv(from, source, n);
+				glProgramUniform1iv(to, target, 1, n);
+				break;
+			}
+		}
+	}
+
+	glGetProgramiv(from, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	for (GLint i = 0; i < count; i++) {
+		GLint binding;
+		glGetActiveUniformBlockName(from, GLuint(i), sizeof(name), nullptr, name);
+		glGetActiveUniformBlockiv(from, GLuint(i), GL_UNIFORM_BLOCK_BINDING, &binding);
+		GLuint target = glGetUniformBlockIndex(to, name);
+		if (target != GL_INVALID_INDEX) {
+			glUniformBlockBinding(to, target, GLuint(binding));
+		}
+	}
+}
+
+/// <summary>
+/// Rebuilds the programs whose sources change, and swaps them in when they build.
+/// </summary>
+class ShaderReloader {
+public:
+	ShaderReloader() = default;
+	ShaderReloader(const ShaderReloader&) = delete;
+	ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+	/// <summary>
+	/// Watches the sources of a finished build.
+	/// </summary>
+	void Watch(const ProgramBuild& build) {
+		Watched watched;
+		watched.build = build;
+		watched.build.shaders.clear();
+		watched.build.cached = false;
+		watched.build.failed = false;
+		watched.files = SourceFiles(build);
+		for (const std::string& file : watched.files) {
+			watched.times.push_back(fileModificationTime(file));
+		}
+		programs.push_back(watched);
+	}
+
+	/// <summary>
+	/// Checks the sources at most every interval, and advances the builds.
+	/// Call it once per frame, on the thread of the GL context.
+	/// </summary>
+	/// <returns> the number of programs swapped in </returns>
+	int Poll() {
+		auto now = std::chrono::steady_clock::now();
+		if (now - lastCheck >= interval) {
+			lastCheck = now;
+			std::map<std::string, long long> times;		// the programs share sources
+			for (Watched& watched : programs) {
+				bool changed = false;
+				for (size_t i = 0; i < watched.files.size(); i++) {
+					const std::string& file = watched.files[i];
+					auto time = times.find(file);
+					if (time == times.end()) {
+						time = times.emplace(file, fileModificationTime(file)).first;
+					}
+					// a file being replaced may be missing for a moment
+					if (time->second != 0 && time->second != watched.times[i]) {
+						watched.times[i] = time->second;
+						changed = true;
+					}
+				}
+				if (changed) {
+					Start(watched);
+				}
+			}
+		}
+		int swapped = 0;
+		for (Watched& watched : programs) {
+			if (watched.building && Advance(watched)) {
+				swapped++;
+			}
+		}
+		return swapped;
+	}
+
+	/// <summary>
+	/// The time between two checks of the sources.
+	/// </summary>
+	std::chrono::milliseconds interval{ 500 };
+
+private:
+	struct Watched {
+		ProgramBuild build;					// the recipe, without shaders
+		std::vector<std::string> files;		// the stage files and their includes
+		std::vector<long long> times;		// the modification time of every file
+		bool building = false;
+		bool linking = false;
+		GLuint shadow = 0;
+		std::vector<GLuint> shaders;
+		std::string cacheKey;				// of the sources being built
+		std::chrono::steady_clock::time_point start;
+	};
+
+	/// <summary>
+	/// Starts compiling the sources of a program, dropping a build in progress.
+	/// </summary>
+	void Start(Watched& watched) {
+		Discard(watched);
+		std::vector<std::string> sources(watched.build.files.size());
+		std::vector<std::vector<std::string>> includes(sources.size());
+		for (size_t i = 0; i < sources.size(); i++) {
+			if (!preprocessShaderSource(watched.build.files[i], watched.build.defines, sources[i], includes[i])) {
+				return;
+			}
+		}
+		// an edit may add or drop includes, the files kept keep their times
+		watched.build.includes = includes;
+		std::vector<std::string> files = SourceFiles(watched.build);
+		std::vector<long long> times;
+		for (const std::string& file : files) {
+			auto kept = std::find(watched.files.begin(), watched.files.end(), file);
+			times.push_back(kept != watched.files.end() ? watched.times[kept - watched.files.begin()] : fileModificationTime(file));
+		}
+		watched.files = files;
+		watched.times = times;
+		watched.start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < sources.size(); i++) {
+			watched.shaders.push_back(startSourceCompile(watched.build.types[i], sources[i]));
+		}
+		watched.cacheKey.clear();
+		if (!watched.build.cacheDirectory.empty()) {
+			watched.cacheKey = programCacheKey(watched.build.types, sources, watched.build.feedbackVaryings);
+		}
+		watched.building = true;
+	}
+
+	/// <summary>
+	/// Moves a build on as far as the driver allows without waiting.
+	/// </summary>
+	/// <returns> true if the program was swapped in </returns>
+	bool Advance(Watched& watched) {
+		bool parallel = GLEW_KHR_parallel_shader_compile;
+		if (!watched.linking) {
+			for (GLuint shader : watched.shaders) {
+				GLint done = GL_TRUE;
+				if (parallel) {
+					glGetShaderiv(shader, GL_COMPLETION_STATUS_KHR, &done);
+				}
+				if (!done) {
+					return false;
+				}
+			}
+			bool compiled = true;
+			for (size_t i = 0; i < watched.shaders.size(); i++) {
+				GLint status = GL_FALSE;
+				glGetShaderiv(watched.shaders[i], GL_COMPILE_STATUS, &status);
+				if (!status) {
+					std::cerr << "Error: Failed to compile " << shaderSourceNames(watched.build.files[i], watched.build.includes[i])
+						<< (watched.build.defines.empty() ? "" : " with " + shaderDefineList(watched.build.defines)) << ":" << std::endl
+						<< ShaderLog(watched.shaders[i]) << "the program in use is kept" << std::endl;
+					compiled = false;
+				}
+			}
+			if (!compiled) {
+				Discard(watched);
+				return false;
+			}
+			watched.shadow = glCreateProgram();
+			for (GLuint shader : watched.shaders) {
+				glAttachShader(watched.shadow, shader);
+			}
+			if (!watched.build.feedbackVaryings.empty()) {
+				glTransformFeedbackVaryings(watched.shadow, GLsizei(watched.build.feedbackVaryings.size()),
+					watched.build.feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+			}
+			if (programBinariesSupported()) {
+				glProgramParameteri(watched.shadow, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			}
+			glLinkProgram(watched.shadow);
+			watched.linking = true;
+		}
+
+		GLint done = GL_TRUE;
+		if (parallel) {
+			glGetProgramiv(watched.shadow, GL_COMPLETION_STATUS_KHR, &done);
+		}
+		if (!done) {
+			return false;
+		}
+		GLint linked = GL_FALSE;
+		glGetProgramiv(watched.shadow, GL_LINK_STATUS, &linked);
+		if (!linked) {
+			GLint length = 0;
+			glGetProgramiv(watched.shadow, GL_INFO_LOG_LENGTH, &length);
+			std::vector<char> log(std::max(length, 1));
+			glGetProgramInfoLog(watched.shadow, GLsizei(log.size()), nullptr, log.data());
+			std::cerr << "Error: Failed to link " << Files(watched) << ":" << std::endl << log.data() << "the program in use is kept" << std::endl;
+			Discard(watched);
+			return false;
+		}
+		Swap(watched);
+		Discard(watched);
+		return true;
+	}
+
+	/// <summary>
+	/// Puts the linked shadow program in the place of the live one.
+	/// </summary>
+	void Swap(Watched& watched) {
+		cy::GLSLProgram& program = *watched.build.program;
+		copyProgramUniforms(program.GetID(), watched.shadow);
+		bool loaded = false;
+		GLint length = 0;
+		if (programBinariesSupported()) {
+			glGetProgramiv(watched.shadow, GL_PROGRAM_BINARY_LENGTH, &length);
+		}
+		if (length > 0) {
+			std::vector<unsigned char> binary(length);
+			GLenum format = 0;
+			glGetProgramBinary(watched.shadow, length, &length, &format, binary.data());
+			program.CreateProgram();
+			glProgramBinary(program.GetID(), format, binary.data(), length);
+			GLint linked = GL_FALSE;
+			glGetProgramiv(program.GetID(), GL_LINK_STATUS, &linked);
+			loaded = linked == GL_TRUE;
+		}
+		if (!loaded) {
+			program.CreateProgram();
+			for (GLuint shader : watched.shaders) {
+				program.AttachShader(shader);
+			}
+			if (!watched.build.feedbackVaryings.empty()) {
+				glTransformFeedbackVaryings(program.GetID(), GLsizei(watched.build.feedbackVaryings.size()),
+					watched.build.feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+			}
+			program.Link(&std::cerr);
+		}
+		copyProgramUniforms(watched.shadow, program.GetID());
+		if (!watched.cacheKey.empty()) {
+			saveCachedProgram(watched.build.cacheDirectory, watched.cacheKey, watched.shadow);
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - watched.start).count();
+		std::cout << "reloaded " << Files(watched) << " in " << ms << " ms" << (loaded ? "" : " (relinked)") << std::endl;
+	}
+
+	/// <summary>
+	/// Drops the shadow program and the shaders of a build.
+	/// </summary>
+	void Discard(Watched& watched) {
+		if (watched.shadow) {
+			glDeleteProgram(watched.shadow);
+			watched.shadow = 0;
+		}
+		for (GLuint shader : watched.shaders) {
+			glDeleteShader(shader);
+		}
+		watched.shaders.clear();
+		watched.building = false;
+		watched.linking = false;
+	}
+
+	static std::string ShaderLog(GLuint shader) {
+		GLint length = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+		std::vector<char> log(std::max(length, 1));
+		glGetShaderInfoLog(shader, GLsizei(log.size()), nullptr, log.data());
+		return log.data();
+	}
+
+	static std::string Files(const Watched& watched) {
+		std::string files;
+		for (const std::string& file : watched.build.files) {
+			files += (files.empty() ? "" : ", ") + file;
+		}
+		if (!watched.build.defines.empty()) {
+			files += " with " + shaderDefineList(watched.build.defines);
+		}
+		return files;
+	}
+
+	/// <summary>
+	/// The stage files of a build and the files they include, each once.
+	/// </summary>
+	static std::vector<std::string> SourceFiles(const ProgramBuild& build) {
+		std::vector<std::string> files;
+		auto add = [&files](const std::string& file) {
+			if (std::find(files.begin(), files.end(), file) == files.end()) {
+				files.push_back(file);
+			}
+		};
+		for (const std::string& file : build.files) {
+			add(file);
+		}
+		for (const std::vector<std::string>& stageIncludes : build.includes) {
+			for (const std::string& file : stageIncludes) {
+				add(file);
+			}
+		}
+		return files;
+	}
+
+	std::vector<Watched> programs;
+	std::chrono::steady_clock::time_point lastCheck;
+};
@@ -0,0 +1,119 @@
+// --------------------------------------------------------------------------------
+// Specialized variants of a shader program.
+//
+// A program with optional features is written once, with #if on a flag per
+// feature, and every combination of flags the application uses is built as a
+// program of its own, the flags defined after the #version line of every stage
+// (preprocessShaderSource() in shaderBuild.h). A disabled feature is removed
+// by the preprocessor instead of branched over at run time, so each variant
+// pays only for the features it uses.
+//
+// ProgramVariants builds a variant the first time it is asked for, from the
+// program cache when it is there, and keeps it for the next time. The variants
+// are handed to a ShaderReloader, which rebuilds each of them with its own
+// flags when the sources or their includes change.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <shaderBuild.h>
+#include <shaderReload.h>
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+/// <summary>
+/// Returns the #define line of a feature flag, for the defines of a variant.
+/// </summary>
+inline std::string shaderDefine(const char* name, int value) {
+	return std::string("#define ") + name + " " + std::to_string(value) + "\n";
+}
+
+/// <summary>
+/// The variants of a program, by their #define lines.
+/// </summary>
+class ProgramVariants {
+public:
+	ProgramVariants() = default;
+	ProgramVariants(const ProgramVariants&) = delete;
+	ProgramVariants& operator=(const ProgramVariants&) = delete;
+
+	/// <summary>
+	/// Sets the stages of the program, same arguments as describeProgram().
+	/// </summary>
+	void SetFiles(const char* vert, const char* frag, const char* geom = nullptr, const char* tesc = nullptr, const char* tese = nullptr) {
+		files[0] = vert;
+		files[1] = frag;
+		files[2] = geom;
+		files[3] = tesc;
+		files[4] = tese;
+	}
+
+	/// <summary>
+	/// Describes a variant for startProgramBuild(), adding it if it is new.
+	/// Its program stays empty until the build is finished.
+	/// </summary>
+	ProgramBuild Describe(const std::string& defines) {
+		std::unique_ptr<cy::GLSLProgram>& program = variants[defines];
+		if (!program) {
+			program.reset(new cy::GLSLProgram);
+		}
+		ProgramBuild build = describeProgram(*program, files[0], files[1], files[2], files[3], files[4]);
+		build.defines = defines;
+		return build;
+	}
+
+	/// <summary>
+	/// Returns a variant that was described, nullptr if there is none.
+	/// </summary>
+	cy::GLSLProgram* Find(const std::string& defines) const {
+		auto variant = variants.find(defines);
+		return variant != variants.end() ? variant->second.get() : nullptr;
+	}
+
+	/// <summary>
+	/// Returns a variant, built and handed to the reloader if it is new.
+	/// A new variant is built on the calling thread before it returns.
+	/// </summary>
+	/// <param name="defines"> the #define lines of the variant </param>
+	/// <param name="cacheDirectory"> the program cache, nullptr without it </param>
+	/// <param name="reloader"> watches the sources of a new variant, may be nullptr </param>
+	/// <param name="built"> if not null, set to whether the variant is new </param>
+	/// <returns> the variant, nullptr if it failed to build </returns>
+	cy::GLSLProgram* Get(const std::string& defines, const char* cacheDirectory, ShaderReloader* reloader, bool* built = nullptr) {
+		if (built) {
+			*built = false;
+		}
+		if (cy::GLSLProgram* program = Find(defines)) {
+			return program;
+		}
+		auto start = std::chrono::steady_clock::now();
+		ProgramBuild build = Describe(defines);
+		startProgramBuild(build, cacheDirectory);
+		if (!finishProgramBuild(build)) {
+			variants.erase(defines);
+			return nullptr;
+		}
+		if (reloader) {
+			reloader->Watch(build);
+		}
+		if (built) {
+			*built = true;
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "shader variant " << shaderDefineList(defines) << ": " << ms << " ms" << (build.cached ? " from the cache" : "") << std::endl;
+		return build.program;
+	}
+
+	/// <summary>
+	/// The number of variants.
+	/// </summary>
+	size_t Size() const { return variants.size(); }
+
+private:
+	const char* files[5] = {};
+	std::map<std::string, std::unique_ptr<cy::GLSLProgram>> variants;
+};
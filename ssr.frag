@@ -0,0 +1,138 @@
+#version 330 core
+
+// Screen space reflections on the water, composited over the shaded scene.
+//
+// The water writes its normal and roughness and, instead of adding it, its
+// cube map reflection with the BRDF weight of the reflection. For every water
+// pixel the reflected ray is traced in screen space through the min depth
+// pyramid (hierarchical Z): the ray skips whole cells while it stays in front
+// of their nearest depth and descends to finer levels when it may hit. A hit
+// returns the scene color there, blurred with the roughness, and the cube map
+// reflection fills in where the ray leaves the screen or misses.
+
+layout(location=0) out vec4 color;
+
+in vec2 screenUV;
+
+uniform sampler2D sceneColor;        // the shaded scene, with mips for rough reflections
+uniform sampler2D hiZ;               // the min depth pyramid
+uniform sampler2D gbufferNormal;     // water normal (world space) and roughness, 0 elsewhere
+uniform sampler2D gbufferReflection; // water cube map reflection and its BRDF weight
+
+uniform mat4 viewMat;
+uniform mat4 projectionMat;
+uniform mat4 invProjectionMat;
+uniform float nearClip;
+
+uniform int hiZLevels;
+uniform int maxIterations;
+uniform float maxRoughness;  // rougher water keeps the cube map reflection
+uniform float maxDistance;   // length of the rays in view space
+uniform float thickness;     // view space depth behind a surface still counted as a hit
+uniform float colorLodScale; // blur of the reflected scene per unit of roughness
+
+vec3 viewPosition(vec2 uv, float depth) {
+    vec4 p = invProjectionMat * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return p.xyz / p.w;
+}
+
+vec3 screenPosition(vec3 viewPos) {
+    vec4 clip = projectionMat * vec4(viewPos, 1.0);
+    return clip.xyz / clip.w * 0.5 + 0.5;
+}
+
+// The ray parameter where o + t d leaves the cell c of a level of the given size,
+// nudged into the next cell.
+float cellExit(vec3 o, vec3 d, vec2 c, vec2 size) {
+    vec2 boundary = (c + step(0.0, d.xy)) / size + sign(d.xy) * (0.001 / size);
+    vec2 direction = vec2(d.x == 0.0 ? 1e-9 : d.x, d.y == 0.0 ? 1e-9 : d.y);
+    vec2 t = (boundary - o.xy) / direction;
+    return min(t.x, t.y);
+}
+
+// Traces o + t d, t in [0, 1], in screen space (uv and depth buffer value).
+// Returns the ray parameter of the hit, or -1. Hits are only decided at the
+// finest level: the nearest depth of a coarser cell may come from another
+// pixel of the cell, such as the one the ray starts from.
+float traceHiZ(vec3 o, vec3 d) {
+    vec2 size0 = vec2(textureSize(hiZ, 0));
+    float t = cellExit(o, d, floor(o.xy * size0), size0); // leave the starting pixel
+    int level = 0;
+    for (int i = 0; i < maxIterations; i++) {
+        vec3 ray = o + d * t;
+        if (t > 1.0 || any(lessThan(ray.xy, vec2(0.0))) || any(greaterThanEqual(ray.xy, vec2(1.0)))) {
+            return -1.0;
+        }
+        vec2 size = vec2(max(textureSize(hiZ, 0) >> level, ivec2(1)));
+        vec2 c = floor(ray.xy * size);
+        float minZ = texelFetch(hiZ, ivec2(c), level).r;
+        float tExit = cellExit(o, d, c, size);
+        if (ray.z < minZ) {
+            // in front of everything in the cell: move to the nearest depth if it is
+            // reached inside the cell, else skip the cell and go up a level
+            float tPlane = d.z > 0.0 ? (minZ - o.z) / d.z : 2.0;
+            if (tPlane < tExit) {
+                t = tPlane;
+                if (level == 0) {
+                    return t; // reaches the depth of the pixel
+                }
+                level--;
+            }
+            else {
+                t = tExit;
+                level = min(level + 1, hiZLevels - 1);
+            }
+        }
+        else {
+            if (level == 0) {
+                return t; // behind the depth of the pixel
+            }
+            level--;
+        }
+    }
+    return -1.0;
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 scene = texelFetch(sceneColor, pixel, 0);
+    vec4 normalRoughness = texelFetch(gbufferNormal, pixel, 0);
+    if (dot(normalRoughness.xyz, normalRoughness.xyz) < 0.25) {
+        color = scene; // not water
+        return;
+    }
+    vec4 reflection = texelFetch(gbufferReflection, pixel, 0);
+    float roughness = normalRoughness.w;
+    float confidence = 0.0;
+    vec3 hitColor = vec3(0.0);
+
+    if (roughness < maxRoughness) {
+        // the reflected ray in view space, clipped at the near plane
+        float depth = texelFetch(hiZ, pixel, 0).r;
+        vec3 P = viewPosition(screenUV, depth);
+        vec3 N = normalize(mat3(viewMat) * normalRoughness.xyz);
+        vec3 R = reflect(normalize(P), N);
+        float rayLength = maxDistance;
+        if (P.z + R.z * rayLength > -nearClip) {
+            rayLength = (-nearClip - P.z) / R.z;
+        }
+        vec3 o = vec3(screenUV, depth);
+        vec3 d = screenPosition(P + R * rayLength) - o;
+
+        float t = traceHiZ(o, d);
+        if (t >= 0.0) {
+            vec3 hit = o + d * t;
+            float sceneDepth = texelFetch(hiZ, ivec2(hit.xy * vec2(textureSize(hiZ, 0))), 0).r;
+            float behind = viewPosition(hit.xy, sceneDepth).z - viewPosition(hit.xy, hit.z).z;
+            if (sceneDepth < 1.0 && behind < thickness) {
+                hitColor = textureLod(sceneColor, hit.xy, roughness * colorLodScale).rgb;
+                vec2 edge = smoothstep(0.0, 0.1, hit.xy) * smoothstep(0.0, 0.1, 1.0 - hit.xy);
+                confidence = edge.x * edge.y
+                           * (1.0 - smoothstep(0.5 * maxRoughness, maxRoughness, roughness))
+                           * (1.0 - smoothstep(0.0, 0.5, R.z)); // rays towards the camera leave the depth buffer
+            }
+        }
+    }
+
+    color = vec4(scene.rgb + mix(reflection.rgb, hitColor * reflection.a, confidence), 1.0);
+}
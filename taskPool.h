@@ -0,0 +1,102 @@
+// --------------------------------------------------------------------------------
+// A small thread pool for loading work.
+//
+// Tasks run in submission order on a fixed set of worker threads and return
+// their result through a std::future. Tasks must not call OpenGL: the context
+// belongs to the main thread, which waits on the futures and does the uploads.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <trace.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// A fixed size pool of worker threads with a shared FIFO queue.
+/// </summary>
+class TaskPool {
+public:
+	/// <summary>
+	/// Starts the workers.
+	/// </summary>
+	/// <param name="numThreads"> the number of workers, 0 for one per hardware thread </param>
+	explicit TaskPool(unsigned numThreads = 0) {
+		if (numThreads == 0) {
+			numThreads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		for (unsigned i = 0; i < numThreads; i++) {
+			workers.emplace_back(&TaskPool::Run, this, i + 1);
+		}
+	}
+
+	/// <summary>
+	/// Finishes the queued tasks and joins the workers.
+	/// </summary>
+	~TaskPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	/// <summary>
+	/// Queues a task.
+	/// </summary>
+	/// <param name="task"> a callable without arguments </param>
+	/// <returns> the future of the task's result </returns>
+	template <class Task>
+	auto Submit(Task task) -> std::future<decltype(task())> {
+		typedef decltype(task()) Result;
+		auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+		std::future<Result> result = packaged->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back([packaged] { (*packaged)(); });
+		}
+		wake.notify_one();
+		return result;
+	}
+
+	/// <summary>
+	/// The number of worker threads.
+	/// </summary>
+	unsigned Size() const { return unsigned(workers.size()); }
+
+private:
+	void Run(unsigned index) {
+		Tracer::SetThreadName("pool worker " + std::to_string(index));
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !queue.empty(); });
+				if (queue.empty()) {
+					return;
+				}
+				task = std::move(queue.front());
+				queue.pop_front();
+			}
+			task();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> queue;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
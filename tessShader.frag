@@ -1,102 +1,106 @@
 #version 330 core
 
+// The water. Its features are flags defined by the application before the
+// source is compiled, one program per combination (shaderVariants.h):
+//   TEXTURED_LIGHT  1: the area lights show their prefiltered texture,
+//                   0: plain area lights, with a diffuse LTC and the GGX Fresnel
+//   DIRECTIONAL     1: the directional light, the sky and the environment map are added
+//   ENV_REFLECT     1: the environment map reflection is added here,
+//                   0: it goes to gbufferReflection for the screen space reflections
+//   NUM_LIGHTS      the number of area lights in use
+// Each flag is a constant, so the compiler removes the code of the features a
+// variant does not use. With UBER_SHADER, DIRECTIONAL, ENV_REFLECT and
+// NUM_LIGHTS are uniforms instead and every variant branches at run time.
+
+#ifdef UBER_SHADER
+uniform int isDirectionalLight;
+uniform int ssrEnabled;           // the reflection is added by the screen space reflection pass
+uniform int numLights;            // lights in use
+#define DIRECTIONAL isDirectionalLight
+#define ENV_REFLECT (1 - ssrEnabled)
+#define NUM_LIGHTS numLights
+#endif
+#ifndef TEXTURED_LIGHT
+#define TEXTURED_LIGHT 1
+#endif
+#ifndef DIRECTIONAL
+#define DIRECTIONAL 1
+#endif
+#ifndef ENV_REFLECT
+#define ENV_REFLECT 1
+#endif
+#ifndef NUM_LIGHTS
+#define NUM_LIGHTS MAX_AREA_LIGHTS
+#endif
+
 layout(location=0) out vec4 color;
+layout(location=1) out vec4 gbufferNormal;      // for the screen space reflections: normal and roughness
+layout(location=2) out vec4 gbufferReflection;  // and the cube map reflection with its BRDF weight
 
 in vec3 fragPos;
 in vec2 fragTexCoord;
 in vec3 fragNormal;
+in float fragSlopeVariance;
+noperspective in vec3 fragBarycentric; // in the tessellated triangle, from tessShader.geom
 
-const vec3 baseColor = vec3(0.1, 0.2, 0.35); 
-
-// Directional light
-uniform vec3 lightDir;          // Light direction = w
-uniform vec3 lightColor;        // Light color
-uniform float constShininess;   // the shininess of the reflection = alpha
-uniform float constLightIntensity;
-uniform float constAmbientLight;
-uniform int isDirectionalLight;
+const vec3 baseColor = vec3(0.1, 0.2, 0.35);
 
 uniform vec3 cameraVec;         // Camera vector = V
+uniform float baseRoughness;    // roughness of calm water
 
-uniform samplerCube env;
+uniform samplerCube env;         // level i is prefiltered for the roughness i / envMaxLod
+uniform float envMaxLod;
+uniform sampler2D envBrdfLut;     // split-sum scale and bias to F0, by N.V and roughness
+const float waterF0 = 0.02;       // reflectance of water at normal incidence
+uniform int showTriangulation;    // draws the edges of the tessellated triangles over the water
 
 // the following is for area lights
-uniform vec3 areaLightVerts[24]; // 4 vertices for 6 squares
-uniform sampler2D areaLightTex; // area light texture
-uniform vec2 areaLightTexCorners[4]; // the corner of texture coords
-uniform vec3 areaLight4Corners[4]; // the corner vertices
-
-// LTC look up table
-uniform sampler2D ltc1;
-uniform sampler2D ltc2;
-const float LUT_SIZE = 64.0; // ltc_texture size. LUT = look up table
-const float LUT_SCALE = (LUT_SIZE - 1.0)/LUT_SIZE;
-const float LUT_BIAS = 0.5/LUT_SIZE;
-
-//////////////////////////////
-// Structures and functions //
-//////////////////////////////
+const int MAX_AREA_LIGHTS = 6; // maximum number of area lights, maxAreaLights in main.cpp
+layout(std140) uniform AreaLights {
+    vec4 areaLightVerts[MAX_AREA_LIGHTS * 4]; // 4 corners per light, xyz
+    vec4 areaLightUV[MAX_AREA_LIGHTS * 2];    // per light: (uv of corner 0, u axis), (v axis, layer, 0)
+};
+
+#include "ltc.glsl"
+#include "gamma.glsl"
+#include "directionalLight.glsl"
+
+#if TEXTURED_LIGHT
+
+//////////////////////////////////////
+// Textured area lights (LTC + map) //
+//////////////////////////////////////
+
+uniform sampler2DArray areaLightTex; // one prefiltered layer per light
+uniform float areaLightFilterScale; // footprint of the filter per unit of distance to the light plane
+const float AREA_LIGHT_BORDER = 0.125; // padding around the light in areaLightTex, see lightPrefilter.h
 
 // Structure for holding transformed light data.
 struct TransformedLight {
-    vec3 center;         // Transformed light center in cosine space.
-    vec3 right;          // Transformed "right" vector (texture u-axis).
-    vec3 up;             // Transformed "up" vector (texture v-axis).
-    float area;          // Area of the transformed light polygon.
-    mat3 Minv;           // Inverse LTC matrix after basis alignment.
     vec3 transformedLight[4];  // Transformed light corner vectors.
+    vec3 corner[4];      // Unnormalized corners in cosine space, for the texture lookup.
 };
 
-// same as altTessShader.frag
-// Approximate edge integral (replacing acos with a rational function)
-vec3 integrateEdgeVec(vec3 v1, vec3 v2){
-    float x = dot(v1, v2);
-    float y = abs(x);
-    float a = 0.8543985 + (0.4965155 + 0.0145206*y)*y;
-    float b = 3.4175940 + (4.1616724 + y)*y;
-    float v = a / b;
-    float theta_sintheta = (x > 0.0) 
-        ? v 
-        : 0.5 * inversesqrt(max(1.0 - x*x, 1e-7)) - v;
-    return cross(v1, v2) * theta_sintheta;
-}
-
-/// Evaluate the transformed light for an area light using the inverse matrix.
+/// Evaluate the transformed light for an area light using the aligned inverse matrix.
 /// : Transforming light corner directions into the
 /// cosine configuration.
-TransformedLight evaluateTransLight(vec3 N, vec3 V, vec3 P, mat3 Minv){
+/// lightNum: the index of the area light
+TransformedLight evaluateTransLight(int lightNum, vec3 P, mat3 newMinv){
     TransformedLight transLight;
 
-    // Orthonormal basis around the surface normal N.
-    vec3 T1 = normalize(V - N * dot(V, N));
-    vec3 T2 = cross(N, T1);
-
-    // Transformation matrix aligning the LTC space with (T1, T2, N).
-    mat3 newMinv = Minv * transpose(mat3(T1, T2, N));
-
-    // Transform each of the area lights corners into cosine space.
-    // Using areaLight4Corners (assumed provided in world-space order).
+    // Transform each of the area light's corners into cosine space.
+    // The corners are in bottom left, bottom right, top right, top left order.
     for (int i = 0; i < 4; i++) {
-        transLight.transformedLight[i] = normalize(newMinv * (areaLight4Corners[i] - P));
+        transLight.corner[i] = newMinv * (areaLightVerts[lightNum * 4 + i].xyz - P);
+        transLight.transformedLight[i] = normalize(transLight.corner[i]);
     }
 
-    // Compute the center and basis vectors.
-    transLight.center = (transLight.transformedLight[0] +
-                         transLight.transformedLight[1] +
-                         transLight.transformedLight[2] +
-                         transLight.transformedLight[3]) / 4.0;
-    transLight.right = normalize(transLight.transformedLight[1] - transLight.transformedLight[0]);
-    transLight.up    = normalize(transLight.transformedLight[3] - transLight.transformedLight[0]);
-    transLight.area  = length(transLight.transformedLight[1] - transLight.transformedLight[0]) *
-                       length(transLight.transformedLight[3] - transLight.transformedLight[0]);
-    transLight.Minv = newMinv;
-
     return transLight;
 }
 
 // Integrate LTC over the light polygon. This approximates the highlight strength.
 // modified from: https://learnopengl.com/Guest-Articles/2022/Area-Lights
-float integrateLTC(TransformedLight transLight, vec3 P) {
+float integrateLTC(TransformedLight transLight) {
     // Compute light polygon normal in cosine space.
     vec3 lightNormal = cross(transLight.transformedLight[1] - transLight.transformedLight[0],
                              transLight.transformedLight[3] - transLight.transformedLight[0]);
@@ -105,7 +109,7 @@ float integrateLTC(TransformedLight transLight, vec3 P) {
     if(dot(transLight.transformedLight[0], lightNormal) < 0.0) {
         return 0.0;
     }
-    
+
     // Sum the edge integration contributions.
     vec3 vSum = vec3(0.0);
     vSum += integrateEdgeVec(transLight.transformedLight[0], transLight.transformedLight[1]);
@@ -121,65 +125,173 @@ float integrateLTC(TransformedLight transLight, vec3 P) {
     // z component of vSum (corresponds roughly to the clamped cosine)
     float z = vSum.z / len;
 
-    vec2 lookupUV = vec2(z * 0.5 + 0.5, clamp(len, 0.0, 1.0));
+    // Clip the equivalent sphere against the horizon.
+    return integrateClippedSphere(len, z);
+}
+
+// Fetch the prefiltered texture of light lightNum for the transformed light.
+// The lookup point is the orthogonal projection of the shading point onto the
+// light plane in cosine space, and the mip level grows with the distance to the
+// plane relative to the light size, so the Gaussian chain matches the width of
+// the cosine lobe. Same math as prefilteredLookup() in lightPrefilter.h.
+vec3 fetchLightTexture(TransformedLight transLight, int lightNum) {
+    vec3 p1 = transLight.corner[0];
+    vec3 V1 = transLight.corner[1] - p1; // texture u-axis
+    vec3 V2 = transLight.corner[3] - p1; // texture v-axis
+
+    vec3 planeOrtho = cross(V1, V2);
+    float planeAreaSquared = dot(planeOrtho, planeOrtho);
+    float planeDistxPlaneArea = dot(planeOrtho, p1);
+    vec3 P = planeDistxPlaneArea * planeOrtho / planeAreaSquared - p1;
+
+    // coordinates of the projected point in the (V1, V2) frame
+    float dot_V1_V2 = dot(V1, V2);
+    float inv_dot_V1_V1 = 1.0 / dot(V1, V1);
+    vec3 V2_ = V2 - V1 * dot_V1_V2 * inv_dot_V1_V1;
+    vec2 Puv;
+    Puv.y = dot(V2_, P) / dot(V2_, V2_);
+    Puv.x = dot(V1, P) * inv_dot_V1_V1 - dot_V1_V2 * inv_dot_V1_V1 * Puv.y;
+
+    // distance to the plane, normalized by the light size
+    float d = abs(planeDistxPlaneArea) / pow(planeAreaSquared, 0.75);
+
+    // the light's own layer, mapped through its texture coordinates
+    vec4 uvU = areaLightUV[lightNum * 2];
+    vec4 uvV = areaLightUV[lightNum * 2 + 1];
+    vec2 uv = uvU.xy + Puv.x * uvU.zw + Puv.y * uvV.xy;
+    uv = AREA_LIGHT_BORDER + (1.0 - 2.0 * AREA_LIGHT_BORDER) * uv;
+
+    float innerSize = float(textureSize(areaLightTex, 0).x) * (1.0 - 2.0 * AREA_LIGHT_BORDER);
+    float lod = log2(max(areaLightFilterScale * d * innerSize, 1e-6));
+    return textureLod(areaLightTex, vec3(uv, uvV.z), lod).rgb;
+}
 
-    // Map lookup UV into the textures coordinate system.
-    lookupUV = lookupUV * LUT_SCALE + LUT_BIAS;
+// Light of the area lights: the parts added to the diffuse and the specular
+// light of the directional light, and the light without the directional light.
+// Minv: the LTC matrix, t2: the second layer of the look up table
+void areaLights(vec3 N, vec3 V, vec3 P, mat3 Minv, vec4 t2, out vec3 diffuse, out vec3 specular, out vec3 alone) {
+    // Align the LTC space with the shading frame once for all lights.
+    mat3 alignedMinv = Minv * shadingBasis(N, V);
+
+    // LTC integration and texture sampling, per light.
+    vec3 ltc_spec = vec3(0.0);
+    float ltcStrength = 0.0;
+    for (int i = 0; i < NUM_LIGHTS; i++) {
+        // Transformed Light (Cosine)
+        TransformedLight tlight = evaluateTransLight(i, P, alignedMinv);
+        float lightStrength = integrateLTC(tlight);
+        if (lightStrength > 0.0) {
+            // Area light's texture color, skipped for lights facing away.
+            ltc_spec += lightStrength * fetchLightTexture(tlight, i);
+            ltcStrength += lightStrength;
+        }
+    }
+    vec3 ltc_diff = ltcStrength * baseColor * 2;
 
-    // The scaling factor from the LTC2 texture.
-    float scale = texture(ltc2, lookupUV).w;
-    return len * scale;
+    diffuse = toSRGB(ltc_diff) * 3.0;
+    specular = toSRGB(ltc_spec) * 10.0;
+    alone = diffuse + specular;
 }
 
-////////////////////////////
-// Texture mapping helper //
-////////////////////////////
+#else
 
-// Compute texture coordinates via an orthonormal projection
-// which ensures that the average direction is well-defined.
-vec2 computeTransUV(TransformedLight transLight) {
+///////////////////////////////////
+// Plain area lights (LTC + GGX) //
+///////////////////////////////////
 
-    // Transform the fragment position relative to the light center into cosine space.
-    vec3 fragP_cosine = transLight.Minv * (fragPos - transLight.center);
+/// calculate for 1 area light source
+/// modified function from https://learnopengl.com/Guest-Articles/2022/Area-Lights
+/// lightNum: the index of the area light source
+/// Minv: the LTC matrix already rotated into the (T1, T2, N) basis, see shadingBasis()
+vec3 evaluateLTC(int lightNum, vec3 P, mat3 Minv){
 
-    // The light plane normal from the transformed basis vectors.
-    vec3 planeNormal = cross(transLight.right, transLight.up);
+    vec3 L[4]; // non transformed light vectors
+    vec3 transformedLight[4];
+    int index = lightNum * 4;
+    for (int i = 0; i < 4; i++){
+        L[i] = areaLightVerts[index + i].xyz;
+        transformedLight[i] = normalize(Minv * (L[i] - P));
+    }
 
-    // Project the fragment point onto the light plane.
-    vec3 projected = fragP_cosine - planeNormal * dot(fragP_cosine, planeNormal);
+    vec3 dir = L[0] - P; // direction from light to surface
+    vec3 lightNormal = cross(L[1] - L[0], L[3] - L[0]); // light normal
+    bool behind = (dot(dir, lightNormal) < 0.0); // check if the light is behind the surface
+    if(behind){
+        return vec3(0.0); // if the light is behind the surface, return 0
+    }
 
-    float u = dot(projected, transLight.right);
-    float v = dot(projected, transLight.up);
+    // integrate the edge of the light
+    vec3 vSum = vec3(0.0);
+    vSum += integrateEdgeVec(transformedLight[0], transformedLight[1]);
+    vSum += integrateEdgeVec(transformedLight[1], transformedLight[2]);
+    vSum += integrateEdgeVec(transformedLight[2], transformedLight[3]);
+    vSum += integrateEdgeVec(transformedLight[3], transformedLight[0]);
 
-    // Map from the expected range of [-1,1] to [0,1]
-    u = clamp(u * 0.5 + 0.5, 0.0, 1.0);
-    v = clamp(v * 0.5 + 0.5, 0.0, 1.0);
-    
-    // Bilinear interpolation between the precomputed texture corners.
-    vec2 bottom = mix(areaLightTexCorners[0], areaLightTexCorners[1], u);
-    vec2 top    = mix(areaLightTexCorners[3], areaLightTexCorners[2], u);
-    return mix(bottom, top, v);
-}
+    // form factor of the polygon in direction vsum
+    float len = length(vSum);
+    if (len < 1e-7) {
+        return vec3(0.0);
+    }
 
-// Compute a simple LOD value based on the distance from the fragment to the light center.
-float computeLOD(vec3 P, vec3 lightCenter, float polygonArea) {
-    float distanceToLight = length(P - lightCenter);
-    float sigma = sqrt((distanceToLight * distanceToLight) / (2.0 * polygonArea));
-    return sigma;
+    float z = vSum.z/len;
+
+    float sum = integrateClippedSphere(len, z);
+
+    // Outgoing radiance (solid angle) for the entire polygon
+    return vec3(sum);
 }
 
-///////////////////////////////////////
-// Gamma correction helper functions //
-///////////////////////////////////////
-// source: https://learnopengl.com/Advanced-Lighting/Gamma-Correction
+// Light of the area lights: the parts added to the diffuse and the specular
+// light of the directional light, and the light without the directional light.
+// Minv: the LTC matrix, t2: the second layer of the look up table
+void areaLights(vec3 N, vec3 V, vec3 P, mat3 Minv, vec4 t2, out vec3 diffuse, out vec3 specular, out vec3 alone) {
+    vec3 mDiffuse = vec3(0.74f, 0.83f, 0.96f);
+    vec3 mSpecular = vec3(0.25f, 0.25f, 0.25f);
+    vec3 areaLight_color = vec3(1.0);
+
+    // rotate area lights in (T1, T2, N) basis, once for all lights
+    mat3 basis = shadingBasis(N, V);
+    mat3 specMinv = Minv * basis;
+
+    vec3 ltc_spec = vec3(0.0);
+    vec3 ltc_diffuse = vec3(0.0);
+    for (int i = 0; i < NUM_LIGHTS; i++){
+        // For specular, use the LTC matrix.
+        ltc_spec += evaluateLTC(i, P, specMinv) * areaLight_color;
+        // For diffuse, use an identity matrix.
+        ltc_diffuse += evaluateLTC(i, P, basis) * areaLight_color;
+    }
 
-vec3 powVec3(vec3 v, float p) {
-    return vec3(pow(v.x, p), pow(v.y, p), pow(v.z, p));
+    // GGX BRDF shadowing and Fresnel
+    // t2.x: shadowedF90 (F90 normally it should be 1.0)
+    // t2.y: Smith function for Geometric Attenuation Term, it is dot(V or L, H).
+    ltc_spec *= mSpecular * t2.x + (vec3(1.0) - mSpecular) * t2.y;
+    ltc_diffuse *= mDiffuse;
+
+    diffuse = toSRGB(ltc_diffuse);
+    specular = toSRGB(ltc_spec);
+    alone = toSRGB(10 * (ltc_spec + ltc_diffuse));
 }
-const float gamma = 2.2;
 
-vec3 toSRGB(vec3 v)   {
-    return powVec3(v, 1.0 / gamma); 
+#endif
+
+// Roughness of the water surface for the LTC lookup.
+// The base roughness is widened by the slope variance of the waves the
+// tessellation filtered out, and by the shortening of the interpolated normal
+// (Toksvig), so distant highlights stay stable instead of aliasing.
+float waterRoughness() {
+    float normalLength = max(length(fragNormal), 1e-4);
+    float toksvig = (1.0 - normalLength) / normalLength;
+    float alpha = baseRoughness * baseRoughness;
+    float alphaSqr = alpha * alpha + fragSlopeVariance + toksvig;
+    return clamp(sqrt(sqrt(alphaSqr)), 0.0, 1.0); // the table is indexed by sqrt(alpha)
+}
+
+// Coverage of the triangle edges, about a pixel wide across the two triangles
+// of an edge: 1 on the edge, 0 inside.
+float triangleEdge() {
+    vec3 distance = fragBarycentric / max(fwidth(fragBarycentric), vec3(1e-6)); // in pixels
+    return 1.0 - smoothstep(0.0, 0.75, min(min(distance.x, distance.y), distance.z));
 }
 
 //////////////////////////////////////
@@ -197,80 +309,57 @@ void main() {
 
     // LTC BRDF Setup
     float dotNV = clamp(dot(N, V), 0.0, 1.0);
-    vec2 uv_sample = vec2(0.2, sqrt(1.0 - dotNV));
-
-    uv_sample = uv_sample * LUT_SCALE + LUT_BIAS;
-    vec4 t1 = texture(ltc1, uv_sample);
-    vec4 t2 = texture(ltc2, uv_sample);
-    
-    // LTC inverse matrix from lookup data.
-    mat3 Minv = mat3(vec3(t1.x, 0.0, t1.y),
-                     vec3(0.0  , 1.0, 0.0),
-                     vec3(t1.z, 0.0, t1.w));
-
-    // Transformed Light (Cosine) 
-    TransformedLight tlight = evaluateTransLight(N, V, P, Minv);
-
-    // LTC integration and texture sampling.
-
-    // UV coordinates via the cosine projection.
-    vec2 uv = computeTransUV(tlight);
-    
-    // Level of Detail
-    float sigma = sqrt((length(P - tlight.center)*length(P - tlight.center)) / (2.0 * tlight.area));
-    float lod = log2(sigma * float(textureSize(areaLightTex, 0).x) / tlight.area);
-
-    // Area lights texture color.
-    vec3 lightTexColor = textureLod(areaLightTex, uv, lod).rgb;
-    
-    float ltcStrength = integrateLTC(tlight, P);
-    
-    vec3 ltc_spec = ltcStrength * lightTexColor;
-    vec3 ltc_diff = ltcStrength * baseColor * 2;
-    
+    float roughness = waterRoughness();
+    vec2 uv_sample = vec2(roughness, sqrt(1.0 - dotNV));
+
+    // split-sum BRDF weight of the reflection, also used by the reflection pass
+    vec2 envBrdf = texture(envBrdfLut, vec2(dotNV, roughness)).rg;
+    float envWeight = waterF0 * envBrdf.x + envBrdf.y;
+    gbufferNormal = vec4(N, roughness);
+    gbufferReflection = vec4(0.0, 0.0, 0.0, envWeight);
+
+    uv_sample = ltcLutCoord(uv_sample);
+    vec4 t1 = texture(ltcLut, vec3(uv_sample, 0.0));
+    vec4 t2 = texture(ltcLut, vec3(uv_sample, 1.0));
+
+    vec3 areaDiffuse, areaSpecular, areaAlone;
+    areaLights(N, V, P, ltcInverse(t1), t2, areaDiffuse, areaSpecular, areaAlone);
+
     ////////////////////////
     // Directional lights //
     ////////////////////////
 
-    if (isDirectionalLight == 1) {
-        // Compute standard directional lighting (diffuse + specular).
-        float dirLightIntensity = constLightIntensity;
-        vec3 dirLightCol = lightColor;
-        float dirCosTheta = max(dot(N, normalize(-lightDir)), 0.0);
-        vec3 dirDiffuse = dirLightCol * dirCosTheta * baseColor;
-    
-        vec3 dirW = normalize(-lightDir);
-        vec3 h = normalize(dirW + V);
-        float dirCosPhi = max(dot(N, h), 0.0);
-        float dirAlpha = constShininess;
-        vec3 dirSpecReflCol = vec3(0.8);
-        vec3 dirSpecular = dirLightCol * dirSpecReflCol * pow(dirCosPhi, dirAlpha);
-    
-        vec3 dirAmbientCol = baseColor * 0.5;
-        float dirAmbientLight = constAmbientLight;
-        vec3 dirResult = dirLightIntensity * (dirDiffuse + dirSpecular)
-                        + dirAmbientLight * dirAmbientCol;
-    
-        // Environment map contribution.
-        vec3 reflection = reflect(V, N);
-        vec3 envCol = texture(env, reflection).rgb;
-        float envRatio = 0.7;
-        vec3 envResult = envCol * envRatio;
-        dirResult = (1.0 - envRatio) * dirResult + envResult;
-    
+    if (DIRECTIONAL != 0) {
+        vec3 dirDiffuse, dirSpecular;
+        directionalLight(N, V, baseColor, dirDiffuse, dirSpecular);
+        vec3 dirAmbientCol = skyAmbient(N, baseColor);
+
+        // Environment map contribution: the level prefiltered for the
+        // roughness of the water, weighted by the split-sum BRDF.
+        vec3 reflection = reflect(-V, N);
+        vec3 envCol = textureLod(env, reflection, roughness * envMaxLod).rgb;
+        vec3 envSpecular = envCol * envWeight;
+        if (ENV_REFLECT == 0) {
+            // screen space reflections replace it where they hit
+            gbufferReflection.rgb = envSpecular;
+            envSpecular = vec3(0.0);
+        }
+
         // Combine the LTC contribution with the directional light result.
-        vec3 combDiffuse = dirDiffuse + toSRGB(ltc_diff) * 3.0;
-        vec3 combSpecular = dirSpecular + toSRGB(ltc_spec) * 10.0;
-        vec3 combResult = dirLightIntensity * (combDiffuse + combSpecular)
-                          + dirAmbientLight * dirAmbientCol;
-    
+        vec3 combDiffuse = dirDiffuse + areaDiffuse;
+        vec3 combSpecular = dirSpecular + areaSpecular + envSpecular;
+        vec3 combResult = constLightIntensity * (combDiffuse + combSpecular)
+                          + constAmbientLight * dirAmbientCol;
+
         color = vec4(combResult, 1.0);
     }
     else {
-        vec3 diffuseTot = toSRGB(ltc_diff) * 3.0;
-        vec3 specTot = toSRGB(ltc_spec) * 10.0;
-        vec3 ltc_result = diffuseTot + specTot;
+        color = vec4(areaAlone, 1.0);
+    }
 
-        color = vec4(ltc_result, 1);
+    if (showTriangulation == 1) {
+        float edge = triangleEdge();
+        color.rgb = mix(color.rgb, vec3(0.5, 0.6, 0.8), edge);
+        gbufferReflection *= 1.0 - edge; // no reflection on the lines
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,343 @@
+// --------------------------------------------------------------------------------
+// On-disk cache of GPU ready textures.
+//
+// Decoding the PNGs, filtering the mip chains and letting the driver compress
+// them is done once. The result is stored as a KTX 1.1 file holding every mip
+// level in the exact format of the GL texture (for example DXT1, or RGBA8 when
+// compression is off), so later runs memory-map the file and hand the levels
+// straight to glCompressedTexImage / glTexImage.
+//
+// Files are named after a hash of the key, which combines the source paths,
+// their modification times and the options the texture was built with. The key
+// is also stored in the file and compared on load, so a stale or colliding file
+// is simply a miss.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <direct.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+const uint32_t KTX_ENDIANNESS = 0x04030201;
+const char* const TEXTURE_CACHE_KEY_NAME = "textureCache.key";
+
+/// <summary>
+/// The KTX 1.1 file header.
+/// </summary>
+struct KTXHeader {
+	unsigned char identifier[12];
+	uint32_t endianness;
+	uint32_t glType;				// 0 for compressed textures
+	uint32_t glTypeSize;
+	uint32_t glFormat;				// 0 for compressed textures
+	uint32_t glInternalFormat;
+	uint32_t glBaseInternalFormat;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t numberOfArrayElements;	// 0 if not an array texture
+	uint32_t numberOfFaces;			// 6 for cube maps, otherwise 1
+	uint32_t numberOfMipmapLevels;
+	uint32_t bytesOfKeyValueData;
+};
+
+/// <summary>
+/// A read only memory mapped file.
+/// </summary>
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { Close(); }
+
+	/// <summary>
+	/// Maps the whole file, returns false if it does not exist or is empty.
+	/// </summary>
+	bool Open(const std::string& filename) {
+		Close();
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+			Close();
+			return false;
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		bytes = mapping ? static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+		length = size_t(fileSize.QuadPart);
+#else
+		int descriptor = open(filename.c_str(), O_RDONLY);
+		if (descriptor < 0) {
+			return false;
+		}
+		struct stat info;
+		if (fstat(descriptor, &info) != 0 || info.st_size == 0) {
+			close(descriptor);
+			return false;
+		}
+		void* address = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+		close(descriptor);
+		bytes = address == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(address);
+		length = size_t(info.st_size);
+#endif
+		if (!bytes) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Unmaps the file.
+	/// </summary>
+	void Close() {
+#ifdef _WIN32
+		if (bytes) UnmapViewOfFile(bytes);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (bytes) munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+		bytes = nullptr;
+		length = 0;
+	}
+
+	const unsigned char* Data() const { return bytes; }
+	size_t Size() const { return length; }
+
+private:
+	const unsigned char* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+/// <summary>
+/// The format and size of a cached texture.
+/// </summary>
+struct TextureCacheDesc {
+	uint32_t internalFormat = 0;
+	uint32_t format = 0;	// 0 for compressed formats
+	uint32_t type = 0;		// 0 for compressed formats
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t layers = 0;	// array layers, 0 if not an array texture
+	uint32_t faces = 1;		// 6 for cube maps
+	uint32_t levels = 0;
+};
+
+/// <summary>
+/// A texture loaded from the cache. The level data points into the mapped file.
+/// </summary>
+struct CachedTexture {
+	TextureCacheDesc desc;
+	std::vector<const unsigned char*> images;	// per level, then per face: the level data (all layers for arrays)
+	std::vector<size_t> imageSizes;				// per level, bytes of one image
+	MappedFile file;
+};
+
+/// <summary>
+/// Returns the modification time of a file, 0 if it does not exist.
+/// </summary>
+inline long long fileModificationTime(const std::string& filename) {
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0) {
+		return 0;
+	}
+	return (long long)info.st_mtime;
+}
+
+/// <summary>
+/// Adds a source file to a cache key: its path and modification time.
+/// </summary>
+inline void addCacheKeySource(std::string& key, const std::string& filename) {
+	key += filename + "@" + std::to_string(fileModificationTime(filename)) + ";";
+}
+
+/// <summary>
+/// Returns the cache file of a key.
+/// </summary>
+inline std::string textureCachePath(const std::string& directory, const std::string& key) {
+	uint64_t hash = 14695981039346656037ull; // FNV-1a
+	for (char c : key) {
+		hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.ktx", (unsigned long long)hash);
+	return directory + "/" + name;
+}
+
+/// <summary>
+/// Loads a texture from the cache.
+/// </summary>
+/// <param name="directory"> the cache directory </param>
+/// <param name="key"> the cache key, see addCacheKeySource() </param>
+/// <param name="texture"> the destination </param>
+/// <returns> true on a cache hit </returns>
+inline bool loadCachedTexture(const std::string& directory, const std::string& key, CachedTexture& texture) {
+	if (!texture.file.Open(textureCachePath(directory, key))) {
+		return false;
+	}
+	const unsigned char* data = texture.file.Data();
+	size_t size = texture.file.Size();
+
+	KTXHeader header;
+	if (size < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.identifier, KTX_IDENTIFIER, 12) != 0 || header.endianness != KTX_ENDIANNESS ||
+		header.numberOfMipmapLevels == 0 || (header.numberOfFaces != 1 && header.numberOfFaces != 6)) {
+		return false;
+	}
+
+	// the key/value data holds the key the file was written for
+	size_t offset = sizeof(header);
+	size_t keyValueEnd = offset + header.bytesOfKeyValueData;
+	if (keyValueEnd > size) {
+		return false;
+	}
+	bool keyMatches = false;
+	while (offset + 4 <= keyValueEnd) {
+		uint32_t pairSize;
+		memcpy(&pairSize, data + offset, 4);
+		if (offset + 4 + pairSize > keyValueEnd) {
+			return false;
+		}
+		std::string pair(reinterpret_cast<const char*>(data + offset + 4), pairSize);
+		size_t split = pair.find('\0');
+		if (split != std::string::npos && pair.compare(0, split, TEXTURE_CACHE_KEY_NAME) == 0) {
+			std::string value = pair.substr(split + 1);
+			keyMatches = value.c_str() == key; // the value is null terminated
+		}
+		offset += 4 + ((pairSize + 3) & ~size_t(3));
+	}
+	if (!keyMatches) {
+		return false;
+	}
+
+	TextureCacheDesc& desc = texture.desc;
+	desc.internalFormat = header.glInternalFormat;
+	desc.format = header.glFormat;
+	desc.type = header.glType;
+	desc.width = header.pixelWidth;
+	desc.height = header.pixelHeight;
+	desc.layers = header.numberOfArrayElements;
+	desc.faces = header.numberOfFaces;
+	desc.levels = header.numberOfMipmapLevels;
+
+	offset = keyValueEnd;
+	texture.images.clear();
+	texture.imageSizes.clear();
+	for (uint32_t level = 0; level < desc.levels; level++) {
+		if (offset + 4 > size) {
+			return false;
+		}
+		uint32_t imageSize;
+		memcpy(&imageSize, data + offset, 4);
+		offset += 4;
+		texture.imageSizes.push_back(imageSize);
+		for (uint32_t face = 0; face < desc.faces; face++) {
+			if (offset + imageSize > size) {
+				return false;
+			}
+			texture.images.push_back(data + offset);
+			offset += (imageSize + 3) & ~size_t(3);
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// Stores a texture in the cache.
+/// </summary>
+/// <param name="directory"> the cache directory, created if needed </param>
+/// <param name="key"> the cache key </param>
+/// <param name="desc"> the texture format </param>
+/// <param name="images"> per level, the data of every face one after the other (all layers for arrays) </param>
+/// <returns> true on success </returns>
+inline bool saveCachedTexture(const std::string& directory, const std::string& key, const TextureCacheDesc& desc,
+	const std::vector<std::vector<unsigned char>>& images) {
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+	std::string filename = textureCachePath(directory, key);
+	std::string temporary = filename + ".tmp";
+	std::ofstream file(temporary, std::ios::binary);
+	if (!file) {
+		std::cerr << "Error: Failed to create texture cache file: " << filename << std::endl;
+		return false;
+	}
+
+	std::string pair = std::string(TEXTURE_CACHE_KEY_NAME) + '\0' + key + '\0';
+	uint32_t pairSize = uint32_t(pair.size());
+	pair.resize((pair.size() + 3) & ~size_t(3), '\0');
+
+	KTXHeader header;
+	memcpy(header.identifier, KTX_IDENTIFIER, 12);
+	header.endianness = KTX_ENDIANNESS;
+	header.glType = desc.type;
+	header.glTypeSize = 1; // bytes, or 1 for compressed formats
+	header.glFormat = desc.format;
+	header.glInternalFormat = desc.internalFormat;
+	header.glBaseInternalFormat = desc.format ? desc.format : 0x1908; // GL_RGBA
+	header.pixelWidth = desc.width;
+	header.pixelHeight = desc.height;
+	header.pixelDepth = 0;
+	header.numberOfArrayElements = desc.layers;
+	header.numberOfFaces = desc.faces;
+	header.numberOfMipmapLevels = desc.levels;
+	header.bytesOfKeyValueData = uint32_t(4 + pair.size());
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(&pairSize), 4);
+	file.write(pair.data(), pair.size());
+
+	const char padding[4] = { 0, 0, 0, 0 };
+	for (const std::vector<unsigned char>& level : images) {
+		uint32_t imageSize = uint32_t(level.size() / desc.faces);
+		file.write(reinterpret_cast<const char*>(&imageSize), 4);
+		for (uint32_t face = 0; face < desc.faces; face++) {
+			file.write(reinterpret_cast<const char*>(level.data()) + size_t(face) * imageSize, imageSize);
+			file.write(padding, (4 - imageSize % 4) % 4);
+		}
+	}
+	file.close();
+	if (!file) {
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	// replace the old file in one step, so an interrupted write is never loaded
+	std::remove(filename.c_str());
+	return std::rename(temporary.c_str(), filename.c_str()) == 0;
+}
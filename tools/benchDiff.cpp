@@ -0,0 +1,109 @@
+// --------------------------------------------------------------------------------
+// Comparison of two flythrough benchmark results (main.cpp --bench).
+//
+// Matches the configurations of both files by name and prints, for every
+// column, the value before, after and the change in percent. Lines starting
+// with # are skipped; the first of them name the path and the renderer, so a
+// comparison across machines shows up in a plain diff of the files instead.
+//
+// usage: benchDiff before.txt after.txt [threshold%]
+// The exit code is 1 if a time got slower by more than the threshold (5% by
+// default), so the comparison can gate a build.
+// --------------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/// <summary>
+/// The columns and the lines of a results file.
+/// </summary>
+struct Results {
+	vector<string> columns;					// the values, without config and frames
+	vector<string> order;					// the configurations in the order of the file
+	map<string, vector<double>> values;
+};
+
+bool readResults(const char* filename, Results& results) {
+	ifstream file(filename);
+	if (!file) {
+		cerr << "Error: Failed to open " << filename << endl;
+		return false;
+	}
+	string line;
+	while (getline(file, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		istringstream fields(line);
+		string name, frames;
+		fields >> name >> frames;
+		vector<string> words;
+		string word;
+		while (fields >> word) {
+			words.push_back(word);
+		}
+		if (name == "config") {
+			results.columns = words;
+			continue;
+		}
+		vector<double>& values = results.values[name];
+		for (const string& w : words) {
+			values.push_back(atof(w.c_str()));
+		}
+		results.order.push_back(name);
+	}
+	if (results.columns.empty()) {
+		cerr << "Error: " << filename << " has no header line" << endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		cerr << "usage: benchDiff before.txt after.txt [threshold%]" << endl;
+		return 2;
+	}
+	double threshold = argc > 3 ? atof(argv[3]) : 5.0;
+	Results before, after;
+	if (!readResults(argv[1], before) || !readResults(argv[2], after)) {
+		return 2;
+	}
+	if (before.columns != after.columns) {
+		cerr << "Error: the files have different columns" << endl;
+		return 2;
+	}
+
+	bool slower = false;
+	for (const string& name : after.order) {
+		auto old = before.values.find(name);
+		if (old == before.values.end()) {
+			printf("%s: only in %s\n", name.c_str(), argv[2]);
+			continue;
+		}
+		printf("%s\n", name.c_str());
+		const vector<double>& a = old->second;
+		const vector<double>& b = after.values[name];
+		for (size_t c = 0; c < before.columns.size() && c < a.size() && c < b.size(); c++) {
+			double change = a[c] != 0.0 ? (b[c] - a[c]) / a[c] * 100.0 : 0.0;
+			bool regressed = change > threshold;
+			slower = slower || regressed;
+			printf("  %-8s %10.3f %10.3f %+8.1f%%%s\n", before.columns[c].c_str(), a[c], b[c], change, regressed ? "  slower" : "");
+		}
+	}
+	for (const string& name : before.order) {
+		if (after.values.find(name) == after.values.end()) {
+			printf("%s: only in %s\n", name.c_str(), argv[1]);
+		}
+	}
+	return slower ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+// --------------------------------------------------------------------------------
+// Benchmark and validation of the GGX prefiltered environment map.
+//
+// Times prefilterEnvironment() (envPrefilter.h, the code run at load time) for
+// several sample and thread counts, then compares every roughness level with the
+// brute force GGX integral over all the texels of the source, along with the box
+// filtered mips the skybox used before (glGenerateMipmap) at the same level.
+//
+// usage: envPrefilterCheck [posx.png negx.png posy.png negy.png posz.png negz.png]
+// without images, a synthetic night sky (stars over a dark gradient) is used.
+// --------------------------------------------------------------------------------
+
+#include <envPrefilter.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef ENV_PREFILTER_CHECK_PNG
+#include <lodepng.h>
+#endif
+
+using namespace std;
+
+/// <summary>
+/// A synthetic night sky: small bright stars and a few moons over a dark vertical gradient.
+/// </summary>
+CubeLevel syntheticSky(int size) {
+	CubeLevel faces;
+	mt19937 rng(11);
+	uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (int f = 0; f < 6; f++) {
+		FilteredLevel& face = faces[f];
+		face.width = face.height = size;
+		face.rgba.resize(size_t(size) * size * 4);
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				float dir[3];
+				cubeDirection(f, (x + 0.5f) / size, (y + 0.5f) / size, dir);
+				float up = dir[1] / sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+				float* p = &face.rgba[(size_t(y) * size + x) * 4];
+				p[0] = 0.05f + 0.1f * max(up, 0.0f);
+				p[1] = 0.05f + 0.15f * max(up, 0.0f);
+				p[2] = 0.15f + 0.3f * max(up, 0.0f);
+				p[3] = 1.0f;
+				if (unit(rng) < 0.01f) {
+					p[0] = p[1] = p[2] = 0.6f + 0.4f * unit(rng);
+				}
+				if ((x / (size / 4) + y / (size / 4) + f) % 7 == 0 && (x % (size / 4)) < size / 16 && (y % (size / 4)) < size / 16) {
+					p[0] = 1.0f; p[1] = 0.9f; p[2] = 0.7f;
+				}
+			}
+		}
+	}
+	return faces;
+}
+
+#ifdef ENV_PREFILTER_CHECK_PNG
+int main(int argc, char* argv[]) {
+#else
+int main() {
+#endif
+	CubeLevel faces;
+#ifdef ENV_PREFILTER_CHECK_PNG
+	if (argc > 6) {
+		for (int f = 0; f < 6; f++) {
+			vector<unsigned char> image;
+			unsigned width, height;
+			unsigned error = lodepng::decode(image, width, height, argv[1 + f]);
+			if (error) {
+				printf("decoder error %u: %s\n", error, lodepng_error_text(error));
+				return 1;
+			}
+			faces[f] = cropLight(image.data(), int(width), 0, 0, int(width), int(height));
+		}
+	}
+#endif
+	if (faces[0].rgba.empty()) {
+		faces = syntheticSky(128);
+	}
+	const int numLevels = 6;
+
+	// convolution time
+	unsigned hardwareThreads = max(1u, thread::hardware_concurrency());
+	printf("face %dx%d, %d levels, %u hardware threads\n", faces[0].width, faces[0].height, numLevels, hardwareThreads);
+	printf("samples  threads  milliseconds\n");
+	for (unsigned samples = 32; samples <= 128; samples *= 2) {
+		for (unsigned threads = 1; threads <= hardwareThreads; threads *= 2) {
+			auto start = chrono::steady_clock::now();
+			prefilterEnvironment(faces, numLevels, samples, threads);
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			printf("%7u  %7u  %12.1f\n", samples, threads, ms);
+		}
+	}
+
+	// quality against the brute force integral, in linear color
+	vector<CubeLevel> chain = prefilterEnvironment(faces, numLevels, 64);
+	CubeLevel linear = faces;
+	vector<CubeLevel> boxChain(1, faces);
+	for (int f = 0; f < 6; f++) {
+		convertGamma(linear[f], 2.2f);
+		convertGamma(boxChain[0][f], 2.2f);
+	}
+	while ((int)boxChain.size() < numLevels) {
+		CubeLevel next;
+		for (int f = 0; f < 6; f++) next[f] = decimate(boxChain.back()[f]);
+		boxChain.push_back(next);
+	}
+	for (int level = 1; level < numLevels; level++) {
+		for (int f = 0; f < 6; f++) convertGamma(chain[level][f], 2.2f);
+	}
+
+	mt19937 rng(5);
+	normal_distribution<float> gaussian;
+	printf("roughness  ggxMeanError  boxMeanError  referenceMean\n");
+	for (int level = 1; level < numLevels; level++) {
+		float roughness = float(level) / (numLevels - 1);
+		double ggxError = 0.0, boxError = 0.0, mean = 0.0;
+		const int numDirections = 64;
+		for (int i = 0; i < numDirections; i++) {
+			float R[3] = { gaussian(rng), gaussian(rng), gaussian(rng) };
+			float length = sqrt(R[0] * R[0] + R[1] * R[1] + R[2] * R[2]);
+			for (int k = 0; k < 3; k++) R[k] /= length;
+			float reference[4], ggx[4], box[4];
+			referenceRadiance(linear, R, roughness * roughness, reference);
+			sampleCube(chain[level], R, ggx);
+			sampleCube(boxChain[level], R, box);
+			for (int k = 0; k < 3; k++) {
+				ggxError += fabs(ggx[k] - reference[k]) / 3.0;
+				boxError += fabs(box[k] - reference[k]) / 3.0;
+				mean += reference[k] / 3.0;
+			}
+		}
+		printf("%9.2f  %12.4f  %12.4f  %13.4f\n", roughness, ggxError / numDirections, boxError / numDirections, mean / numDirections);
+	}
+	return 0;
+}
@@ -0,0 +1,123 @@
+// --------------------------------------------------------------------------------
+// Validates the prefiltered area light lookup against a brute force reference.
+//
+// For random light placements in LTC space, the texture color returned by the
+// prefiltered chain (lightPrefilter.h, same math as the shader) is compared with
+// the clamped cosine weighted average of the unfiltered texture over the light.
+// The error is reported for a range of filter scales so the shader constant
+// (areaLightFilterScale in main.cpp) can be tuned.
+//
+// usage: lightFilterCheck [image.png]
+// without an image, a synthetic high contrast pattern is used.
+// --------------------------------------------------------------------------------
+
+#include <lightPrefilter.h>
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#ifdef LIGHT_FILTER_CHECK_PNG
+#include <lodepng.h>
+#endif
+
+using namespace std;
+
+/// <summary>
+/// A synthetic light: windows of random colors on a dark background.
+/// </summary>
+vector<unsigned char> syntheticLight(int width, int height) {
+	vector<unsigned char> image(size_t(width) * height * 4);
+	mt19937 rng(7);
+	uniform_int_distribution<int> color(40, 255);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			unsigned char* p = &image[(size_t(y) * width + x) * 4];
+			bool window = (x / 8) % 3 != 0 && (y / 12) % 3 != 0;
+			mt19937 cell(unsigned((x / 24) * 131 + (y / 36) * 7919));
+			p[0] = window ? (unsigned char)color(cell) : 10;
+			p[1] = window ? (unsigned char)color(cell) : 10;
+			p[2] = window ? (unsigned char)color(cell) : 20;
+			p[3] = 255;
+		}
+	}
+	return image;
+}
+
+#ifdef LIGHT_FILTER_CHECK_PNG
+int main(int argc, char* argv[]) {
+#else
+int main() {
+#endif
+	vector<unsigned char> image;
+	unsigned width = 256, height = 256;
+
+#ifdef LIGHT_FILTER_CHECK_PNG
+	if (argc > 1) {
+		unsigned error = lodepng::decode(image, width, height, argv[1]);
+		if (error) {
+			printf("decoder error %u: %s\n", error, lodepng_error_text(error));
+			return 1;
+		}
+	}
+#endif
+	if (image.empty()) {
+		image = syntheticLight(int(width), int(height));
+	}
+
+	const int maxSize = 256;
+	FilteredLevel base = createPaddedBase(image.data(), int(width), int(height), maxSize);
+	vector<FilteredLevel> chain = buildPrefilteredChain(base);
+	float innerSize = base.width * (1.0f - 2.0f * AREA_LIGHT_BORDER);
+
+	// the reference integrates the unfiltered light at the working resolution
+	FilteredLevel light;
+	light.width = int(width);
+	light.height = int(height);
+	light.rgba.resize(image.size());
+	for (size_t i = 0; i < image.size(); i++) light.rgba[i] = image[i] / 255.0f;
+
+	// random lights above the horizon, in LTC space
+	struct Config { LightVec3 p1, p2, p4; float reference[4]; };
+	vector<Config> configs;
+	mt19937 rng(1234);
+	uniform_real_distribution<double> unit(0.0, 1.0);
+	while (configs.size() < 200) {
+		double size = 0.2 + 1.8 * unit(rng);
+		LightVec3 center = { 3.0 * unit(rng) - 1.5, 3.0 * unit(rng) - 1.5, 0.1 + 3.0 * unit(rng) };
+		double tilt = 1.2 * unit(rng) - 0.6;
+		LightVec3 axisU = { size, 0.0, 0.0 };
+		LightVec3 axisV = { 0.0, size * cos(tilt), size * sin(tilt) };
+		Config config;
+		config.p1 = { center.x - 0.5 * (axisU.x + axisV.x), center.y - 0.5 * (axisU.y + axisV.y), center.z - 0.5 * (axisU.z + axisV.z) };
+		config.p2 = { config.p1.x + axisU.x, config.p1.y + axisU.y, config.p1.z + axisU.z };
+		config.p4 = { config.p1.x + axisV.x, config.p1.y + axisV.y, config.p1.z + axisV.z };
+		if (min(min(config.p1.z, config.p2.z), config.p4.z) <= 0.05) continue;
+		referenceLightColor(light, config.p1, config.p2, config.p4, 128, config.reference);
+		configs.push_back(config);
+	}
+
+	printf("levels: %zu, base %dx%d\n", chain.size(), base.width, base.height);
+	printf("filterScale  meanAbsError  maxAbsError\n");
+	float bestScale = 0.0f, bestError = 1e9f;
+	for (float scale = 0.05f; scale <= 2.0f; scale *= 1.25f) {
+		double sum = 0.0, worst = 0.0;
+		for (const Config& config : configs) {
+			float u, v, lod, color[4];
+			prefilteredLookup(config.p1, config.p2, config.p4, scale, innerSize, u, v, lod);
+			sampleChain(chain, u, v, lod, color);
+			double error = (fabs(color[0] - config.reference[0]) + fabs(color[1] - config.reference[1]) + fabs(color[2] - config.reference[2])) / 3.0;
+			sum += error;
+			worst = max(worst, error);
+		}
+		double mean = sum / configs.size();
+		printf("%11.3f  %12.4f  %11.4f\n", scale, mean, worst);
+		if (mean < bestError) {
+			bestError = float(mean);
+			bestScale = scale;
+		}
+	}
+	printf("best filterScale %.3f (mean error %.4f)\n", bestScale, bestError);
+	return 0;
+}
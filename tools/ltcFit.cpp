@@ -0,0 +1,545 @@
+// --------------------------------------------------------------------------------
+// Offline fitting tool for the LTC look up tables.
+//
+// Fits a linearly transformed cosine to an isotropic microfacet BRDF for every
+// (roughness, sqrt(1 - cos(theta))) texel, then writes the tables in the binary
+// format read by ltcTable.h. The fitting follows the reference implementation:
+// https://github.com/selfshadow/ltc_code/tree/master/fit
+//
+// usage: ltcFit [--brdf ggx|beckmann] [--size 32|64|128] [--samples n] [--float] output.ltc
+// --------------------------------------------------------------------------------
+
+#include <ltcTable.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+const double PI = 3.14159265358979323846;
+const double MIN_ALPHA = 0.00001;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Vec3 {
+	double x, y, z;
+	Vec3(double x = 0, double y = 0, double z = 0) : x(x), y(y), z(z) {}
+	Vec3 operator+(const Vec3& v) const { return Vec3(x + v.x, y + v.y, z + v.z); }
+	Vec3 operator-(const Vec3& v) const { return Vec3(x - v.x, y - v.y, z - v.z); }
+	Vec3 operator*(double s) const { return Vec3(x * s, y * s, z * s); }
+};
+
+double dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+double length(const Vec3& v) { return sqrt(dot(v, v)); }
+Vec3 normalize(const Vec3& v) { return v * (1.0 / length(v)); }
+Vec3 cross(const Vec3& a, const Vec3& b) { return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+
+/// <summary>
+/// Row major 3x3 matrix: m[row][column].
+/// </summary>
+struct Mat3 {
+	double m[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+
+	Vec3 operator*(const Vec3& v) const {
+		return Vec3(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+			m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+			m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+	}
+	Mat3 operator*(const Mat3& b) const {
+		Mat3 r;
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				r.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+		return r;
+	}
+	double determinant() const {
+		return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+			- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	}
+	Mat3 inverse() const {
+		Mat3 r;
+		double invDet = 1.0 / determinant();
+		r.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * invDet;
+		r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+		r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+		r.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * invDet;
+		r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+		r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+		r.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * invDet;
+		r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+		r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+		return r;
+	}
+	static Mat3 fromColumns(const Vec3& c0, const Vec3& c1, const Vec3& c2) {
+		Mat3 r;
+		r.m[0][0] = c0.x; r.m[0][1] = c1.x; r.m[0][2] = c2.x;
+		r.m[1][0] = c0.y; r.m[1][1] = c1.y; r.m[1][2] = c2.y;
+		r.m[2][0] = c0.z; r.m[2][1] = c1.z; r.m[2][2] = c2.z;
+		return r;
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// <summary>
+/// An isotropic microfacet BRDF with Smith height-correlated masking.
+/// eval returns brdf * cos(theta_l) and the pdf of sample().
+/// </summary>
+struct Brdf {
+	virtual ~Brdf() {}
+	virtual double D(double cosThetaH, double alpha) const = 0;
+	virtual double lambda(double cosTheta, double alpha) const = 0;
+	virtual double sampleTan2(double u, double alpha) const = 0;
+
+	double eval(const Vec3& V, const Vec3& L, double alpha, double& pdf) const {
+		if (V.z <= 0 || L.z <= 0) {
+			pdf = 0;
+			return 0;
+		}
+		Vec3 halfVector = V + L;
+		if (dot(halfVector, halfVector) <= 0) {
+			pdf = 0;
+			return 0;
+		}
+		Vec3 H = normalize(halfVector);
+		double d = D(H.z, alpha);
+		double G2 = 1.0 / (1.0 + lambda(V.z, alpha) + lambda(L.z, alpha));
+		pdf = fabs(d * H.z / (4.0 * dot(V, H)));
+		return d * G2 / (4.0 * V.z);
+	}
+
+	Vec3 sample(const Vec3& V, double alpha, double u1, double u2) const {
+		double phi = 2.0 * PI * u1;
+		double cosTheta = 1.0 / sqrt(1.0 + sampleTan2(u2, alpha));
+		double sinTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta));
+		Vec3 H(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+		return H * (2.0 * dot(V, H)) - V;
+	}
+};
+
+struct BrdfGGX : Brdf {
+	double D(double cosThetaH, double alpha) const override {
+		if (cosThetaH <= 0) return 0;
+		double a2 = alpha * alpha;
+		double t = cosThetaH * cosThetaH * (a2 - 1.0) + 1.0;
+		return a2 / (PI * t * t);
+	}
+	double lambda(double cosTheta, double alpha) const override {
+		double tan2 = (1.0 - cosTheta * cosTheta) / (cosTheta * cosTheta);
+		return 0.5 * (-1.0 + sqrt(1.0 + alpha * alpha * tan2));
+	}
+	double sampleTan2(double u, double alpha) const override {
+		return alpha * alpha * u / max(1.0 - u, 1e-12);
+	}
+};
+
+struct BrdfBeckmann : Brdf {
+	double D(double cosThetaH, double alpha) const override {
+		if (cosThetaH <= 0) return 0;
+		double c2 = cosThetaH * cosThetaH;
+		double tan2 = (1.0 - c2) / c2;
+		return exp(-tan2 / (alpha * alpha)) / (PI * alpha * alpha * c2 * c2);
+	}
+	double lambda(double cosTheta, double alpha) const override {
+		double tanTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta)) / cosTheta;
+		if (tanTheta <= 0) return 0;
+		double a = 1.0 / (alpha * tanTheta);
+		if (a >= 1.6) return 0;
+		return (1.0 - 1.259 * a + 0.396 * a * a) / (3.535 * a + 2.181 * a * a);
+	}
+	double sampleTan2(double u, double alpha) const override {
+		return -alpha * alpha * log(max(1.0 - u, 1e-12));
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// <summary>
+/// A linearly transformed cosine: D(L) = D_o(invM L / |invM L|) / Jacobian.
+/// The fitted parameters are m11, m22 and m13 in the (X, Y, Z) frame.
+/// </summary>
+struct LTC {
+	double magnitude = 1;
+	double m11 = 1, m22 = 1, m13 = 0;
+	Vec3 X = Vec3(1, 0, 0), Y = Vec3(0, 1, 0), Z = Vec3(0, 0, 1);
+	Mat3 M, invM;
+	double detM = 1;
+
+	void update() {
+		Mat3 params;
+		params.m[0][0] = m11;
+		params.m[0][2] = m13;
+		params.m[1][1] = m22;
+		M = Mat3::fromColumns(X, Y, Z) * params;
+		invM = M.inverse();
+		detM = fabs(M.determinant());
+	}
+
+	double eval(const Vec3& L) const {
+		Vec3 original = normalize(invM * L);
+		Vec3 transformed = M * original;
+		double l = length(transformed);
+		double jacobian = detM / (l * l * l);
+		double d = max(0.0, original.z) / PI;
+		return magnitude * d / jacobian;
+	}
+
+	Vec3 sample(double u1, double u2) const {
+		double theta = acos(sqrt(u1));
+		double phi = 2.0 * PI * u2;
+		return normalize(M * Vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta)));
+	}
+};
+
+/// <summary>
+/// Computes the BRDF norm, the Fresnel term integral and the average direction.
+/// </summary>
+void computeAvgTerms(const Brdf& brdf, const Vec3& V, double alpha, int samples, double& norm, double& fresnel, Vec3& averageDir) {
+	norm = 0;
+	fresnel = 0;
+	averageDir = Vec3();
+
+	for (int j = 0; j < samples; j++) {
+		for (int i = 0; i < samples; i++) {
+			double u1 = (i + 0.5) / samples;
+			double u2 = (j + 0.5) / samples;
+			Vec3 L = brdf.sample(V, alpha, u1, u2);
+
+			double pdf;
+			double value = brdf.eval(V, L, alpha, pdf);
+			if (pdf > 0) {
+				double weight = value / pdf;
+				Vec3 H = normalize(V + L);
+				norm += weight;
+				fresnel += weight * pow(1.0 - max(dot(V, H), 0.0), 5.0);
+				averageDir = averageDir + L * weight;
+			}
+		}
+	}
+
+	double count = double(samples) * samples;
+	norm /= count;
+	fresnel /= count;
+
+	// the average direction lives in the plane of V (y = 0) for isotropic BRDFs
+	averageDir.y = 0;
+	averageDir = normalize(averageDir);
+}
+
+/// <summary>
+/// The error between the BRDF and the LTC, using multiple importance sampling.
+/// </summary>
+double computeError(const LTC& ltc, const Brdf& brdf, const Vec3& V, double alpha, int samples) {
+	double error = 0;
+
+	for (int j = 0; j < samples; j++) {
+		for (int i = 0; i < samples; i++) {
+			double u1 = (i + 0.5) / samples;
+			double u2 = (j + 0.5) / samples;
+
+			// importance sample the LTC
+			{
+				Vec3 L = ltc.sample(u1, u2);
+				double pdfBrdf;
+				double evalBrdf = brdf.eval(V, L, alpha, pdfBrdf);
+				double evalLTC = ltc.eval(L);
+				double pdfLTC = evalLTC / ltc.magnitude;
+				double e = fabs(evalBrdf - evalLTC);
+				if (pdfLTC + pdfBrdf > 0) {
+					error += e * e * e / (pdfLTC + pdfBrdf);
+				}
+			}
+			// importance sample the BRDF
+			{
+				Vec3 L = brdf.sample(V, alpha, u1, u2);
+				double pdfBrdf;
+				double evalBrdf = brdf.eval(V, L, alpha, pdfBrdf);
+				double evalLTC = ltc.eval(L);
+				double pdfLTC = evalLTC / ltc.magnitude;
+				double e = fabs(evalBrdf - evalLTC);
+				if (pdfLTC + pdfBrdf > 0) {
+					error += e * e * e / (pdfLTC + pdfBrdf);
+				}
+			}
+		}
+	}
+
+	return error / (double(samples) * samples);
+}
+
+/// <summary>
+/// Applies the fitted parameters to the LTC.
+/// </summary>
+void applyParams(LTC& ltc, const double* params, bool isotropic) {
+	double m11 = max(params[0], 1e-7);
+	double m22 = max(params[1], 1e-7);
+	double m13 = params[2];
+
+	if (isotropic) {
+		ltc.m11 = m11;
+		ltc.m22 = m11;
+		ltc.m13 = 0;
+	}
+	else {
+		ltc.m11 = m11;
+		ltc.m22 = m22;
+		ltc.m13 = m13;
+	}
+	ltc.update();
+}
+
+/// <summary>
+/// Downhill simplex minimization of the fitting error over (m11, m22, m13).
+/// </summary>
+void fitNelderMead(LTC& ltc, const Brdf& brdf, const Vec3& V, double alpha, int samples, bool isotropic) {
+	const int DIM = 3;
+	const int MAX_ITERATIONS = 100;
+	const double DELTA = 0.05;
+	const double TOLERANCE = 1e-5;
+
+	auto error = [&](const double* p) {
+		LTC trial = ltc;
+		applyParams(trial, p, isotropic);
+		return computeError(trial, brdf, V, alpha, samples);
+	};
+
+	double simplex[DIM + 1][DIM];
+	double values[DIM + 1];
+	double start[DIM] = { ltc.m11, ltc.m22, ltc.m13 };
+	for (int i = 0; i <= DIM; i++) {
+		for (int j = 0; j < DIM; j++) {
+			simplex[i][j] = start[j] + (i == j + 1 ? DELTA : 0.0);
+		}
+		values[i] = error(simplex[i]);
+	}
+
+	for (int iteration = 0; iteration < MAX_ITERATIONS; iteration++) {
+		// order the vertices
+		int order[DIM + 1] = { 0, 1, 2, 3 };
+		sort(order, order + DIM + 1, [&](int a, int b) { return values[a] < values[b]; });
+		int best = order[0];
+		int worst = order[DIM];
+		int secondWorst = order[DIM - 1];
+
+		if (fabs(values[worst] - values[best]) <= TOLERANCE * (fabs(values[worst]) + fabs(values[best])) + 1e-30) {
+			break;
+		}
+
+		double centroid[DIM] = { 0, 0, 0 };
+		for (int i = 0; i <= DIM; i++) {
+			if (i == worst) continue;
+			for (int j = 0; j < DIM; j++) centroid[j] += simplex[i][j] / DIM;
+		}
+
+		auto along = [&](double t, double* out) {
+			for (int j = 0; j < DIM; j++) out[j] = centroid[j] + t * (simplex[worst][j] - centroid[j]);
+		};
+
+		double reflected[DIM];
+		along(-1.0, reflected);
+		double reflectedValue = error(reflected);
+
+		if (reflectedValue < values[best]) {
+			double expanded[DIM];
+			along(-2.0, expanded);
+			double expandedValue = error(expanded);
+			bool useExpanded = expandedValue < reflectedValue;
+			for (int j = 0; j < DIM; j++) simplex[worst][j] = useExpanded ? expanded[j] : reflected[j];
+			values[worst] = useExpanded ? expandedValue : reflectedValue;
+			continue;
+		}
+		if (reflectedValue < values[secondWorst]) {
+			for (int j = 0; j < DIM; j++) simplex[worst][j] = reflected[j];
+			values[worst] = reflectedValue;
+			continue;
+		}
+
+		double contracted[DIM];
+		along(reflectedValue < values[worst] ? -0.5 : 0.5, contracted);
+		double contractedValue = error(contracted);
+		if (contractedValue < min(reflectedValue, values[worst])) {
+			for (int j = 0; j < DIM; j++) simplex[worst][j] = contracted[j];
+			values[worst] = contractedValue;
+			continue;
+		}
+
+		// shrink towards the best vertex
+		for (int i = 0; i <= DIM; i++) {
+			if (i == best) continue;
+			for (int j = 0; j < DIM; j++) simplex[i][j] = simplex[best][j] + 0.5 * (simplex[i][j] - simplex[best][j]);
+			values[i] = error(simplex[i]);
+		}
+	}
+
+	int best = 0;
+	for (int i = 1; i <= DIM; i++) {
+		if (values[i] < values[best]) best = i;
+	}
+	applyParams(ltc, simplex[best], isotropic);
+}
+
+/// <summary>
+/// Fits one roughness row of the table (all view angles).
+/// </summary>
+void fitRow(const Brdf& brdf, int size, int samples, int a, LTCTable& table) {
+	double roughness = a / double(size - 1);
+	double alpha = max(roughness * roughness, MIN_ALPHA);
+
+	LTC ltc;
+	for (int t = 0; t < size; t++) {
+		double x = t / double(size - 1);
+		double cosTheta = 1.0 - x * x;
+		double theta = min(1.57, acos(cosTheta));
+		Vec3 V(sin(theta), 0, cos(theta));
+
+		double norm, fresnel;
+		Vec3 averageDir;
+		computeAvgTerms(brdf, V, alpha, samples, norm, fresnel, averageDir);
+
+		bool isotropic;
+		if (t == 0) {
+			// the lobe is rotationally symmetric around the normal at normal incidence
+			ltc.X = Vec3(1, 0, 0);
+			ltc.Y = Vec3(0, 1, 0);
+			ltc.Z = Vec3(0, 0, 1);
+			ltc.m11 = max(alpha, 1e-3);
+			ltc.m22 = ltc.m11;
+			ltc.m13 = 0;
+			isotropic = true;
+		}
+		else {
+			// otherwise start from the previous fit, aligned with the average direction
+			ltc.X = Vec3(averageDir.z, 0, -averageDir.x);
+			ltc.Y = Vec3(0, 1, 0);
+			ltc.Z = averageDir;
+			isotropic = false;
+		}
+		ltc.magnitude = norm;
+		ltc.update();
+
+		fitNelderMead(ltc, brdf, V, alpha, samples, isotropic);
+
+		// store the inverse matrix, normalized by its middle element
+		Mat3 invM = ltc.invM;
+		double middle = invM.m[1][1];
+		int index = (a + t * size) * 4;
+		table.ltc1[index + 0] = float(invM.m[0][0] / middle);
+		table.ltc1[index + 1] = float(invM.m[2][0] / middle);
+		table.ltc1[index + 2] = float(invM.m[0][2] / middle);
+		table.ltc1[index + 3] = float(invM.m[2][2] / middle);
+
+		table.ltc2[index + 0] = float(norm);
+		table.ltc2[index + 1] = float(fresnel);
+		table.ltc2[index + 2] = 0.0f;
+	}
+}
+
+/// <summary>
+/// Fills ltc2.w with the horizon clipped sphere integral, indexed by
+/// (z * 0.5 + 0.5, form factor length). The shader multiplies it by the length.
+/// </summary>
+void computeSphereTable(int size, LTCTable& table) {
+	const int STEPS = 64;
+
+	for (int j = 0; j < size; j++) {
+		double len = j / double(size - 1);
+		double sinSigma = sqrt(len);
+		double cosSigma = sqrt(max(0.0, 1.0 - len));
+
+		for (int i = 0; i < size; i++) {
+			double z = 2.0 * i / double(size - 1) - 1.0;
+			Vec3 center(sqrt(max(0.0, 1.0 - z * z)), 0, z);
+			Vec3 t1(center.z, 0, -center.x);
+			Vec3 t2(0, 1, 0);
+
+			double scale;
+			if (len <= 0) {
+				scale = max(z, 0.0);
+			}
+			else {
+				// integrate the clamped cosine over the spherical cap
+				double integral = 0;
+				double dCos = (1.0 - cosSigma) / STEPS;
+				double dPsi = 2.0 * PI / STEPS;
+				for (int b = 0; b < STEPS; b++) {
+					double cosBeta = cosSigma + (b + 0.5) * dCos;
+					double sinBeta = sqrt(max(0.0, 1.0 - cosBeta * cosBeta));
+					for (int p = 0; p < STEPS; p++) {
+						double psi = (p + 0.5) * dPsi;
+						Vec3 dir = center * cosBeta + (t1 * cos(psi) + t2 * sin(psi)) * sinBeta;
+						integral += max(dir.z, 0.0) * dCos * dPsi;
+					}
+				}
+				scale = integral / PI / (sinSigma * sinSigma);
+			}
+			table.ltc2[(i + j * size) * 4 + 3] = float(scale);
+		}
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[]) {
+	string brdfName = "ggx";
+	int size = 64;
+	int samples = 32;
+	bool useHalf = true;
+	const char* output = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--brdf" && i + 1 < argc) brdfName = argv[++i];
+		else if (arg == "--size" && i + 1 < argc) size = atoi(argv[++i]);
+		else if (arg == "--samples" && i + 1 < argc) samples = atoi(argv[++i]);
+		else if (arg == "--float") useHalf = false;
+		else output = argv[i];
+	}
+
+	if (output == nullptr || size < 2 || samples < 1) {
+		cerr << "usage: ltcFit [--brdf ggx|beckmann] [--size 32|64|128] [--samples n] [--float] output.ltc" << endl;
+		return 1;
+	}
+
+	BrdfGGX ggx;
+	BrdfBeckmann beckmann;
+	const Brdf* brdf;
+	if (brdfName == "ggx") brdf = &ggx;
+	else if (brdfName == "beckmann") brdf = &beckmann;
+	else {
+		cerr << "Error: unknown brdf " << brdfName << endl;
+		return 1;
+	}
+
+	LTCTable table;
+	table.size = size;
+	table.ltc1.assign(size_t(size) * size * 4, 0.0f);
+	table.ltc2.assign(size_t(size) * size * 4, 0.0f);
+
+	// every roughness row is independent, so the rows are fitted in parallel
+	unsigned numThreads = max(1u, thread::hardware_concurrency());
+	vector<thread> workers;
+	for (unsigned w = 0; w < numThreads; w++) {
+		workers.emplace_back([&, w]() {
+			for (int a = int(w); a < size; a += int(numThreads)) {
+				fitRow(*brdf, size, samples, a, table);
+			}
+		});
+	}
+	for (thread& worker : workers) {
+		worker.join();
+	}
+
+	computeSphereTable(size, table);
+
+	if (!saveLTCTable(output, table, useHalf)) {
+		return 1;
+	}
+	cout << "wrote " << brdfName << " " << size << "x" << size << " LTC table to " << output << endl;
+	return 0;
+}
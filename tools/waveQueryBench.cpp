@@ -0,0 +1,174 @@
+// --------------------------------------------------------------------------------
+// Benchmark and validation of the batched wave height queries.
+//
+// Times WaveField::QueryHeights() (waveField.h) for 1k, 100k and 1M points on a
+// 100 x 100 patch of water: the scalar loop in double precision as reference,
+// then the direct evaluation (SSE unless built with WAVE_FIELD_NO_SSE) on one
+// thread and on a JobSystem, and the baked tile lookup. The errors of every path
+// against the reference are reported, for all the waves and for a footprint
+// that keeps only the waves the tile can represent.
+//
+// usage: waveQueryBench [waves] [workers] [trace.json]
+// The trace, if given, holds the jobs of one more query of 1M points.
+// --------------------------------------------------------------------------------
+
+#include <waveField.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+/// <summary>
+/// The waves of waveSetup() in main.cpp.
+/// </summary>
+struct Waves {
+	vector<float> amplitude, frequency, speed;
+	vector<cy::Vec2f> direction;
+
+	explicit Waves(int count) : amplitude(count), frequency(count), speed(count), direction(count) {
+		mt19937 rng(3);
+		uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		for (int i = 0; i < count; i++) {
+			amplitude[i] = i == 0 ? 1.0f : amplitude[i - 1] * 0.5f;
+			frequency[i] = i == 0 ? 1.0f : frequency[i - 1] * 1.3f;
+			speed[i] = float(rng() % 10);
+			float x = unit(rng), y = unit(rng);
+			float length = sqrt(x * x + y * y);
+			direction[i] = cy::Vec2f(x / length, y / length);
+		}
+	}
+};
+
+/// <summary>
+/// The wave loop of tessShader.tese in double precision.
+/// </summary>
+void reference(const Waves& waves, float time, float footprint, const vector<cy::Vec2f>& points, vector<double>& heights, vector<cy::Vec3f>& normals) {
+	heights.resize(points.size());
+	normals.resize(points.size());
+	for (size_t p = 0; p < points.size(); p++) {
+		double height = 0.0, slopeX = 0.0, slopeZ = 0.0, previous = 0.0;
+		for (size_t i = 0; i < waves.amplitude.size(); i++) {
+			double resolved = 1.0;
+			if (footprint > 0.0f) {
+				double t = min(max((6.283185307179586 / waves.frequency[i] / footprint - 2.0) / 2.0, 0.0), 1.0);
+				resolved = t * t * (3.0 - 2.0 * t);
+				if (resolved <= 0.0) break;
+			}
+			double angle = (waves.direction[i].x * (points[p].x + previous) + waves.direction[i].y * points[p].y) * waves.frequency[i]
+				+ double(time) * waves.speed[i];
+			double e = resolved * waves.amplitude[i] * exp(sin(angle) - 1.0);
+			double derivative = e * cos(angle) * waves.frequency[i];
+			height += e;
+			slopeX += waves.direction[i].x * derivative;
+			slopeZ += waves.direction[i].y * derivative;
+			previous = derivative;
+		}
+		heights[p] = height;
+		double length = sqrt(slopeX * slopeX + slopeZ * slopeZ + 1.0);
+		normals[p] = cy::Vec3f(float(-slopeX / length), float(1.0 / length), float(-slopeZ / length));
+	}
+}
+
+/// <summary>
+/// Runs a query until it took at least 200 ms, returns the milliseconds per query.
+/// </summary>
+template <typename Query>
+double timeQuery(Query query) {
+	int runs = 0;
+	auto start = chrono::steady_clock::now();
+	double ms = 0.0;
+	do {
+		query();
+		runs++;
+		ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	} while (ms < 200.0);
+	return ms / runs;
+}
+
+int main(int argc, char* argv[]) {
+	int numWaves = argc > 1 ? atoi(argv[1]) : 32;
+	unsigned numWorkers = argc > 2 ? unsigned(atoi(argv[2])) : 0;
+	const char* tracePath = argc > 3 ? argv[3] : nullptr;
+	Waves waves(numWaves);
+	WaveField field;
+	field.Set(numWaves, waves.amplitude.data(), waves.frequency.data(), waves.speed.data(), waves.direction.data());
+	JobSystem jobs(numWorkers);
+	const float time = 12.5f;
+	const float tileSize = 100.0f;
+	const int tileResolution = 1024;
+	// the waves left are longer than 2 footprints, the tile spacing must be 1/8 of them
+	const float tileFootprint = tileSize / (tileResolution - 1) * 4.0f * 1.01f;
+
+	mt19937 rng(9);
+	uniform_real_distribution<float> coordinate(-tileSize / 2, tileSize / 2);
+#ifdef WAVE_FIELD_SSE
+	const char* simd = "sse";
+#else
+	const char* simd = "scalar";
+#endif
+	printf("%s, %d waves, %u threads, tile %dx%d over %.0f units\n", simd, numWaves, jobs.Size(), tileResolution, tileResolution, tileSize);
+	printf("footprint  points    path        ms/query   Mpoints/s  maxHeightError  maxNormalError\n");
+	for (float footprint : { 0.0f, tileFootprint }) {
+		WaveQueryOptions options;
+		options.time = time;
+		options.footprint = footprint;
+		auto bakeStart = chrono::steady_clock::now();
+		options.jobs = &jobs;
+		field.BakeTile(options, cy::Vec2f(-tileSize / 2, -tileSize / 2), tileSize, tileResolution);
+		double bakeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - bakeStart).count();
+		printf("tile baked in %.1f ms, %s\n", bakeMs, field.TileMatches(time, footprint) ? "used" : "too coarse for these waves, not baked");
+
+		for (size_t count : { size_t(1000), size_t(100000), size_t(1000000) }) {
+			vector<cy::Vec2f> points(count);
+			for (cy::Vec2f& p : points) p = cy::Vec2f(coordinate(rng), coordinate(rng));
+			vector<double> expectedHeights;
+			vector<cy::Vec3f> expectedNormals;
+			auto referenceStart = chrono::steady_clock::now();
+			reference(waves, time, footprint, points, expectedHeights, expectedNormals);
+			double referenceMs = chrono::duration<double, milli>(chrono::steady_clock::now() - referenceStart).count();
+			printf("%9.4f  %7zu   reference   %9.3f  %10.2f\n", footprint, count, referenceMs, count / referenceMs / 1e3);
+
+			vector<float> heights(count);
+			vector<cy::Vec3f> normals(count);
+			struct Path { const char* name; bool threads; bool tile; };
+			for (Path path : { Path{ "direct", false, false }, Path{ "direct+jobs", true, false }, Path{ "tile+jobs", true, true } }) {
+				if (path.tile && !field.TileMatches(time, footprint)) {
+					continue;
+				}
+				options.jobs = path.threads ? &jobs : nullptr;
+				options.useTile = path.tile;
+				double ms = timeQuery([&] { field.QueryHeights(points.data(), count, heights.data(), normals.data(), options); });
+				double heightError = 0.0, normalError = 0.0;
+				for (size_t i = 0; i < count; i++) {
+					heightError = max(heightError, fabs(heights[i] - expectedHeights[i]));
+					cy::Vec3f d = normals[i] - expectedNormals[i];
+					normalError = max(normalError, double(d.Length()));
+				}
+				printf("%9.4f  %7zu   %-11s %9.3f  %10.2f  %14.2e  %14.2e\n", footprint, count, path.name, ms, count / ms / 1e3, heightError, normalError);
+			}
+		}
+	}
+
+	if (tracePath) {
+		vector<cy::Vec2f> points(1000000);
+		for (cy::Vec2f& p : points) p = cy::Vec2f(coordinate(rng), coordinate(rng));
+		vector<float> heights(points.size());
+		WaveQueryOptions options;
+		options.time = time;
+		options.jobs = &jobs;
+		Tracer::Clear();
+		field.QueryHeights(points.data(), points.size(), heights.data(), nullptr, options);
+		int events = Tracer::Write(tracePath);
+		if (events < 0) {
+			fprintf(stderr, "Error: Could not write %s\n", tracePath);
+			return 1;
+		}
+		printf("%d events traced to %s%s\n", events, tracePath, TraceEnabled ? "" : " (tracing compiled out)");
+	}
+	return 0;
+}
@@ -0,0 +1,299 @@
+// --------------------------------------------------------------------------------
+// In-process tracing of the frames, the passes and the loading.
+//
+// TRACE_SCOPE("name") times the rest of the scope as a zone, TRACE_COUNTER
+// records the value of a counter, and GpuTimers adds the GPU time of the
+// passes on a track of its own. Every thread appends its events to a buffer
+// of its own without locks. Tracer::Write() writes the events recorded since
+// the last write in the Chrome trace event format, to be opened in
+// chrome://tracing or https://ui.perfetto.dev; the thread moves its events
+// that were not written yet to the front of its buffer at its next event,
+// unless a write is in progress.
+//
+// The zones and counters compile out when TRACE_ENABLED is 0, by default in
+// builds with NDEBUG: TraceZone is then an empty class and the counters are
+// discarded by if constexpr.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef TRACE_ENABLED
+#ifdef NDEBUG
+#define TRACE_ENABLED 0
+#else
+#define TRACE_ENABLED 1
+#endif
+#endif
+
+constexpr bool TraceEnabled = TRACE_ENABLED != 0;
+
+/// <summary>
+/// The trace of the process: one event buffer per thread that recorded events.
+/// </summary>
+class Tracer {
+public:
+	static const size_t ChunkEvents = 16384;
+	static const size_t MaxChunks = 64;		// at most 1M events per thread between two writes, the rest is dropped
+
+	/// <summary>
+	/// The nanoseconds since the start of the process, the clock of every event.
+	/// </summary>
+	static int64_t Now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Instance().epoch).count();
+	}
+
+	/// <summary>
+	/// Names the calling thread in the trace.
+	/// </summary>
+	/// <param name="name"> the name, copied </param>
+	static void SetThreadName(const std::string& name) {
+		if (TraceEnabled) {
+			Buffer& buffer = ThreadBuffer();
+			std::lock_guard<std::mutex> lock(Instance().registerMutex);
+			buffer.name = name;
+		}
+	}
+
+	/// <summary>
+	/// Records a zone of the calling thread.
+	/// </summary>
+	/// <param name="name"> the name of the zone, a string that outlives the trace such as a literal </param>
+	static void Zone(const char* name, int64_t start, int64_t end) { Record(Event{ name, start, end, 0.0, Event::CpuZone }); }
+
+	/// <summary>
+	/// Records a zone of the GPU, in the clock of Now().
+	/// </summary>
+	static void GpuZone(const char* name, int64_t start, int64_t end) { Record(Event{ name, start, end, 0.0, Event::GpuZone }); }
+
+	/// <summary>
+	/// Records the value of a counter now.
+	/// </summary>
+	static void Counter(const char* name, double value) {
+		int64_t now = Now();
+		Record(Event{ name, now, now, value, Event::Counter });
+	}
+
+	/// <summary>
+	/// Writes the events recorded since the last write. The events recorded
+	/// while the file is written go to the next one.
+	/// </summary>
+	/// <param name="path"> the file to write </param>
+	/// <param name="dropped"> receives the events dropped because a buffer was full </param>
+	/// <returns> the number of events written, -1 if the file could not be written </returns>
+	static int Write(const char* path, size_t* dropped = nullptr) {
+		Tracer& tracer = Instance();
+		std::lock_guard<std::mutex> lock(tracer.writeMutex);
+		std::ofstream file(path);
+		if (!file) {
+			return -1;
+		}
+		std::vector<Buffer*> buffers;
+		std::vector<std::string> names;
+		{
+			std::lock_guard<std::mutex> registerLock(tracer.registerMutex);
+			for (const std::unique_ptr<Buffer>& buffer : tracer.buffers) {
+				buffers.push_back(buffer.get());
+				names.push_back(buffer->name.empty() ? "thread " + std::to_string(buffer->tid) : buffer->name);
+			}
+		}
+
+		file << std::fixed << std::setprecision(3);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << GpuTrack << ",\"args\":{\"name\":\"GPU\"}}";
+		int written = 0;
+		size_t totalDropped = 0;
+		for (size_t b = 0; b < buffers.size(); b++) {
+			Buffer* buffer = buffers[b];
+			file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid << ",\"args\":{\"name\":\"";
+			WriteString(file, names[b]);
+			file << "\"}}";
+			totalDropped += buffer->dropped.exchange(0, std::memory_order_relaxed);
+			// the owner only moves the events while holding writeMutex
+			size_t begin = buffer->written.load(std::memory_order_relaxed);
+			size_t count = buffer->count.load(std::memory_order_acquire);
+			for (size_t i = begin; i < count; i++) {
+				const Event& event = buffer->chunks[i / ChunkEvents].load(std::memory_order_acquire)[i % ChunkEvents];
+				file << ",\n{\"name\":\"";
+				WriteString(file, event.name);
+				file << "\",\"pid\":1,\"ts\":" << event.start * 1e-3;
+				if (event.kind == Event::Counter) {
+					file << ",\"ph\":\"C\",\"tid\":" << buffer->tid << ",\"args\":{\"value\":" << event.value << "}}";
+				}
+				else {
+					file << ",\"ph\":\"X\",\"dur\":" << (event.end - event.start) * 1e-3 << ",\"tid\":"
+						<< (event.kind == Event::GpuZone ? GpuTrack : buffer->tid) << "}";
+				}
+				written++;
+			}
+			buffer->written.store(count, std::memory_order_relaxed);
+		}
+		file << "\n]}\n";
+		if (dropped) {
+			*dropped = totalDropped;
+		}
+		return file ? written : -1;
+	}
+
+	/// <summary>
+	/// Drops the events recorded so far without writing them.
+	/// </summary>
+	static void Clear() {
+		Tracer& tracer = Instance();
+		std::lock_guard<std::mutex> lock(tracer.writeMutex);
+		std::lock_guard<std::mutex> registerLock(tracer.registerMutex);
+		for (const std::unique_ptr<Buffer>& buffer : tracer.buffers) {
+			buffer->written.store(buffer->count.load(std::memory_order_acquire), std::memory_order_relaxed);
+		}
+	}
+
+private:
+	static const int GpuTrack = 1000;	// the tid of the GPU zones
+
+	struct Event {
+		enum Kind : uint8_t { CpuZone, GpuZone, Counter };
+		const char* name;
+		int64_t start;
+		int64_t end;
+		double value;
+		Kind kind;
+	};
+
+	/// <summary>
+	/// The events of one thread. Only the thread appends to it, and the count is
+	/// published after the event is written, so a writer reads complete events
+	/// without locking. The events before written are in a file already.
+	/// </summary>
+	struct Buffer {
+		std::atomic<Event*> chunks[MaxChunks] = {};
+		std::atomic<size_t> count{ 0 };
+		std::atomic<size_t> written{ 0 };
+		std::atomic<size_t> dropped{ 0 };
+		int tid = 0;
+		std::string name;
+	};
+
+	static Tracer& Instance() {
+		// never destroyed: threads and atexit handlers may still record or write at exit
+		static Tracer* tracer = new Tracer();
+		return *tracer;
+	}
+
+	static Buffer& ThreadBuffer() {
+		thread_local Buffer* buffer = nullptr;
+		if (!buffer) {
+			Tracer& tracer = Instance();
+			std::lock_guard<std::mutex> lock(tracer.registerMutex);
+			tracer.buffers.emplace_back(new Buffer());
+			buffer = tracer.buffers.back().get();
+			buffer->tid = int(tracer.buffers.size());
+		}
+		return *buffer;
+	}
+
+	static void Record(const Event& event) {
+		if (!TraceEnabled) {
+			return;
+		}
+		Buffer& buffer = ThreadBuffer();
+		if (buffer.written.load(std::memory_order_relaxed) > 0) {
+			Compact(buffer);
+		}
+		size_t index = buffer.count.load(std::memory_order_relaxed);
+		if (index >= ChunkEvents * MaxChunks) {
+			buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		std::atomic<Event*>& chunk = buffer.chunks[index / ChunkEvents];
+		if (!chunk.load(std::memory_order_relaxed)) {
+			chunk.store(new Event[ChunkEvents], std::memory_order_release);
+		}
+		chunk.load(std::memory_order_relaxed)[index % ChunkEvents] = event;
+		buffer.count.store(index + 1, std::memory_order_release);
+	}
+
+	/// <summary>
+	/// Moves the events not written yet to the front of the buffer of the
+	/// calling thread, unless a write is in progress.
+	/// </summary>
+	static void Compact(Buffer& buffer) {
+		Tracer& tracer = Instance();
+		std::unique_lock<std::mutex> lock(tracer.writeMutex, std::try_to_lock);
+		if (!lock.owns_lock()) {
+			return;
+		}
+		size_t written = buffer.written.load(std::memory_order_relaxed);
+		size_t count = buffer.count.load(std::memory_order_relaxed);
+		for (size_t i = written; i < count; i++) {
+			buffer.chunks[(i - written) / ChunkEvents].load(std::memory_order_relaxed)[(i - written) % ChunkEvents] =
+				buffer.chunks[i / ChunkEvents].load(std::memory_order_relaxed)[i % ChunkEvents];
+		}
+		buffer.count.store(count - written, std::memory_order_relaxed);
+		buffer.written.store(0, std::memory_order_relaxed);
+	}
+
+	static void WriteString(std::ostream& out, const std::string& text) {
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				out << '\\';
+			}
+			out << c;
+		}
+	}
+
+	Tracer() : epoch(std::chrono::steady_clock::now()) {}
+
+	std::chrono::steady_clock::time_point epoch;
+	std::mutex registerMutex;					// guards the buffer list and the thread names
+	std::mutex writeMutex;						// held by Write() and Clear(), and by a thread moving its events
+	std::vector<std::unique_ptr<Buffer>> buffers;
+};
+
+/// <summary>
+/// Times its scope as a zone of the calling thread. Empty when tracing is compiled out.
+/// </summary>
+template <bool Enabled>
+class TraceZoneT {
+public:
+	explicit TraceZoneT(const char* name) : name(name), start(Tracer::Now()) {}
+	~TraceZoneT() { Tracer::Zone(name, start, Tracer::Now()); }
+
+	TraceZoneT(const TraceZoneT&) = delete;
+	TraceZoneT& operator=(const TraceZoneT&) = delete;
+
+private:
+	const char* name;
+	int64_t start;
+};
+
+template <>
+class TraceZoneT<false> {
+public:
+	explicit TraceZoneT(const char*) {}
+};
+
+typedef TraceZoneT<TraceEnabled> TraceZone;
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+/// <summary>
+/// Times the rest of the scope as a zone named by a string literal.
+/// </summary>
+#define TRACE_SCOPE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+
+/// <summary>
+/// Records the value of a counter named by a string literal. The value is not
+/// evaluated when tracing is compiled out.
+/// </summary>
+#define TRACE_COUNTER(name, value) do { if constexpr (TraceEnabled) { Tracer::Counter(name, double(value)); } } while (0)
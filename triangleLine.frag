@@ -1,7 +0,0 @@
-#version 330 core
-
-layout(location=0) out vec4 color;
-
-void main() {
-    color = vec4(0.5, 0.6, 0.8, 0.2);
-}
\ No newline at end of file
@@ -0,0 +1,226 @@
+// --------------------------------------------------------------------------------
+// Transform feedback capture of the displaced water surface for the CPU.
+//
+// The waves only exist inside the tessellation evaluation shader. For the game
+// logic (buoyancy, camera collision) a few patches are drawn again each frame
+// with the rasterizer off, and transform feedback writes the tessellated,
+// displaced vertices into one slot of a ring of FramesInFlight slots. A fence
+// follows the capture of every slot. In frame N the CPU reads the capture of
+// frame N - 2 while the one of frame N - 1 may still be in flight; the GPU has
+// usually long finished it, and the fence is only polled, never waited on.
+//
+// With GL_ARB_buffer_storage the ring is mapped once, persistently and
+// coherently, and a slot is copied straight out of the mapping. Without it the
+// slot is read with glGetBufferSubData, which does not stall either once the
+// fence has signaled.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+/// <summary>
+/// Captures tessellated vertices on the GPU and reads them back a few frames later.
+/// </summary>
+class WaveCapture {
+public:
+	static const int FramesInFlight = 3;
+
+	/// <summary>
+	/// A captured vertex, as written by the transform feedback varyings.
+	/// </summary>
+	struct Vertex {
+		float position[3];
+		float normal[3];
+	};
+
+	/// <summary>
+	/// Makes room for the given number of vertices per frame. Growing the ring
+	/// drops the captures still in flight.
+	/// </summary>
+	void Reserve(size_t vertices) {
+		if (vertices <= capacity) {
+			return;
+		}
+		Release();
+		capacity = std::max(vertices, capacity * 2);
+		slotSize = capacity * sizeof(Vertex);
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, buffer);
+		persistent = GLEW_ARB_buffer_storage != GL_FALSE;
+		if (persistent) {
+			GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_TRANSFORM_FEEDBACK_BUFFER, slotSize * FramesInFlight, nullptr, flags);
+			mapped = static_cast<const char*>(glMapBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, slotSize * FramesInFlight, flags));
+			persistent = mapped != nullptr;
+		}
+		else {
+			glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, slotSize * FramesInFlight, nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+		glGenQueries(FramesInFlight, queries);
+	}
+
+	/// <summary>
+	/// Captures the vertices of the triangles drawn by draw into the slot of this
+	/// frame. The current program must have the position and normal varyings
+	/// set up for interleaved transform feedback. Nothing is rasterized.
+	/// </summary>
+	template <typename DrawFunc>
+	void Capture(DrawFunc draw) {
+		int index = int(frame % FramesInFlight);
+		Slot& slot = slots[index];
+		frame++;
+		if (slot.fence) {
+			// the slot was never read back, it is overwritten
+			glDeleteSync(slot.fence);
+			slot.fence = nullptr;
+			dropped++;
+		}
+		if (buffer == 0) {
+			return;
+		}
+		glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer, GLintptr(slotSize * index), GLsizeiptr(slotSize));
+		glEnable(GL_RASTERIZER_DISCARD);
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, queries[index]);
+		glBeginTransformFeedback(GL_TRIANGLES);
+		draw();
+		glEndTransformFeedback();
+		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+		glDisable(GL_RASTERIZER_DISCARD);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slot.frame = frame - 1;
+		slot.submitted = std::chrono::steady_clock::now();
+	}
+
+	/// <summary>
+	/// Copies out the capture of two frames ago if the GPU is done with it,
+	/// without waiting. Call once per frame before Capture().
+	/// </summary>
+	/// <param name="vertices"> receives the vertices, 3 per triangle </param>
+	/// <returns> true if vertices holds a new capture </returns>
+	bool Read(std::vector<Vertex>& vertices) {
+		int index = int((frame + 1) % FramesInFlight);
+		Slot& slot = slots[index];
+		if (!slot.fence) {
+			return false;
+		}
+		GLint available = GL_FALSE;
+		if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+			notReady++;
+			return false;
+		}
+		glGetQueryObjectiv(queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			notReady++;
+			return false;
+		}
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+
+		auto start = std::chrono::steady_clock::now();
+		GLuint triangles = 0;
+		glGetQueryObjectuiv(queries[index], GL_QUERY_RESULT, &triangles);
+		size_t count = std::min(size_t(triangles) * 3, capacity);
+		vertices.resize(count);
+		size_t bytes = count * sizeof(Vertex);
+		if (persistent) {
+			memcpy(vertices.data(), mapped + slotSize * index, bytes);
+		}
+		else if (count > 0) {
+			glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, buffer);
+			glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, GLintptr(slotSize * index), GLsizeiptr(bytes), vertices.data());
+			glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		totalLatencyMs += std::chrono::duration<double, std::milli>(end - slot.submitted).count();
+		totalLatencyFrames += frame - slot.frame;
+		totalReadMs += std::chrono::duration<double, std::milli>(end - start).count();
+		totalBytes += double(bytes);
+		reads++;
+		return true;
+	}
+
+	/// <summary>
+	/// Whether the ring is persistently mapped.
+	/// </summary>
+	bool IsPersistent() const { return persistent; }
+
+	/// <summary>
+	/// Prints the readback latency and bandwidth since the last report, and resets them.
+	/// </summary>
+	/// <param name="out"> the stream </param>
+	/// <param name="seconds"> the time since the last report </param>
+	void Report(std::ostream& out, double seconds) {
+		out << "wave capture (" << (persistent ? "persistent map" : "glGetBufferSubData") << "): ";
+		if (reads > 0) {
+			out << totalBytes / reads / 1024.0 << " KB per frame, latency " << double(totalLatencyFrames) / reads << " frames "
+				<< totalLatencyMs / reads << " ms, copy " << totalReadMs / reads << " ms ("
+				<< (totalReadMs > 0.0 ? totalBytes / (totalReadMs * 1e-3) / 1e9 : 0.0) << " GB/s), "
+				<< totalBytes / seconds / 1e6 << " MB/s read back";
+		}
+		else {
+			out << "nothing read back";
+		}
+		out << ", " << notReady << " not ready, " << dropped << " dropped" << std::endl;
+		reads = 0;
+		notReady = 0;
+		dropped = 0;
+		totalLatencyMs = 0.0;
+		totalLatencyFrames = 0;
+		totalReadMs = 0.0;
+		totalBytes = 0.0;
+	}
+
+private:
+	struct Slot {
+		GLsync fence = nullptr;
+		long long frame = 0;
+		std::chrono::steady_clock::time_point submitted;
+	};
+
+	void Release() {
+		for (Slot& slot : slots) {
+			if (slot.fence) {
+				glDeleteSync(slot.fence);
+				slot.fence = nullptr;
+			}
+		}
+		if (buffer != 0) {
+			if (persistent) {
+				glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, buffer);
+				glUnmapBuffer(GL_TRANSFORM_FEEDBACK_BUFFER);
+				glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+			}
+			glDeleteBuffers(1, &buffer);
+			glDeleteQueries(FramesInFlight, queries);
+			buffer = 0;
+			mapped = nullptr;
+		}
+	}
+
+	GLuint buffer = 0;
+	GLuint queries[FramesInFlight] = {};
+	Slot slots[FramesInFlight];
+	const char* mapped = nullptr;
+	bool persistent = false;
+	size_t capacity = 0;				// vertices per slot
+	size_t slotSize = 0;				// bytes per slot
+	long long frame = 0;
+
+	int reads = 0;
+	int notReady = 0;
+	int dropped = 0;
+	double totalLatencyMs = 0.0;
+	long long totalLatencyFrames = 0;
+	double totalReadMs = 0.0;
+	double totalBytes = 0.0;
+};
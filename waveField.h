@@ -0,0 +1,318 @@
+// --------------------------------------------------------------------------------
+// Batched evaluation of the wave field on the CPU.
+//
+// Game logic (floating objects, collisions) needs the height and normal of the
+// water at many points per tick. QueryHeights() evaluates the same sum of
+// exponentiated sines as tessShader.tese for a batch of points: with SSE, 4
+// points go through the wave loop at once with polynomial sin, cos and exp, and
+// large batches are split into chunks run as jobs of a JobSystem.
+//
+// Like the shader, waves shorter than 2 to 4 times a footprint can be faded out.
+// When the footprint leaves only waves long enough, a heightfield tile baked
+// once per tick answers the queries inside it with a bilinear lookup instead,
+// in constant time per point whatever the number of waves.
+// --------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cyVector.h>
+#include <jobSystem.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if !defined(WAVE_FIELD_NO_SSE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define WAVE_FIELD_SSE 1
+#include <emmintrin.h>
+#endif
+
+/// <summary>
+/// How a batch of points is evaluated.
+/// </summary>
+struct WaveQueryOptions {
+	float time = 0.0f;
+	float footprint = 0.0f;		// waves shorter than 2 to 4 footprints fade out as in tessShader.tese, 0 keeps every wave
+	bool useTile = false;		// look up the baked tile where it is precise enough
+	JobSystem* jobs = nullptr;	// splits large batches into jobs, nullptr runs on the calling thread
+};
+
+/// <summary>
+/// The waves of the water, evaluated on the CPU.
+/// </summary>
+class WaveField {
+public:
+	static const size_t ChunkSize = 4096;	// points per task when a batch is split
+
+	/// <summary>
+	/// Copies the wave parameters, the same arrays the shaders get. The waves are
+	/// sorted by frequency.
+	/// </summary>
+	void Set(int count, const float* amplitude, const float* frequency, const float* speed, const cy::Vec2f* direction) {
+		waves.resize(std::max(count, 0));
+		for (int i = 0; i < count; i++) {
+			waves[i] = { amplitude[i], frequency[i], speed[i], direction[i].x, direction[i].y };
+		}
+		tile.resolution = 0;
+	}
+
+	/// <summary>
+	/// Evaluates the height of the water and, if normals is not null, its unit
+	/// normal (y up) at every point.
+	/// </summary>
+	/// <param name="positions"> the points on the water plane, x and z </param>
+	/// <param name="count"> the number of points </param>
+	/// <param name="heights"> receives the heights </param>
+	/// <param name="normals"> receives the normals, may be null </param>
+	/// <param name="options"> time, footprint, tile and threads </param>
+	void QueryHeights(const cy::Vec2f* positions, size_t count, float* heights, cy::Vec3f* normals, const WaveQueryOptions& options) const {
+		std::vector<Term> terms = Terms(options.time, options.footprint);
+		bool lookup = options.useTile && TileMatches(options.time, options.footprint);
+		auto work = [&](size_t begin, size_t end) {
+			if (lookup) {
+				for (size_t i = begin; i < end; i++) {
+					if (!LookupTile(positions[i], heights[i], normals ? &normals[i] : nullptr)) {
+						Evaluate(terms, positions + i, 1, heights + i, normals ? normals + i : nullptr);
+					}
+				}
+			}
+			else {
+				Evaluate(terms, positions + begin, end - begin, heights + begin, normals ? normals + begin : nullptr);
+			}
+		};
+
+		if (options.jobs == nullptr) {
+			work(0, count);
+			return;
+		}
+		// the calling thread runs chunks too while it waits for the rest
+		options.jobs->ParallelFor("wave query", count, ChunkSize, work);
+	}
+
+	/// <summary>
+	/// Bakes the heights and slopes of a square of the water for the tile
+	/// lookups of the queries with the same time and footprint. The tile is only
+	/// baked when its spacing is at most 1/8 of the shortest wave left by the
+	/// footprint; otherwise the queries keep evaluating the waves.
+	/// </summary>
+	/// <param name="options"> time, footprint and threads of the queries to answer </param>
+	/// <param name="origin"> the corner of the tile with the smallest x and z </param>
+	/// <param name="size"> the width of the tile </param>
+	/// <param name="resolution"> the number of samples along each side </param>
+	void BakeTile(const WaveQueryOptions& options, cy::Vec2f origin, float size, int resolution) {
+		resolution = std::max(resolution, 2);
+		float spacing = size / float(resolution - 1);
+		std::vector<Term> terms = Terms(options.time, options.footprint);
+		float shortest = terms.empty() ? 0.0f : 6.2831853f / terms.back().frequency;
+		tile.resolution = 0;
+		if (spacing > shortest / 8.0f) {
+			return; // too coarse for these waves
+		}
+
+		std::vector<cy::Vec2f> samples(size_t(resolution) * resolution);
+		for (int z = 0; z < resolution; z++) {
+			for (int x = 0; x < resolution; x++) {
+				samples[size_t(z) * resolution + x] = cy::Vec2f(origin.x + x * spacing, origin.y + z * spacing);
+			}
+		}
+		std::vector<float> heights(samples.size());
+		std::vector<cy::Vec3f> normals(samples.size());
+		WaveQueryOptions exact = options;
+		exact.useTile = false;
+		QueryHeights(samples.data(), samples.size(), heights.data(), normals.data(), exact);
+
+		tile.time = options.time;
+		tile.footprint = options.footprint;
+		tile.origin = origin;
+		tile.spacing = spacing;
+		tile.resolution = resolution;
+		tile.samples.resize(samples.size());
+		for (size_t i = 0; i < samples.size(); i++) {
+			// the slopes interpolate better than the normals
+			tile.samples[i] = { heights[i], -normals[i].x / normals[i].y, -normals[i].z / normals[i].y };
+		}
+	}
+
+	/// <summary>
+	/// Whether the queries with these options are answered by the tile.
+	/// </summary>
+	bool TileMatches(float time, float footprint) const {
+		return tile.resolution > 0 && tile.time == time && tile.footprint == footprint;
+	}
+
+private:
+	struct Wave {
+		float amplitude, frequency, speed, directionX, directionZ;
+	};
+
+	/// <summary>
+	/// A wave at a given time: the amplitude is faded by the footprint and the speed is a phase.
+	/// </summary>
+	struct Term {
+		float amplitude, frequency, phase, directionX, directionZ;
+	};
+
+	struct TileSample {
+		float height, slopeX, slopeZ;
+	};
+
+	struct Tile {
+		float time = 0.0f;
+		float footprint = 0.0f;
+		cy::Vec2f origin;
+		float spacing = 1.0f;
+		int resolution = 0;				// 0 when there is no tile
+		std::vector<TileSample> samples;
+	};
+
+	std::vector<Term> Terms(float time, float footprint) const {
+		std::vector<Term> terms;
+		for (const Wave& wave : waves) {
+			float resolved = 1.0f;
+			if (footprint > 0.0f) {
+				// smoothstep(2, 4, wavelength / footprint), and every shorter wave is gone too
+				float t = std::min(std::max((6.2831853f / wave.frequency / footprint - 2.0f) / 2.0f, 0.0f), 1.0f);
+				resolved = t * t * (3.0f - 2.0f * t);
+				if (resolved <= 0.0f) {
+					break;
+				}
+			}
+			terms.push_back({ resolved * wave.amplitude, wave.frequency, time * wave.speed, wave.directionX, wave.directionZ });
+		}
+		return terms;
+	}
+
+	bool LookupTile(const cy::Vec2f& p, float& height, cy::Vec3f* normal) const {
+		float fx = (p.x - tile.origin.x) / tile.spacing;
+		float fz = (p.y - tile.origin.y) / tile.spacing;
+		if (!(fx >= 0.0f && fz >= 0.0f && fx <= float(tile.resolution - 1) && fz <= float(tile.resolution - 1))) {
+			return false;
+		}
+		int x = std::min(int(fx), tile.resolution - 2);
+		int z = std::min(int(fz), tile.resolution - 2);
+		float tx = fx - x, tz = fz - z;
+		const TileSample* row0 = &tile.samples[size_t(z) * tile.resolution + x];
+		const TileSample* row1 = row0 + tile.resolution;
+		float w00 = (1.0f - tx) * (1.0f - tz), w10 = tx * (1.0f - tz), w01 = (1.0f - tx) * tz, w11 = tx * tz;
+		height = w00 * row0[0].height + w10 * row0[1].height + w01 * row1[0].height + w11 * row1[1].height;
+		if (normal) {
+			float slopeX = w00 * row0[0].slopeX + w10 * row0[1].slopeX + w01 * row1[0].slopeX + w11 * row1[1].slopeX;
+			float slopeZ = w00 * row0[0].slopeZ + w10 * row0[1].slopeZ + w01 * row1[0].slopeZ + w11 * row1[1].slopeZ;
+			*normal = Normal(slopeX, slopeZ);
+		}
+		return true;
+	}
+
+	static cy::Vec3f Normal(float slopeX, float slopeZ) {
+		float inverseLength = 1.0f / std::sqrt(slopeX * slopeX + slopeZ * slopeZ + 1.0f);
+		return cy::Vec3f(-slopeX * inverseLength, inverseLength, -slopeZ * inverseLength);
+	}
+
+	/// <summary>
+	/// The wave loop of tessShader.tese for a run of points.
+	/// </summary>
+	static void Evaluate(const std::vector<Term>& terms, const cy::Vec2f* positions, size_t count, float* heights, cy::Vec3f* normals) {
+		size_t i = 0;
+#ifdef WAVE_FIELD_SSE
+		for (; i + 4 <= count; i += 4) {
+			const cy::Vec2f* p = positions + i;
+			const __m128 x = _mm_set_ps(p[3].x, p[2].x, p[1].x, p[0].x);
+			const __m128 z = _mm_set_ps(p[3].y, p[2].y, p[1].y, p[0].y);
+			const __m128 one = _mm_set1_ps(1.0f);
+			__m128 height = _mm_setzero_ps(), slopeX = _mm_setzero_ps(), slopeZ = _mm_setzero_ps();
+			__m128 previousDerivative = _mm_setzero_ps();
+			for (const Term& term : terms) {
+				// the previous wave shifts the phase of the next one along x
+				__m128 shiftedX = _mm_add_ps(x, previousDerivative);
+				__m128 dot = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(term.directionX), shiftedX), _mm_mul_ps(_mm_set1_ps(term.directionZ), z));
+				__m128 angle = _mm_add_ps(_mm_mul_ps(dot, _mm_set1_ps(term.frequency)), _mm_set1_ps(term.phase));
+				__m128 s, c;
+				SinCos4(angle, s, c);
+				__m128 e = _mm_mul_ps(_mm_set1_ps(term.amplitude), Exp4(_mm_sub_ps(s, one)));
+				__m128 derivative = _mm_mul_ps(_mm_mul_ps(e, c), _mm_set1_ps(term.frequency));
+				height = _mm_add_ps(height, e);
+				slopeX = _mm_add_ps(slopeX, _mm_mul_ps(_mm_set1_ps(term.directionX), derivative));
+				slopeZ = _mm_add_ps(slopeZ, _mm_mul_ps(_mm_set1_ps(term.directionZ), derivative));
+				previousDerivative = derivative;
+			}
+			_mm_storeu_ps(heights + i, height);
+			if (normals) {
+				float sx[4], sz[4];
+				_mm_storeu_ps(sx, slopeX);
+				_mm_storeu_ps(sz, slopeZ);
+				for (int k = 0; k < 4; k++) normals[i + k] = Normal(sx[k], sz[k]);
+			}
+		}
+#endif
+		// the rest of the points, or all of them without SSE
+		for (; i < count; i++) {
+			float height = 0.0f, slopeX = 0.0f, slopeZ = 0.0f, previousDerivative = 0.0f;
+			for (const Term& term : terms) {
+				float angle = (term.directionX * (positions[i].x + previousDerivative) + term.directionZ * positions[i].y) * term.frequency + term.phase;
+				float e = term.amplitude * std::exp(std::sin(angle) - 1.0f);
+				float derivative = e * std::cos(angle) * term.frequency;
+				height += e;
+				slopeX += term.directionX * derivative;
+				slopeZ += term.directionZ * derivative;
+				previousDerivative = derivative;
+			}
+			heights[i] = height;
+			if (normals) {
+				normals[i] = Normal(slopeX, slopeZ);
+			}
+		}
+	}
+
+#ifdef WAVE_FIELD_SSE
+	/// <summary>
+	/// sin and cos of 4 angles: reduced to [-pi/4, pi/4] by quarter turns, then
+	/// the minimax polynomials of Cephes sinf and cosf. About 1e-7 absolute error
+	/// for angles up to 1e5.
+	/// </summary>
+	static void SinCos4(__m128 x, __m128& s, __m128& c) {
+		__m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.63661977f)));
+		__m128 j = _mm_cvtepi32_ps(quadrant);
+		// pi / 2 in three parts so that j * part is exact
+		x = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(1.5703125f)));
+		x = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(4.8375129699707031e-4f)));
+		x = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(7.5497899548918822e-8f)));
+		__m128 x2 = _mm_mul_ps(x, x);
+		__m128 sinPoly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), x2), _mm_set1_ps(8.3321608736e-3f));
+		sinPoly = _mm_add_ps(_mm_mul_ps(sinPoly, x2), _mm_set1_ps(-1.6666654611e-1f));
+		sinPoly = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinPoly, x2), x), x);
+		__m128 cosPoly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), x2), _mm_set1_ps(-1.388731625493765e-3f));
+		cosPoly = _mm_add_ps(_mm_mul_ps(cosPoly, x2), _mm_set1_ps(4.166664568298827e-2f));
+		cosPoly = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cosPoly, x2), x2), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), x2)));
+		// odd quadrants swap sin and cos, the signs follow the quadrant
+		__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+		__m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+		__m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+		s = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, cosPoly), _mm_andnot_ps(swap, sinPoly)), sinSign);
+		c = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, sinPoly), _mm_andnot_ps(swap, cosPoly)), cosSign);
+	}
+
+	/// <summary>
+	/// exp of 4 values in [-87, 88]: 2^n times a polynomial of the remainder.
+	/// About 2 ulp of error.
+	/// </summary>
+	static __m128 Exp4(__m128 x) {
+		__m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)));
+		__m128 nf = _mm_cvtepi32_ps(n);
+		// ln 2 in two parts
+		x = _mm_sub_ps(x, _mm_mul_ps(nf, _mm_set1_ps(0.693359375f)));
+		x = _mm_sub_ps(x, _mm_mul_ps(nf, _mm_set1_ps(-2.12194440e-4f)));
+		__m128 p = _mm_set1_ps(1.9875691500e-4f);
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(1.3981999507e-3f));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(8.3334519073e-3f));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(4.1665795894e-2f));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(1.6666665459e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(5.0000001201e-1f));
+		p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, x), x), _mm_add_ps(x, _mm_set1_ps(1.0f)));
+		__m128i exponent = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+		return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+	}
+#endif
+
+	std::vector<Wave> waves;
+	Tile tile;
+};